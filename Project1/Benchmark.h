@@ -0,0 +1,181 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// command line of the benchmark runner
+//   --headless       render offscreen without a window or ImGui
+//   --frames N       frames measured
+//   --warmup N       frames rendered before measuring (shader compilation,
+//                    first uploads, shadow map fill)
+//   --width W --height H
+//   --out path       JSON report file, stdout when omitted
+//   --gl M.m         OpenGL version requested, 3.3 by default. 4.3 enables
+//                    the multi draw indirect path (a newer context created
+//                    for a 3.3 request does not), 3.3 is used when the
+//                    driver cannot create the requested version
+//   --gpu-culling    frustum culls the scene and shadow casters in a compute
+//                    shader, needs a 4.3 context (--gl 4.3)
+//   --rock-field N   N instanced rocks around a planet outside of the room
+//                    (resources/models/planet, rock), none by default
+struct BenchmarkOptions
+{
+    bool headless = false;
+    int frames = 600;
+    int warmupFrames = 60;
+    int width = 1920;
+    int height = 1080;
+    std::string outputPath;
+    int glMajor = 3;
+    int glMinor = 3;
+    bool gpuCulling = false;
+    int rockFieldInstances = 0;
+
+    // drivers may create a newer context than requested (4.6 for 3.3), the
+    // paths of newer versions follow the request, not the context
+    bool requestsGL(int major, int minor) const
+    {
+        return glMajor * 10 + glMinor >= major * 10 + minor;
+    }
+};
+
+inline bool
+parseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* argument = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(argument, "--headless") == 0)
+        {
+            options.headless = true;
+        }
+        else if (strcmp(argument, "--gpu-culling") == 0)
+        {
+            options.gpuCulling = true;
+        }
+        else if (strcmp(argument, "--rock-field") == 0 && hasValue)
+        {
+            options.rockFieldInstances = atoi(argv[++i]);
+        }
+        else if (strcmp(argument, "--frames") == 0 && hasValue)
+        {
+            options.frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argument, "--warmup") == 0 && hasValue)
+        {
+            options.warmupFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argument, "--width") == 0 && hasValue)
+        {
+            options.width = atoi(argv[++i]);
+        }
+        else if (strcmp(argument, "--height") == 0 && hasValue)
+        {
+            options.height = atoi(argv[++i]);
+        }
+        else if (strcmp(argument, "--out") == 0 && hasValue)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (strcmp(argument, "--gl") == 0 && hasValue)
+        {
+            const char* version = argv[++i];
+            const char* dot = strchr(version, '.');
+            options.glMajor = atoi(version);
+            options.glMinor = dot ? atoi(dot + 1) : 0;
+        }
+        else
+        {
+            std::cout << "ERROR::BENCHMARK::UNKNOWN_ARGUMENT " << argument
+                      << std::endl;
+            return false;
+        }
+    }
+
+    if (options.frames <= 0 || options.warmupFrames < 0 ||
+        options.width <= 0 || options.height <= 0 ||
+        options.rockFieldInstances < 0 ||
+        !options.requestsGL(3, 3))
+    {
+        std::cout << "ERROR::BENCHMARK::INVALID_ARGUMENTS" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Frame times of a benchmark run and their statistics
+class BenchmarkResults
+{
+  public:
+    void addFrame(double milliseconds) { frameTimes.push_back(milliseconds); }
+
+    size_t size() const { return frameTimes.size(); }
+
+    // JSON report, frame times in milliseconds
+    void write(std::ostream& out,
+               const std::string& renderer,
+               int width,
+               int height) const
+    {
+        std::vector<double> sorted = frameTimes;
+        std::sort(sorted.begin(), sorted.end());
+
+        double total = 0.0;
+        for (double time : sorted)
+        {
+            total += time;
+        }
+        double mean = sorted.empty() ? 0.0 : total / sorted.size();
+
+        out << "{\n";
+        out << "  \"renderer\": \"" << escape(renderer) << "\",\n";
+        out << "  \"width\": " << width << ",\n";
+        out << "  \"height\": " << height << ",\n";
+        out << "  \"frames\": " << sorted.size() << ",\n";
+        out << "  \"frame_ms\": {\n";
+        out << "    \"mean\": " << mean << ",\n";
+        out << "    \"p50\": " << percentile(sorted, 0.50) << ",\n";
+        out << "    \"p95\": " << percentile(sorted, 0.95) << ",\n";
+        out << "    \"p99\": " << percentile(sorted, 0.99) << ",\n";
+        out << "    \"max\": " << (sorted.empty() ? 0.0 : sorted.back())
+            << "\n";
+        out << "  }\n";
+        out << "}\n";
+    }
+
+  private:
+    std::vector<double> frameTimes;
+
+    // nearest rank percentile of sorted values
+    static double percentile(const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0.0;
+
+        size_t rank = (size_t)std::ceil(p * sorted.size());
+        return sorted[std::clamp(rank, (size_t)1, sorted.size()) - 1];
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+#endif
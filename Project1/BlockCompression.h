@@ -0,0 +1,409 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// GPU block compression formats, each 4x4 texel block is stored in 8 (BC1,
+// BC4) or 16 (BC3, BC5) bytes
+enum class BlockFormat : uint32_t
+{
+    None = 0,
+    // RGB, 4 bits per texel
+    BC1 = 1,
+    // RGBA, BC1 color with a BC4 alpha, 8 bits per texel
+    BC3 = 3,
+    // single channel, 4 bits per texel
+    BC4 = 4,
+    // two channels (normal map x and y), 8 bits per texel
+    BC5 = 5
+};
+
+inline size_t
+getBlockSize(BlockFormat format)
+{
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+namespace BlockCompression
+{
+// 5:6:5 color of a BC1 endpoint, and its expansion back to 8 bits the way
+// the GPU decodes it
+inline uint16_t
+packColor(const float color[3])
+{
+    int r = std::clamp((int)std::lround(color[0] * 31.0f / 255.0f), 0, 31);
+    int g = std::clamp((int)std::lround(color[1] * 63.0f / 255.0f), 0, 63);
+    int b = std::clamp((int)std::lround(color[2] * 31.0f / 255.0f), 0, 31);
+    return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+inline void
+unpackColor(uint16_t packed, float color[3])
+{
+    int r = packed >> 11 & 31;
+    int g = packed >> 5 & 63;
+    int b = packed & 31;
+    color[0] = (float)(r << 3 | r >> 2);
+    color[1] = (float)(g << 2 | g >> 4);
+    color[2] = (float)(b << 3 | b >> 2);
+}
+
+// palette of a 4 color BC1 block
+inline void
+getPalette(uint16_t color0, uint16_t color1, float palette[4][3])
+{
+    unpackColor(color0, palette[0]);
+    unpackColor(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+}
+
+// nearest palette entry of every texel, returns the total squared error
+inline float
+selectColorIndices(const float texels[16][3],
+                   uint16_t color0,
+                   uint16_t color1,
+                   uint8_t indices[16])
+{
+    float palette[4][3];
+    getPalette(color0, color1, palette);
+
+    float error = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        float best = INFINITY;
+        for (int p = 0; p < 4; p++)
+        {
+            float distance = 0.0f;
+            for (int c = 0; c < 3; c++)
+            {
+                float d = texels[i][c] - palette[p][c];
+                distance += d * d;
+            }
+            if (distance < best)
+            {
+                best = distance;
+                indices[i] = (uint8_t)p;
+            }
+        }
+        error += best;
+    }
+    return error;
+}
+
+// endpoints minimizing the squared error of the texels for fixed indices
+inline bool
+fitEndpoints(const float texels[16][3],
+             const uint8_t indices[16],
+             float endpoint0[3],
+             float endpoint1[3])
+{
+    static const float WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float a = WEIGHTS[indices[i]];
+        float b = 1.0f - a;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (int c = 0; c < 3; c++)
+        {
+            ax[c] += a * texels[i][c];
+            bx[c] += b * texels[i][c];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+
+    for (int c = 0; c < 3; c++)
+    {
+        endpoint0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+        endpoint1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+    }
+    return true;
+}
+
+// color part of BC1 and BC3 blocks. The endpoints start at the extremes of
+// the texels along their principal axis, slightly inset, and are refined
+// once by least squares when that lowers the error. Always in 4 color mode
+// (color0 > color1) as BC3 requires.
+inline void
+encodeColorBlock(const float texels[16][3], unsigned char* block)
+{
+    float mean[3] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            mean[c] += texels[i][c] / 16.0f;
+        }
+    }
+
+    float covariance[6] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float r = texels[i][0] - mean[0];
+        float g = texels[i][1] - mean[1];
+        float b = texels[i][2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // principal axis by power iteration, from the channel varying the most:
+    // a fixed start such as (1, 1, 1) is orthogonal to the axis of colors
+    // changing in opposite directions (red against green)
+    const float variances[3] = { covariance[0], covariance[3], covariance[5] };
+    float axis[3] = {};
+    axis[std::max_element(variances, variances + 3) - variances] = 1.0f;
+
+    bool collapsed = false;
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] +
+                  covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] +
+                  covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] +
+                  covariance[5] * axis[2];
+
+        float length = std::max({ std::fabs(x), std::fabs(y), std::fabs(z) });
+        if (length < 1e-6f)
+        {
+            collapsed = true;
+            break;
+        }
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+
+    float lowest = INFINITY, highest = -INFINITY;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < 3; c++)
+        {
+            t += (texels[i][c] - mean[c]) * axis[c];
+        }
+        lowest = std::min(lowest, t);
+        highest = std::max(highest, t);
+    }
+
+    float axisLength =
+      axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float inset = (highest - lowest) / 16.0f;
+    float endpoint0[3], endpoint1[3];
+    for (int c = 0; c < 3; c++)
+    {
+        float direction = axisLength > 0.0f ? axis[c] / axisLength : 0.0f;
+        endpoint0[c] = mean[c] + direction * (highest - inset);
+        endpoint1[c] = mean[c] + direction * (lowest + inset);
+    }
+
+    // no axis found (tiny variances), the corners of the texels' box
+    if (collapsed)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            endpoint0[c] = texels[0][c];
+            endpoint1[c] = texels[0][c];
+            for (int i = 1; i < 16; i++)
+            {
+                endpoint0[c] = std::max(endpoint0[c], texels[i][c]);
+                endpoint1[c] = std::min(endpoint1[c], texels[i][c]);
+            }
+        }
+    }
+
+    uint16_t color0 = packColor(endpoint0);
+    uint16_t color1 = packColor(endpoint1);
+    uint8_t indices[16];
+    float error = selectColorIndices(texels, color0, color1, indices);
+
+    if (fitEndpoints(texels, indices, endpoint0, endpoint1))
+    {
+        uint16_t fitted0 = packColor(endpoint0);
+        uint16_t fitted1 = packColor(endpoint1);
+        uint8_t fittedIndices[16];
+        if (selectColorIndices(texels, fitted0, fitted1, fittedIndices) <
+            error)
+        {
+            color0 = fitted0;
+            color1 = fitted1;
+            std::memcpy(indices, fittedIndices, sizeof(indices));
+        }
+    }
+
+    // 4 color mode needs color0 > color1, swapping the endpoints swaps the
+    // indices 0 <-> 1 and 2 <-> 3
+    if (color0 < color1)
+    {
+        std::swap(color0, color1);
+        for (uint8_t& index : indices)
+        {
+            index ^= 1;
+        }
+    }
+    else if (color0 == color1)
+    {
+        std::memset(indices, 0, sizeof(indices));
+    }
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        bits |= (uint32_t)indices[i] << (2 * i);
+    }
+
+    std::memcpy(block, &color0, 2);
+    std::memcpy(block + 2, &color1, 2);
+    std::memcpy(block + 4, &bits, 4);
+}
+
+// single channel block of BC3 alpha, BC4 and BC5, in 8 value mode between
+// the extremes of the texels
+inline void
+encodeChannelBlock(const float texels[16], unsigned char* block)
+{
+    float lowest = *std::min_element(texels, texels + 16);
+    float highest = *std::max_element(texels, texels + 16);
+
+    uint8_t value0 = (uint8_t)std::lround(highest);
+    uint8_t value1 = (uint8_t)std::lround(lowest);
+
+    float palette[8];
+    palette[0] = value0;
+    palette[1] = value1;
+    for (int i = 1; i < 7; i++)
+    {
+        palette[i + 1] = ((7 - i) * value0 + i * value1) / 7.0f;
+    }
+
+    uint64_t bits = 0;
+    if (value0 != value1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            uint64_t index = 0;
+            float best = INFINITY;
+            for (int p = 0; p < 8; p++)
+            {
+                float distance = std::fabs(texels[i] - palette[p]);
+                if (distance < best)
+                {
+                    best = distance;
+                    index = p;
+                }
+            }
+            bits |= index << (3 * i);
+        }
+    }
+
+    block[0] = value0;
+    block[1] = value1;
+    for (int i = 0; i < 6; i++)
+    {
+        block[2 + i] = (unsigned char)(bits >> (8 * i));
+    }
+}
+
+} // namespace BlockCompression
+
+// byte size of a width x height level, partial blocks at the edges count
+// as whole blocks
+inline size_t
+getCompressedSize(BlockFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+           getBlockSize(format);
+}
+
+// compresses an 8 bit per channel image (1 to 4 components). BC1 and BC3
+// read RGB(A), a single channel image is read as gray, BC4 reads the first
+// channel and BC5 the first two.
+inline void
+compressImage(const unsigned char* pixels,
+              int width,
+              int height,
+              int components,
+              BlockFormat format,
+              unsigned char* destination)
+{
+    size_t blockSize = getBlockSize(format);
+
+    for (int blockY = 0; blockY < height; blockY += 4)
+    {
+        for (int blockX = 0; blockX < width; blockX += 4)
+        {
+            // RGBA of the block, texels past the edges repeat the last one
+            float texels[4][16];
+            for (int i = 0; i < 16; i++)
+            {
+                int x = std::min(blockX + i % 4, width - 1);
+                int y = std::min(blockY + i / 4, height - 1);
+                const unsigned char* texel =
+                  pixels + ((size_t)y * width + x) * components;
+
+                for (int c = 0; c < 4; c++)
+                {
+                    if (c < components)
+                        texels[c][i] = texel[c];
+                    else if (c < 3)
+                        texels[c][i] = components == 1 ? texel[0] : 0.0f;
+                    else
+                        texels[c][i] = 255.0f;
+                }
+            }
+
+            float colors[16][3];
+            for (int i = 0; i < 16; i++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    colors[i][c] = texels[c][i];
+                }
+            }
+
+            unsigned char* block = destination;
+            destination += blockSize;
+
+            switch (format)
+            {
+                case BlockFormat::BC1:
+                    BlockCompression::encodeColorBlock(colors, block);
+                    break;
+                case BlockFormat::BC3:
+                    BlockCompression::encodeChannelBlock(texels[3], block);
+                    BlockCompression::encodeColorBlock(colors, block + 8);
+                    break;
+                case BlockFormat::BC4:
+                    BlockCompression::encodeChannelBlock(texels[0], block);
+                    break;
+                case BlockFormat::BC5:
+                    BlockCompression::encodeChannelBlock(texels[0], block);
+                    BlockCompression::encodeChannelBlock(texels[1], block + 8);
+                    break;
+                case BlockFormat::None:
+                    break;
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef BOUNDING_BOX_H
+#define BOUNDING_BOX_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+
+// Axis aligned bounding box, empty until something is added to it
+struct BoundingBox
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool isEmpty() const { return min.x > max.x; }
+
+    void extend(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void extend(const BoundingBox& box)
+    {
+        if (box.isEmpty())
+            return;
+
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    glm::vec3 getCenter() const { return (min + max) * 0.5f; }
+    glm::vec3 getExtents() const { return (max - min) * 0.5f; }
+
+    // box enclosing this box once transformed, the world space bounds of a
+    // model given its model matrix
+    BoundingBox transformed(const glm::mat4& transform) const
+    {
+        if (isEmpty())
+            return *this;
+
+        glm::vec3 center =
+          glm::vec3(transform * glm::vec4(getCenter(), 1.0f));
+        glm::vec3 extents = getExtents();
+
+        glm::vec3 newExtents(0.0f);
+        for (int i = 0; i < 3; i++)
+        {
+            newExtents += glm::abs(glm::vec3(transform[i])) * extents[i];
+        }
+
+        BoundingBox box;
+        box.min = center - newExtents;
+        box.max = center + newExtents;
+        return box;
+    }
+
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        glm::vec3 closest = glm::max(min, glm::min(center, max));
+        glm::vec3 delta = closest - center;
+        return glm::dot(delta, delta) <= radius * radius;
+    }
+};
+
+struct BoundingSphere
+{
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = -1.0f;
+
+    bool isEmpty() const { return radius < 0.0f; }
+
+    // sphere enclosing this sphere once transformed, the radius is scaled by
+    // the largest axis scale of the transform
+    BoundingSphere transformed(const glm::mat4& transform) const
+    {
+        if (isEmpty())
+            return *this;
+
+        float scale = std::max({ glm::length(glm::vec3(transform[0])),
+                                 glm::length(glm::vec3(transform[1])),
+                                 glm::length(glm::vec3(transform[2])) });
+
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+        sphere.radius = radius * scale;
+        return sphere;
+    }
+};
+
+#endif
@@ -143,6 +143,15 @@ public:
         updateCameraVectors();
     }
 
+    // turns the camera towards a point, used by scripted camera paths
+    void LookAt(glm::vec3 target)
+    {
+        glm::vec3 direction = glm::normalize(target - Position);
+        Yaw = glm::degrees(atan2(direction.z, direction.x));
+        Pitch = glm::degrees(asin(direction.y));
+        updateCameraVectors();
+    }
+
 
 private:
     // calculates the front vector from the Camera's (updated) Euler Angles
@@ -0,0 +1,107 @@
+#version 430 core
+
+// GpuCuller: one invocation per instance. An instance visible in any of the
+// frustums (the camera, or the six faces of an omni shadow map) allowed by
+// its face mask takes the next slot of its batch's range and writes its draw
+// command, model matrix and the frustums it is visible in there. Slots left
+// over keep their cleared command, a draw of zero instances.
+layout (local_size_x = 64) in;
+
+struct Instance
+{
+	mat4 model;
+	// bounding sphere in the space model transforms from, radius in w
+	vec4 sphere;
+	uint count;
+	uint firstIndex;
+	int baseVertex;
+	uint batch;
+	uint faceMask;
+	uint firstSlot;
+	uint padding0;
+	uint padding1;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout (std430, binding = 0) writeonly buffer DrawData
+{
+	mat4 models[];
+};
+
+layout (std430, binding = 1) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+layout (std430, binding = 2) writeonly buffer DrawCommands
+{
+	DrawCommand commands[];
+};
+
+// visible instances per batch
+layout (std430, binding = 3) buffer Counters
+{
+	uint counters[];
+};
+
+layout (std430, binding = 4) writeonly buffer DrawFaceMasks
+{
+	uint faceMasks[];
+};
+
+#define MAX_FRUSTUMS 6
+
+// six inward facing planes per frustum, see Frustum.h
+uniform vec4 planes[MAX_FRUSTUMS * 6];
+uniform int frustumCount;
+uniform int instanceCount;
+
+void main()
+{
+	uint index = gl_GlobalInvocationID.x;
+	if (index >= uint(instanceCount))
+		return;
+
+	Instance instance = instances[index];
+
+	vec3 center = vec3(instance.model * vec4(instance.sphere.xyz, 1.0));
+	float scale = max(length(instance.model[0].xyz),
+					  max(length(instance.model[1].xyz),
+						  length(instance.model[2].xyz)));
+	float radius = instance.sphere.w * scale;
+
+	uint visible = 0u;
+	for (int frustum = 0; frustum < frustumCount; frustum++)
+	{
+		bool inside = true;
+		for (int plane = 0; plane < 6 && inside; plane++)
+		{
+			vec4 p = planes[frustum * 6 + plane];
+			inside = dot(p.xyz, center) + p.w >= -radius;
+		}
+		if (inside)
+			visible |= 1u << frustum;
+	}
+
+	visible &= instance.faceMask;
+	if (visible == 0u)
+		return;
+
+	uint slot = instance.firstSlot + atomicAdd(counters[instance.batch], 1u);
+
+	commands[slot] = DrawCommand(instance.count,
+								 1u,
+								 instance.firstIndex,
+								 instance.baseVertex,
+								 slot);
+	models[slot] = instance.model;
+	faceMasks[slot] = visible;
+}
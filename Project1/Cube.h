@@ -3,6 +3,8 @@
 
 #include <glad/glad.h>
 
+#include "GLState.h"
+
 class Cube
 {
   public:
@@ -17,12 +19,11 @@ class Cube
 
     void Draw(Shader& shader)
     {
-        glBindVertexArray(VAO);
+        GLState::bindVertexArray(VAO);
 
 
 
         glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
     }
 
   private:
@@ -77,7 +78,7 @@ class Cube
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        GLState::bindVertexArray(VAO);
 
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(
@@ -107,7 +108,7 @@ class Cube
                               (void*)(6 * sizeof(float)));
         glEnableVertexAttribArray(2);
 
-        glBindVertexArray(0);
+        GLState::bindVertexArray(0);
     }
 };
 
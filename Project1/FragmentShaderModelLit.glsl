@@ -6,7 +6,10 @@ in vec3 Normal;
 in vec3 FragPos;
 in vec2 TexCoords;
 
-#define MAX_NR_LIGHTS 10
+#define MAX_NR_DIRECTIONAL_LIGHTS 4
+#define MAX_NR_POINT_LIGHTS 192
+#define MAX_NR_SPOT_LIGHTS 32
+
 struct DirectionalLight {
 	vec3 direction;
 
@@ -14,22 +17,47 @@ struct DirectionalLight {
 	vec3 diffuse;
 	vec3 specular;
 };
-uniform DirectionalLight directionalLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_DIRECTIONAL_LIGHTS;
 
+// vec3 members are followed by a scalar so the std140 layout stays packed
 struct PointLight {
 	vec3 position;
+	bool casts_shadows;
 
 	vec3 ambient;
+	float constant;
 	vec3 diffuse;
+	float linear;
 	vec3 specular;
+	float quadratic;
+};
 
+struct SpotLight {
+	vec3 position;
 	float constant;
+	vec3 direction;
 	float linear;
+
+	vec3 ambient;
 	float quadratic;
+	vec3 diffuse;
+	float innerCutoff;
+	vec3 specular;
+	float outerCutoff;
+};
+
+layout (std140) uniform LightBlock {
+	int NUMBER_OF_DIRECTIONAL_LIGHTS;
+	int NUMBER_OF_POINT_LIGHTS;
+	int NUMBER_OF_SPOT_LIGHTS;
+
+	ivec4 clusterGridSize;
+	vec4 clusterTileSize;
+	vec4 clusterDepthParams;
+
+	DirectionalLight directionalLights[MAX_NR_DIRECTIONAL_LIGHTS];
+	PointLight pointLights[MAX_NR_POINT_LIGHTS];
+	SpotLight spotLights[MAX_NR_SPOT_LIGHTS];
 };
-uniform PointLight pointLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_POINT_LIGHTS;
 
 struct Material {
 	sampler2D texture_diffuse1;
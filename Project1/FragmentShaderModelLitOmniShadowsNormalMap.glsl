@@ -8,7 +8,10 @@ in VS_OUT {
 	vec2 TexCoords;
 } fs_in;
 
-#define MAX_NR_LIGHTS 10
+#define MAX_NR_DIRECTIONAL_LIGHTS 4
+#define MAX_NR_POINT_LIGHTS 192
+#define MAX_NR_SPOT_LIGHTS 32
+
 struct DirectionalLight {
 	vec3 direction;
 
@@ -16,22 +19,47 @@ struct DirectionalLight {
 	vec3 diffuse;
 	vec3 specular;
 };
-uniform DirectionalLight directionalLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_DIRECTIONAL_LIGHTS;
 
+// vec3 members are followed by a scalar so the std140 layout stays packed
 struct PointLight {
 	vec3 position;
+	bool casts_shadows;
 
 	vec3 ambient;
+	float constant;
 	vec3 diffuse;
+	float linear;
 	vec3 specular;
+	float quadratic;
+};
 
+struct SpotLight {
+	vec3 position;
 	float constant;
+	vec3 direction;
 	float linear;
+
+	vec3 ambient;
 	float quadratic;
+	vec3 diffuse;
+	float innerCutoff;
+	vec3 specular;
+	float outerCutoff;
+};
+
+layout (std140) uniform LightBlock {
+	int NUMBER_OF_DIRECTIONAL_LIGHTS;
+	int NUMBER_OF_POINT_LIGHTS;
+	int NUMBER_OF_SPOT_LIGHTS;
+
+	ivec4 clusterGridSize;
+	vec4 clusterTileSize;
+	vec4 clusterDepthParams;
+
+	DirectionalLight directionalLights[MAX_NR_DIRECTIONAL_LIGHTS];
+	PointLight pointLights[MAX_NR_POINT_LIGHTS];
+	SpotLight spotLights[MAX_NR_SPOT_LIGHTS];
 };
-uniform PointLight pointLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_POINT_LIGHTS;
 
 struct Material {
 	sampler2D texture_diffuse1;
@@ -77,10 +105,11 @@ void main()
 
 vec3 CalcPointLight(PointLight light, vec3 fragPos, vec3 viewDir) {
 	vec3 diffuse_sample = vec3(texture(material.texture_diffuse1, fs_in.TexCoords));
-	vec3 normal_sample = vec3(texture(material.texture_normal1, fs_in.TexCoords));
+	// normal maps may be two channel (BC5), z is rebuilt from x and y
+	vec2 normal_sample = texture(material.texture_normal1, fs_in.TexCoords).rg * 2.0 - 1.0;
 	vec3 parallax_sample = vec3(texture(material.texture_parallax1, fs_in.TexCoords));
 
-	vec3 normal = normal_sample * 2.0 - 1.0;
+	vec3 normal = normalize(vec3(normal_sample, sqrt(max(1.0 - dot(normal_sample, normal_sample), 0.0))));
 	vec3 worldSpaceNormal = fs_in.TBN * normal;
 
 	vec3 lightDir = normalize(light.position - fragPos);
@@ -1,16 +1,17 @@
 #version 330 core
 
-#define MAX_NR_LIGHTS 10
+#define MAX_NR_DIRECTIONAL_LIGHTS 4
+#define MAX_NR_POINT_LIGHTS 192
+#define MAX_NR_SPOT_LIGHTS 32
 
 out vec4 FragColor;
 
 in VS_OUT {
-	vec3 Debug;
 	vec3 FragPos;
 	vec2 TexCoords;
 	vec3 TangentViewPos;
 	vec3 TangentFragPos;
-	vec3[MAX_NR_LIGHTS] tangentPointLightPositions;
+	mat3 TBN;
 } fs_in;
 
 struct DirectionalLight {
@@ -20,23 +21,51 @@ struct DirectionalLight {
 	vec3 diffuse;
 	vec3 specular;
 };
-uniform DirectionalLight directionalLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_DIRECTIONAL_LIGHTS;
 
+// vec3 members are followed by a scalar so the std140 layout stays packed
 struct PointLight {
 	vec3 position;
 	bool casts_shadows;
 
 	vec3 ambient;
+	float constant;
 	vec3 diffuse;
+	float linear;
 	vec3 specular;
+	float quadratic;
+};
 
+struct SpotLight {
+	vec3 position;
 	float constant;
+	vec3 direction;
 	float linear;
+
+	vec3 ambient;
 	float quadratic;
+	vec3 diffuse;
+	float innerCutoff;
+	vec3 specular;
+	float outerCutoff;
+};
+
+layout (std140) uniform LightBlock {
+	int NUMBER_OF_DIRECTIONAL_LIGHTS;
+	int NUMBER_OF_POINT_LIGHTS;
+	int NUMBER_OF_SPOT_LIGHTS;
+
+	ivec4 clusterGridSize;     // x tiles, y tiles, z slices
+	vec4 clusterTileSize;      // tile size in pixels
+	vec4 clusterDepthParams;   // near, far, slice scale, slice bias
+
+	DirectionalLight directionalLights[MAX_NR_DIRECTIONAL_LIGHTS];
+	PointLight pointLights[MAX_NR_POINT_LIGHTS];
+	SpotLight spotLights[MAX_NR_SPOT_LIGHTS];
 };
-uniform PointLight pointLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_POINT_LIGHTS;
+
+// per cluster: x = offset in lightIndices, y = point count | spot count << 16
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
 
 struct Material {
 	sampler2D texture_diffuse1;
@@ -59,8 +88,11 @@ uniform float parallax_max_layers;
 uniform bool parallax_self_shadow;
 uniform float parallax_self_shadow_exponent;
 
+int ClusterIndex();
 vec3 CalcPointLight(PointLight light, vec3 lightPos, vec3 tangentFragPos, vec3 tangentViewDir, vec2 texCoords);
+vec3 CalcSpotLight(SpotLight light, vec3 tangentFragPos, vec3 tangentViewDir, vec2 texCoords);
 vec2 ParallaxMapping(vec2 texCoords, vec3 tangentViewDir);
+vec3 SampleNormal(vec2 texCoords);
 
 float OmniShadowCalculation(vec3 worldFragPos, vec3 worldLightPos);
 float ParallaxShadow(vec3 tangentLightDir, vec2 texCoords);
@@ -86,10 +118,28 @@ void main()
 
 	vec3 result = vec3(0.0);
 
-	for (int i = 0; i < NUMBER_OF_POINT_LIGHTS; i++){
+	uvec2 cluster = texelFetch(lightClusters, ClusterIndex()).xy;
+	int firstIndex = int(cluster.x);
+	int pointCount = int(cluster.y & 0xFFFFu);
+	int spotCount = int(cluster.y >> 16);
+
+	for (int i = 0; i < pointCount; i++){
+		int lightId = int(texelFetch(lightIndices, firstIndex + i).r);
+
 		result += CalcPointLight(
-			pointLights[i],
-			fs_in.tangentPointLightPositions[i],
+			pointLights[lightId],
+			fs_in.TBN * pointLights[lightId].position,
+			fs_in.TangentFragPos,
+			tangentViewDir,
+			texCoords
+		);
+	}
+
+	for (int i = 0; i < spotCount; i++){
+		int lightId = int(texelFetch(lightIndices, firstIndex + pointCount + i).r);
+
+		result += CalcSpotLight(
+			spotLights[lightId],
 			fs_in.TangentFragPos,
 			tangentViewDir,
 			texCoords
@@ -100,6 +150,23 @@ void main()
 };
 
 
+int ClusterIndex(){
+	float near = clusterDepthParams.x;
+	float far = clusterDepthParams.y;
+
+	float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+	float viewDepth = 2.0 * near * far / (far + near - ndcDepth * (far - near));
+
+	int slice = int(log(viewDepth) * clusterDepthParams.z - clusterDepthParams.w);
+	slice = clamp(slice, 0, clusterGridSize.z - 1);
+
+	ivec2 tile = ivec2(gl_FragCoord.xy / clusterTileSize.xy);
+	tile = clamp(tile, ivec2(0), clusterGridSize.xy - 1);
+
+	return tile.x + clusterGridSize.x * (tile.y + clusterGridSize.y * slice);
+}
+
+
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir){
 	const float minLayers = 8.0;
 	float maxLayers = parallax_max_layers;
@@ -140,10 +207,9 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir){
 vec3 CalcPointLight(PointLight light, vec3 tangentLightPos, vec3 tangentFragPos, vec3 tangentViewDir, vec2 texCoords) {
 	vec3 diffuse_sample = vec3(texture(material.texture_diffuse1, texCoords));
 	vec3 specular_sample = vec3(texture(material.texture_specular1, texCoords));
-	vec3 normal_sample = vec3(texture(material.texture_normal1, texCoords));
 	float parallax_sample = texture(material.texture_parallax1, texCoords).r;
 
-	vec3 normal = normalize(normal_sample * 2.0 - 1.0);
+	vec3 normal = SampleNormal(texCoords);
 
 	vec3 lightDir = normalize(tangentLightPos - tangentFragPos);
 
@@ -177,6 +243,43 @@ vec3 CalcPointLight(PointLight light, vec3 tangentLightPos, vec3 tangentFragPos,
 }
 
 
+vec3 CalcSpotLight(SpotLight light, vec3 tangentFragPos, vec3 tangentViewDir, vec2 texCoords) {
+	vec3 diffuse_sample = vec3(texture(material.texture_diffuse1, texCoords));
+	vec3 specular_sample = vec3(texture(material.texture_specular1, texCoords));
+
+	vec3 normal = SampleNormal(texCoords);
+
+	vec3 tangentLightPos = fs_in.TBN * light.position;
+	vec3 lightDir = normalize(tangentLightPos - tangentFragPos);
+
+	// cone falloff is evaluated in world space
+	vec3 worldLightDir = normalize(light.position - fs_in.FragPos);
+	float theta = dot(worldLightDir, normalize(-light.direction));
+	float epsilon = light.innerCutoff - light.outerCutoff;
+	float intensity = clamp((theta - light.outerCutoff) / epsilon, 0.0, 1.0);
+
+	float diff = max(dot(normal, lightDir), 0.0);
+
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(tangentViewDir, reflectDir), 0.0f), 200.0f);
+
+	if (diff < 0.001)
+		spec = 0;
+
+	vec3 ambient = light.ambient * diffuse_sample;
+	vec3 diffuse = light.diffuse * diff * diffuse_sample;
+	vec3 specular = light.specular * spec * specular_sample;
+
+	float distance = length(tangentLightPos - tangentFragPos);
+	float attenuation = 1.0 / (light.constant + light.linear * distance + 
+								light.quadratic * pow(distance, 2));
+
+	float parallaxShadowMultiplier = parallax_self_shadow ? ParallaxShadow(lightDir, texCoords) : 1.0;
+
+	return attenuation * (ambient + intensity * parallaxShadowMultiplier * (diffuse + specular));
+}
+
+
 float ParallaxShadow(vec3 lightDir, vec2 texCoords){
 	float shadowMultiplier = 1;
 
@@ -240,3 +343,10 @@ float OmniShadowCalculation(vec3 worldFragPos, vec3 worldLightPos){
 
 	return shadow;
 }
+
+
+// normal maps may be two channel (BC5), z is rebuilt from x and y
+vec3 SampleNormal(vec2 texCoords) {
+	vec2 xy = texture(material.texture_normal1, texCoords).rg * 2.0 - 1.0;
+	return normalize(vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0))));
+}
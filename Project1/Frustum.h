@@ -0,0 +1,238 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+#include "BoundingBox.h"
+
+// View frustum as six inward facing planes (xyz normal, w distance), a point
+// p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+    enum Plane
+    {
+        LEFT_PLANE,
+        RIGHT_PLANE,
+        BOTTOM_PLANE,
+        TOP_PLANE,
+        NEAR_PLANE,
+        FAR_PLANE
+    };
+
+    glm::vec4 planes[6];
+
+    Frustum() = default;
+
+    // extracts the planes of a projection * view matrix, they end up in the
+    // space the matrix transforms from (world space for projection * view)
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+        {
+            row[i] = glm::vec4(viewProjection[0][i],
+                               viewProjection[1][i],
+                               viewProjection[2][i],
+                               viewProjection[3][i]);
+        }
+
+        planes[LEFT_PLANE] = row[3] + row[0];
+        planes[RIGHT_PLANE] = row[3] - row[0];
+        planes[BOTTOM_PLANE] = row[3] + row[1];
+        planes[TOP_PLANE] = row[3] - row[1];
+        planes[NEAR_PLANE] = row[3] + row[2];
+        planes[FAR_PLANE] = row[3] - row[2];
+
+        for (glm::vec4& plane : planes)
+        {
+            plane /= glm::length(glm::vec3(plane));
+        }
+    }
+
+    // conservative, a box outside of the frustum but crossing the extension
+    // of two of its planes near a corner is reported as intersecting
+    bool intersects(const BoundingBox& box) const
+    {
+        glm::vec3 center = box.getCenter();
+        glm::vec3 extents = box.getExtents();
+
+        for (const glm::vec4& plane : planes)
+        {
+            glm::vec3 normal(plane);
+            float distance = glm::dot(normal, center) + plane.w;
+            float radius = glm::dot(glm::abs(normal), extents);
+
+            if (distance + radius < 0.0f)
+                return false;
+        }
+
+        return true;
+    }
+
+    bool intersects(const BoundingSphere& sphere) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w <
+                -sphere.radius)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+struct FrustumCullStats
+{
+    unsigned int tested = 0;
+    unsigned int culled = 0;
+};
+
+// Tests a batch of world space boxes against a frustum. The boxes are stored
+// as centers and extents in structure of arrays layout so that four boxes
+// are tested against a plane per SSE instruction, the scalar path is used
+// on other targets.
+class FrustumCuller
+{
+  public:
+    FrustumCullStats lastStats;
+
+    void clear()
+    {
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        extentX.clear();
+        extentY.clear();
+        extentZ.clear();
+        visible.clear();
+    }
+
+    // returns the index of the box, to query its visibility after cull()
+    size_t add(const BoundingBox& box)
+    {
+        glm::vec3 center = box.getCenter();
+        glm::vec3 extents = box.getExtents();
+
+        centerX.push_back(center.x);
+        centerY.push_back(center.y);
+        centerZ.push_back(center.z);
+        extentX.push_back(extents.x);
+        extentY.push_back(extents.y);
+        extentZ.push_back(extents.z);
+
+        return centerX.size() - 1;
+    }
+
+    size_t size() const { return centerX.size(); }
+
+    void cull(const Frustum& frustum)
+    {
+        size_t count = size();
+
+        // pad to a whole number of SSE batches, the padding is dropped again
+        // once culled
+        size_t padded = (count + 3) & ~(size_t)3;
+        resize(padded);
+        visible.assign(padded, 1);
+
+#ifdef FRUSTUM_CULLING_SSE
+        for (size_t i = 0; i < padded; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&centerX[i]);
+            __m128 cy = _mm_loadu_ps(&centerY[i]);
+            __m128 cz = _mm_loadu_ps(&centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&extentX[i]);
+            __m128 ey = _mm_loadu_ps(&extentY[i]);
+            __m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+            __m128 outside = _mm_setzero_ps();
+
+            for (const glm::vec4& plane : frustum.planes)
+            {
+                __m128 nx = _mm_set1_ps(plane.x);
+                __m128 ny = _mm_set1_ps(plane.y);
+                __m128 nz = _mm_set1_ps(plane.z);
+
+                // distance of the centers plus the boxes' projected radius
+                __m128 distance = _mm_add_ps(
+                  _mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                  _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+                __m128 radius = _mm_add_ps(
+                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), ex),
+                             _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), ey)),
+                  _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), ez));
+
+                outside = _mm_or_ps(
+                  outside,
+                  _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(outside);
+            for (int j = 0; j < 4; j++)
+            {
+                visible[i + j] = !(mask & (1 << j));
+            }
+        }
+#else
+        for (size_t i = 0; i < padded; i++)
+        {
+            for (const glm::vec4& plane : frustum.planes)
+            {
+                float distance = plane.x * centerX[i] + plane.y * centerY[i] +
+                                 plane.z * centerZ[i] + plane.w;
+                float radius = std::abs(plane.x) * extentX[i] +
+                               std::abs(plane.y) * extentY[i] +
+                               std::abs(plane.z) * extentZ[i];
+
+                if (distance + radius < 0.0f)
+                {
+                    visible[i] = 0;
+                    break;
+                }
+            }
+        }
+#endif
+
+        resize(count);
+
+        lastStats.tested = (unsigned int)count;
+        lastStats.culled = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            lastStats.culled += !visible[i];
+        }
+    }
+
+    bool isVisible(size_t index) const { return visible[index] != 0; }
+
+  private:
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<uint8_t> visible;
+
+    void resize(size_t count)
+    {
+        centerX.resize(count);
+        centerY.resize(count);
+        centerZ.resize(count);
+        extentX.resize(count);
+        extentY.resize(count);
+        extentZ.resize(count);
+        visible.resize(count);
+    }
+};
+
+#endif
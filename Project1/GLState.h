@@ -0,0 +1,156 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+// binds issued through GLState and the ones it skipped as redundant, reset
+// every frame
+struct GLStateStats
+{
+    unsigned int programBinds = 0;
+    unsigned int programBindsSkipped = 0;
+    unsigned int textureBinds = 0;
+    unsigned int textureBindsSkipped = 0;
+    unsigned int vertexArrayBinds = 0;
+    unsigned int vertexArrayBindsSkipped = 0;
+};
+
+// Shadow copy of the program, vertex array, active texture unit and texture
+// bindings, a bind that would not change the current GL state is skipped.
+// Only works if every such bind goes through GLState, code binding behind
+// its back (e.g. a third party renderer) has to call invalidate() afterwards.
+class GLState
+{
+  public:
+    static const unsigned int MAX_TEXTURE_UNITS = 32;
+
+    inline static GLStateStats frameStats;
+    inline static GLStateStats lastFrameStats;
+
+    // call once per frame, keeps the previous frame's counters for display
+    static void beginFrame()
+    {
+        lastFrameStats = frameStats;
+        frameStats = GLStateStats();
+    }
+
+    static void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+
+        for (auto& unit : textures)
+        {
+            for (unsigned int& texture : unit)
+            {
+                texture = UNKNOWN;
+            }
+        }
+    }
+
+    static void useProgram(unsigned int id)
+    {
+        if (program == id)
+        {
+            frameStats.programBindsSkipped++;
+            return;
+        }
+
+        frameStats.programBinds++;
+        program = id;
+        glUseProgram(id);
+    }
+
+    static void bindVertexArray(unsigned int id)
+    {
+        if (vertexArray == id)
+        {
+            frameStats.vertexArrayBindsSkipped++;
+            return;
+        }
+
+        frameStats.vertexArrayBinds++;
+        vertexArray = id;
+        glBindVertexArray(id);
+    }
+
+    // binds the texture to the target of the given unit, which is left
+    // active (texture uploads after this go to that texture)
+    static void bindTexture(unsigned int unit, GLenum target, unsigned int id)
+    {
+        int targetIndex = getTargetIndex(target);
+
+        activeTexture(unit);
+
+        if (unit < MAX_TEXTURE_UNITS && targetIndex >= 0 &&
+            textures[unit][targetIndex] == id)
+        {
+            frameStats.textureBindsSkipped++;
+            return;
+        }
+
+        frameStats.textureBinds++;
+        if (unit < MAX_TEXTURE_UNITS && targetIndex >= 0)
+            textures[unit][targetIndex] = id;
+        glBindTexture(target, id);
+    }
+
+    // a deleted texture or vertex array is unbound by GL, forget about it so
+    // a new object reusing its name is not considered bound
+    static void forgetTexture(unsigned int id)
+    {
+        for (auto& unit : textures)
+        {
+            for (unsigned int& texture : unit)
+            {
+                if (texture == id)
+                    texture = UNKNOWN;
+            }
+        }
+    }
+
+    static void forgetVertexArray(unsigned int id)
+    {
+        if (vertexArray == id)
+            vertexArray = UNKNOWN;
+    }
+
+  private:
+    static const unsigned int UNKNOWN = ~0u;
+
+    // cached targets, binds to any other target are always issued
+    static const int TARGET_COUNT = 3;
+
+    // a new context has nothing bound and unit 0 active
+    inline static unsigned int program = 0;
+    inline static unsigned int vertexArray = 0;
+    inline static unsigned int activeUnit = 0;
+    inline static unsigned int textures[MAX_TEXTURE_UNITS][TARGET_COUNT] = {};
+
+    static int getTargetIndex(GLenum target)
+    {
+        switch (target)
+        {
+            case GL_TEXTURE_2D:
+                return 0;
+            case GL_TEXTURE_CUBE_MAP:
+                return 1;
+            case GL_TEXTURE_BUFFER:
+                return 2;
+            default:
+                return -1;
+        }
+    }
+
+    static void activeTexture(unsigned int unit)
+    {
+        if (activeUnit == unit)
+            return;
+
+        activeUnit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+};
+
+#endif
@@ -0,0 +1,455 @@
+#ifndef GEOMETRY_BUFFER_H
+#define GEOMETRY_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "GLState.h"
+
+// First fit allocator of ranges of units in [0, capacity), the free blocks
+// are kept sorted by offset and merged with their neighbours when freed
+class RangeAllocator
+{
+  public:
+    static constexpr size_t NO_SPACE = SIZE_MAX;
+
+    size_t getCapacity() const { return capacity; }
+    size_t getUsed() const { return used; }
+
+    // offset of the new range, NO_SPACE if no free block is large enough
+    // (even though the free units may add up to size, see getUsed)
+    size_t allocate(size_t size)
+    {
+        if (size == 0)
+            return 0;
+
+        for (auto block = freeBlocks.begin(); block != freeBlocks.end();
+             ++block)
+        {
+            if (block->second < size)
+                continue;
+
+            size_t offset = block->first;
+            size_t remaining = block->second - size;
+            freeBlocks.erase(block);
+            if (remaining > 0)
+                freeBlocks[offset + size] = remaining;
+
+            used += size;
+            return offset;
+        }
+        return NO_SPACE;
+    }
+
+    void free(size_t offset, size_t size)
+    {
+        if (size == 0)
+            return;
+
+        used -= size;
+
+        auto next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.end() && offset + size == next->first)
+        {
+            size += next->second;
+            next = freeBlocks.erase(next);
+        }
+
+        if (next != freeBlocks.begin())
+        {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset)
+            {
+                previous->second += size;
+                return;
+            }
+        }
+
+        freeBlocks[offset] = size;
+    }
+
+    // every used unit packed at the start (after a defragmentation), the
+    // rest up to capacity free
+    void reset(size_t capacity, size_t used)
+    {
+        this->capacity = capacity;
+        this->used = used;
+
+        freeBlocks.clear();
+        if (used < capacity)
+            freeBlocks[used] = capacity - used;
+    }
+
+  private:
+    std::map<size_t, size_t> freeBlocks;
+    size_t capacity = 0;
+    size_t used = 0;
+};
+
+struct GeometryBufferStats
+{
+    // live allocations
+    unsigned int allocations = 0;
+    // buffers reallocated to grow or to defragment them
+    unsigned int relocations = 0;
+};
+
+// Vertex and index buffers shared by every mesh of a vertex format, with a
+// single vertex array: meshes are sub-allocated ranges drawn with their base
+// vertex, so that consecutive draws of different meshes need no bind.
+//
+// Vertices are allocated by vertex, indices by 4 bytes so that both 16 and
+// 32 bit indices are aligned. A buffer that cannot fit an allocation is
+// reallocated with its live ranges packed at the start, twice as large if
+// the free space was not only fragmented. Allocations are referred to by
+// handle, their offsets change when the buffer is defragmented.
+//
+// The vertex array also has an instanced integer attribute holding the
+// instance index at DRAW_INDEX_LOCATION. With one instance per draw it is
+// the draw's baseInstance, the index of its data in indirect draws (shaders
+// of 3.3 contexts have no gl_DrawID).
+//
+// Instanced vertex arrays read the same vertices and indices with their own
+// per-instance attributes instead (see InstancedModel), they are kept
+// attached to the buffers across relocations.
+class GeometryBuffer
+{
+  public:
+    static constexpr size_t INITIAL_VERTICES = 1 << 16;
+    static constexpr size_t INITIAL_INDEX_UNITS = 1 << 18;
+    static constexpr unsigned int DRAW_INDEX_LOCATION = 5;
+    static constexpr size_t INITIAL_DRAW_INDICES = 1024;
+
+    GeometryBufferStats stats;
+
+    // vertexSize is the stride, setupAttributes sets the attribute pointers
+    // of the vertex array with the vertex buffer bound, from offset 0
+    GeometryBuffer(size_t vertexSize, void (*setupAttributes)())
+      : vertexSize(vertexSize)
+      , setupAttributes(setupAttributes)
+    {
+    }
+
+    GeometryBuffer(const GeometryBuffer&) = delete;
+    GeometryBuffer& operator=(const GeometryBuffer&) = delete;
+
+    // creates the buffers on first use
+    unsigned int getVertexArray()
+    {
+        if (!VAO)
+            create();
+        return VAO;
+    }
+
+    // uploads the vertices and indices (indexSize bytes each) of a mesh,
+    // returns the handle of its allocation
+    unsigned int allocate(const void* vertexData,
+                          size_t vertexCount,
+                          const void* indexData,
+                          size_t indexCount,
+                          size_t indexSize)
+    {
+        if (!VAO)
+            create();
+
+        Allocation allocation;
+        allocation.vertexCount = vertexCount;
+        allocation.indexUnits = (indexCount * indexSize + 3) / 4;
+
+        allocation.firstVertex = vertexAllocator.allocate(vertexCount);
+        if (allocation.firstVertex == RangeAllocator::NO_SPACE)
+        {
+            relocate(vertices, vertexAllocator, vertexCount);
+            allocation.firstVertex = vertexAllocator.allocate(vertexCount);
+        }
+
+        allocation.firstIndexUnit =
+          indexAllocator.allocate(allocation.indexUnits);
+        if (allocation.firstIndexUnit == RangeAllocator::NO_SPACE)
+        {
+            relocate(indices, indexAllocator, allocation.indexUnits);
+            allocation.firstIndexUnit =
+              indexAllocator.allocate(allocation.indexUnits);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vertices);
+        glBufferSubData(GL_COPY_WRITE_BUFFER,
+                        allocation.firstVertex * vertexSize,
+                        vertexCount * vertexSize,
+                        vertexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indices);
+        glBufferSubData(GL_COPY_WRITE_BUFFER,
+                        allocation.firstIndexUnit * 4,
+                        indexCount * indexSize,
+                        indexData);
+
+        allocation.live = true;
+        stats.allocations++;
+
+        if (!freeHandles.empty())
+        {
+            unsigned int handle = freeHandles.back();
+            freeHandles.pop_back();
+            allocations[handle] = allocation;
+            return handle;
+        }
+
+        allocations.push_back(allocation);
+        return (unsigned int)allocations.size() - 1;
+    }
+
+    void free(unsigned int handle)
+    {
+        Allocation& allocation = allocations[handle];
+        if (!allocation.live)
+            return;
+
+        vertexAllocator.free(allocation.firstVertex, allocation.vertexCount);
+        indexAllocator.free(allocation.firstIndexUnit, allocation.indexUnits);
+        allocation.live = false;
+        freeHandles.push_back(handle);
+        stats.allocations--;
+    }
+
+    GLint getBaseVertex(unsigned int handle) const
+    {
+        return (GLint)allocations[handle].firstVertex;
+    }
+
+    // byte offset of the allocation's first index in the index buffer
+    size_t getIndexOffset(unsigned int handle) const
+    {
+        return allocations[handle].firstIndexUnit * 4;
+    }
+
+    // makes draw indices up to count - 1 available to the attribute
+    void reserveDrawIndices(size_t count)
+    {
+        if (!VAO)
+            create();
+        if (count <= drawIndexCount)
+            return;
+
+        while (drawIndexCount < count)
+        {
+            drawIndexCount *= 2;
+        }
+        uploadDrawIndices();
+        attachBuffers();
+    }
+
+    // vertex array over the shared buffers with the per-instance attributes
+    // set by setupInstanceAttributes, with instanceBuffer bound. The buffer
+    // may be reallocated with glBufferData but must not be deleted before
+    // the vertex array is released.
+    unsigned int createInstancedVertexArray(unsigned int instanceBuffer,
+                                            void (*setupInstanceAttributes)())
+    {
+        if (!VAO)
+            create();
+
+        InstancedVertexArray instanced;
+        glGenVertexArrays(1, &instanced.VAO);
+        instanced.instanceBuffer = instanceBuffer;
+        instanced.setupInstanceAttributes = setupInstanceAttributes;
+        instancedArrays.push_back(instanced);
+
+        attachInstanced(instanced);
+        return instanced.VAO;
+    }
+
+    void releaseVertexArray(unsigned int vertexArray)
+    {
+        for (size_t i = 0; i < instancedArrays.size(); i++)
+        {
+            if (instancedArrays[i].VAO != vertexArray)
+                continue;
+
+            GLState::forgetVertexArray(vertexArray);
+            glDeleteVertexArrays(1, &vertexArray);
+            instancedArrays.erase(instancedArrays.begin() + i);
+            return;
+        }
+    }
+
+    size_t getVertexBytes() const
+    {
+        return vertexAllocator.getUsed() * vertexSize;
+    }
+
+    size_t getIndexBytes() const { return indexAllocator.getUsed() * 4; }
+
+    size_t getCapacityBytes() const
+    {
+        return vertexAllocator.getCapacity() * vertexSize +
+               indexAllocator.getCapacity() * 4;
+    }
+
+  private:
+    struct Allocation
+    {
+        size_t firstVertex;
+        size_t vertexCount;
+        size_t firstIndexUnit;
+        size_t indexUnits;
+        bool live;
+    };
+
+    struct InstancedVertexArray
+    {
+        unsigned int VAO;
+        unsigned int instanceBuffer;
+        void (*setupInstanceAttributes)();
+    };
+
+    size_t vertexSize;
+    void (*setupAttributes)();
+
+    unsigned int VAO = 0;
+    unsigned int vertices = 0;
+    unsigned int indices = 0;
+    unsigned int drawIndices = 0;
+    size_t drawIndexCount = INITIAL_DRAW_INDICES;
+    RangeAllocator vertexAllocator;
+    RangeAllocator indexAllocator;
+
+    std::vector<Allocation> allocations;
+    std::vector<unsigned int> freeHandles;
+    std::vector<InstancedVertexArray> instancedArrays;
+
+    void create()
+    {
+        glGenVertexArrays(1, &VAO);
+
+        vertices = createBuffer(INITIAL_VERTICES * vertexSize);
+        vertexAllocator.reset(INITIAL_VERTICES, 0);
+        indices = createBuffer(INITIAL_INDEX_UNITS * 4);
+        indexAllocator.reset(INITIAL_INDEX_UNITS, 0);
+
+        glGenBuffers(1, &drawIndices);
+        uploadDrawIndices();
+
+        attachBuffers();
+    }
+
+    void uploadDrawIndices()
+    {
+        std::vector<uint32_t> sequence(drawIndexCount);
+        for (size_t i = 0; i < drawIndexCount; i++)
+        {
+            sequence[i] = (uint32_t)i;
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, drawIndices);
+        glBufferData(GL_COPY_WRITE_BUFFER,
+                     drawIndexCount * sizeof(uint32_t),
+                     sequence.data(),
+                     GL_STATIC_DRAW);
+    }
+
+    static unsigned int createBuffer(size_t size)
+    {
+        unsigned int buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+        return buffer;
+    }
+
+    void attachBuffers()
+    {
+        GLState::bindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, vertices);
+        setupAttributes();
+
+        glBindBuffer(GL_ARRAY_BUFFER, drawIndices);
+        glEnableVertexAttribArray(DRAW_INDEX_LOCATION);
+        glVertexAttribIPointer(
+          DRAW_INDEX_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+        glVertexAttribDivisor(DRAW_INDEX_LOCATION, 1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+        GLState::bindVertexArray(0);
+
+        for (const InstancedVertexArray& instanced : instancedArrays)
+        {
+            attachInstanced(instanced);
+        }
+    }
+
+    void attachInstanced(const InstancedVertexArray& instanced)
+    {
+        GLState::bindVertexArray(instanced.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, vertices);
+        setupAttributes();
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanced.instanceBuffer);
+        instanced.setupInstanceAttributes();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+        GLState::bindVertexArray(0);
+    }
+
+    // moves the live ranges of buffer to the start of a new buffer, large
+    // enough for extra more units
+    void relocate(unsigned int& buffer,
+                  RangeAllocator& allocator,
+                  size_t extra)
+    {
+        bool isVertices = &allocator == &vertexAllocator;
+        size_t unitSize = isVertices ? vertexSize : 4;
+
+        size_t capacity = allocator.getCapacity();
+        while (capacity < allocator.getUsed() + extra)
+        {
+            capacity *= 2;
+        }
+
+        // live allocations in buffer order
+        std::vector<Allocation*> live;
+        for (Allocation& allocation : allocations)
+        {
+            if (allocation.live)
+                live.push_back(&allocation);
+        }
+        std::sort(live.begin(),
+                  live.end(),
+                  [&](const Allocation* a, const Allocation* b)
+                  {
+                      return isVertices
+                               ? a->firstVertex < b->firstVertex
+                               : a->firstIndexUnit < b->firstIndexUnit;
+                  });
+
+        unsigned int relocated = createBuffer(capacity * unitSize);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+
+        size_t offset = 0;
+        for (Allocation* allocation : live)
+        {
+            size_t& first = isVertices ? allocation->firstVertex
+                                       : allocation->firstIndexUnit;
+            size_t count =
+              isVertices ? allocation->vertexCount : allocation->indexUnits;
+
+            glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                                GL_COPY_WRITE_BUFFER,
+                                first * unitSize,
+                                offset * unitSize,
+                                count * unitSize);
+            first = offset;
+            offset += count;
+        }
+
+        glDeleteBuffers(1, &buffer);
+        buffer = relocated;
+        allocator.reset(capacity, offset);
+        stats.relocations++;
+
+        attachBuffers();
+    }
+};
+
+#endif
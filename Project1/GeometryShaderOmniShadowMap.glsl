@@ -4,12 +4,17 @@ layout(triangles) in;
 layout(triangle_strip, max_vertices=18) out;
 
 uniform mat4 shadowMatrices[6];
+// bit i set when the primitive has to be rendered to face i
+uniform int faceMask;
 
 out vec4 FragPos;
 
 void main() {
 	for (int face = 0; face < 6; ++face)
 	{
+		if ((faceMask & (1 << face)) == 0)
+			continue;
+
 		gl_Layer = face;
 		for (int i = 0; i < 3; ++i)
 		{
@@ -0,0 +1,29 @@
+#version 430 core
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices=18) out;
+
+uniform mat4 shadowMatrices[6];
+
+// bit i set when the primitive has to be rendered to face i, per draw
+flat in int FaceMask[];
+
+out vec4 FragPos;
+
+void main() {
+	int faceMask = FaceMask[0];
+	for (int face = 0; face < 6; ++face)
+	{
+		if ((faceMask & (1 << face)) == 0)
+			continue;
+
+		gl_Layer = face;
+		for (int i = 0; i < 3; ++i)
+		{
+			FragPos = gl_in[i].gl_Position;
+			gl_Position = shadowMatrices[face] * FragPos;
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
@@ -0,0 +1,324 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Frustum.h"
+#include "Mesh.h"
+#include "RenderQueue.h"
+#include "Shader.h"
+
+struct GpuCullStats
+{
+    // instances tested by the last cull()
+    unsigned int instances = 0;
+    // draw calls issued by the last draw()
+    unsigned int drawCalls = 0;
+};
+
+// Frustum culling done by a compute shader on GL 4.3 contexts, so that the
+// CPU never looks at the bounds of the instances drawn.
+//
+// Every frame the instances (mesh lod, model matrix, bounding sphere) are
+// added, uploaded at once and tested by ComputeShaderCullInstances.glsl
+// against one frustum, or the six faces of an omni shadow map. Instances are
+// grouped into batches sharing a shader, vertex array, index type and
+// textures, each batch owning as many slots of the command buffer as it has
+// instances: the visible ones write their DrawElementsIndirectCommand and
+// model matrix (binding RenderQueue::DRAW_DATA_BINDING) to the next slot of
+// their batch, the culled ones leave a draw of zero instances behind. One
+// glMultiDrawElementsIndirect per batch draws the whole range, GL 4.3 has no
+// draw count read from a buffer (ARB_indirect_parameters) and reading it
+// back would stall on the GPU.
+//
+// The faces an instance is visible in are written at binding FACE_MASK_BINDING
+// for the omni shadow shaders (GeometryShaderOmniShadowMapIndirect.glsl).
+class GpuCuller
+{
+  public:
+    static constexpr unsigned int GROUP_SIZE = 64;
+    static constexpr int MAX_FRUSTUMS = 6;
+    static constexpr unsigned int INSTANCE_BINDING = 1;
+    static constexpr unsigned int COMMAND_BINDING = 2;
+    static constexpr unsigned int COUNTER_BINDING = 3;
+    static constexpr unsigned int FACE_MASK_BINDING = 4;
+
+    GpuCullStats lastStats;
+
+    GpuCuller()
+      : cullShader("ComputeShaderCullInstances.glsl")
+    {
+        planesLocation = cullShader.getUniformLocation("planes[0]");
+        frustumCountUniform = cullShader.getUniform<int>("frustumCount");
+        instanceCountUniform = cullShader.getUniform<int>("instanceCount");
+
+        glGenBuffers(1, &instanceBuffer);
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &counterBuffer);
+        glGenBuffers(1, &drawDataBuffer);
+        glGenBuffers(1, &faceMaskBuffer);
+    }
+
+    ~GpuCuller()
+    {
+        glDeleteBuffers(1, &instanceBuffer);
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteBuffers(1, &counterBuffer);
+        glDeleteBuffers(1, &drawDataBuffer);
+        glDeleteBuffers(1, &faceMaskBuffer);
+    }
+
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    static bool isSupported() { return GLAD_GL_VERSION_4_3 != 0; }
+
+    // empties the culler for the next frame or view
+    void clear()
+    {
+        instances.clear();
+        batches.clear();
+    }
+
+    // faceMask limits the frustums the instance is tested against, bit i
+    // for the frustum i given to cull()
+    void add(Shader& shader,
+             Mesh& mesh,
+             const glm::mat4& model,
+             unsigned int lod = 0,
+             unsigned int faceMask = 1)
+    {
+        if (mesh.boundingSphere.isEmpty() || faceMask == 0)
+            return;
+
+        uint32_t batch = findBatch(shader, mesh);
+        batches[batch].instanceCount++;
+
+        indirectCommands.clear();
+        mesh.appendIndirectCommands(lod, nullptr, 0, indirectCommands);
+        const DrawElementsIndirectCommand& command = indirectCommands[0];
+
+        // the model matrix drawn with includes the dequantization of packed
+        // vertices, the sphere is moved into the packed space it applies to
+        const glm::mat4& vertexTransform = mesh.vertexTransform;
+        glm::vec3 center =
+          glm::vec3(glm::inverse(vertexTransform) *
+                    glm::vec4(mesh.boundingSphere.center, 1.0f));
+        float radius = mesh.boundingSphere.radius / vertexTransform[0][0];
+
+        Instance instance;
+        instance.model = model * vertexTransform;
+        instance.sphere = glm::vec4(center, radius);
+        instance.count = command.count;
+        instance.firstIndex = command.firstIndex;
+        instance.baseVertex = command.baseVertex;
+        instance.batch = batch;
+        instance.faceMask = faceMask;
+        instances.push_back(instance);
+    }
+
+    size_t size() const { return instances.size(); }
+
+    // tests every instance against the frustums (count <= MAX_FRUSTUMS)
+    void cull(const Frustum* frustums, int count)
+    {
+        lastStats = GpuCullStats();
+        lastStats.instances = (unsigned int)instances.size();
+        if (instances.empty())
+            return;
+
+        count = std::min(count, MAX_FRUSTUMS);
+
+        uint32_t slot = 0;
+        for (Batch& batch : batches)
+        {
+            batch.firstSlot = slot;
+            slot += batch.instanceCount;
+        }
+        for (Instance& instance : instances)
+        {
+            instance.firstSlot = batches[instance.batch].firstSlot;
+        }
+
+        reserve(instances.size(), batches.size());
+
+        // orphaned every frame like the RenderQueue's buffers
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     instances.size() * sizeof(Instance),
+                     instances.data(),
+                     GL_STREAM_DRAW);
+
+        // a culled slot keeps a command of zero indices and instances
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER,
+                          GL_R32UI,
+                          GL_RED_INTEGER,
+                          GL_UNSIGNED_INT,
+                          NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER,
+                          GL_R32UI,
+                          GL_RED_INTEGER,
+                          GL_UNSIGNED_INT,
+                          NULL);
+
+        bindBuffers();
+        glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, instanceBuffer);
+        glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, commandBuffer);
+        glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, COUNTER_BINDING, counterBuffer);
+
+        glm::vec4 planes[MAX_FRUSTUMS * 6];
+        for (int i = 0; i < count; i++)
+        {
+            std::copy(
+              frustums[i].planes, frustums[i].planes + 6, planes + i * 6);
+        }
+
+        cullShader.use();
+        glUniform4fv(planesLocation, count * 6, &planes[0][0]);
+        cullShader.set(frustumCountUniform, count);
+        cullShader.set(instanceCountUniform, (int)instances.size());
+        glDispatchCompute(
+          (GLuint)((instances.size() + GROUP_SIZE - 1) / GROUP_SIZE), 1, 1);
+
+        // the commands are read by the indirect draws, the model matrices
+        // and face masks by their vertex shaders
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT |
+                        GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // draws the instances left by the last cull(), every batch with the
+    // shader it was added with
+    void draw()
+    {
+        if (instances.empty())
+            return;
+
+        bindBuffers();
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+        for (const Batch& batch : batches)
+        {
+            Mesh::getGeometryBuffer(batch.mesh->format)
+              .reserveDrawIndices(instances.size());
+
+            batch.shader->use();
+            batch.mesh->material.bind();
+            GLState::bindVertexArray(batch.mesh->VAO);
+            glMultiDrawElementsIndirect(
+              GL_TRIANGLES,
+              batch.mesh->indexType,
+              (void*)(batch.firstSlot * sizeof(DrawElementsIndirectCommand)),
+              (GLsizei)batch.instanceCount,
+              0);
+            lastStats.drawCalls++;
+        }
+    }
+
+  private:
+    // std430 layout of ComputeShaderCullInstances.glsl's Instance
+    struct Instance
+    {
+        glm::mat4 model;
+        // bounding sphere in the space model transforms from, radius in w
+        glm::vec4 sphere;
+        GLuint count;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint batch;
+        GLuint faceMask;
+        GLuint firstSlot;
+        GLuint padding[2];
+    };
+    static_assert(sizeof(Instance) == 112, "must match the std430 layout");
+
+    struct Batch
+    {
+        Shader* shader;
+        // first mesh added, its vertex array, index type and textures are
+        // the batch's
+        Mesh* mesh;
+        uint32_t instanceCount;
+        uint32_t firstSlot;
+    };
+
+    Shader cullShader;
+    int planesLocation;
+    Uniform<int> frustumCountUniform;
+    Uniform<int> instanceCountUniform;
+
+    unsigned int instanceBuffer = 0;
+    unsigned int commandBuffer = 0;
+    unsigned int counterBuffer = 0;
+    unsigned int drawDataBuffer = 0;
+    unsigned int faceMaskBuffer = 0;
+    size_t slotCapacity = 0;
+    size_t counterCapacity = 0;
+
+    std::vector<Instance> instances;
+    std::vector<Batch> batches;
+    std::vector<DrawElementsIndirectCommand> indirectCommands;
+
+    uint32_t findBatch(Shader& shader, Mesh& mesh)
+    {
+        for (size_t i = 0; i < batches.size(); i++)
+        {
+            const Mesh& other = *batches[i].mesh;
+            if (batches[i].shader == &shader && other.VAO == mesh.VAO &&
+                other.indexType == mesh.indexType &&
+                other.material.bindsSameTextures(mesh.material))
+            {
+                return (uint32_t)i;
+            }
+        }
+
+        batches.push_back({ &shader, &mesh, 0, 0 });
+        return (uint32_t)batches.size() - 1;
+    }
+
+    // grows the slot and counter buffers, their content is rewritten by
+    // every cull()
+    void reserve(size_t slots, size_t counters)
+    {
+        if (slots > slotCapacity)
+        {
+            slotCapacity = std::max(slots, slotCapacity * 2);
+            allocate(commandBuffer,
+                     slotCapacity * sizeof(DrawElementsIndirectCommand));
+            allocate(drawDataBuffer, slotCapacity * sizeof(glm::mat4));
+            allocate(faceMaskBuffer, slotCapacity * sizeof(GLuint));
+        }
+
+        if (counters > counterCapacity)
+        {
+            counterCapacity = std::max(counters, counterCapacity * 2);
+            allocate(counterBuffer, counterCapacity * sizeof(GLuint));
+        }
+    }
+
+    static void allocate(unsigned int buffer, size_t size)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+    }
+
+    void bindBuffers() const
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER,
+                         RenderQueue::DRAW_DATA_BINDING,
+                         drawDataBuffer);
+        glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, FACE_MASK_BINDING, faceMaskBuffer);
+    }
+};
+
+#endif
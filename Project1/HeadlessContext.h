@@ -0,0 +1,215 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+// Linux build agents have no display, the context is created through EGL on
+// Mesa's surfaceless platform (llvmpipe when there is no GPU). Elsewhere a
+// hidden GLFW window provides the context.
+//
+// Only the Visual Studio project is part of this tree. A Linux build
+// (glad.c, imgui, GLFW, assimp, libEGL) is set up by the build agent, it is
+// not provided here.
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+
+// OpenGL context without anything on screen, everything is rendered to an
+// OffscreenTarget
+class HeadlessContext
+{
+  public:
+    HeadlessContext() = default;
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    ~HeadlessContext() { destroy(); }
+
+    // creates a core profile context of the given version, makes it current
+    // and loads the GL functions
+    bool create(int major, int minor)
+    {
+#ifdef __linux__
+        auto getPlatformDisplay =
+          (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+        {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                         EGL_DEFAULT_DISPLAY,
+                                         NULL);
+        }
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint eglMajor, eglMinor;
+        if (display == EGL_NO_DISPLAY ||
+            !eglInitialize(display, &eglMajor, &eglMinor))
+        {
+            std::cout << "ERROR::HEADLESS::EGL_INITIALIZATION_FAILED"
+                      << std::endl;
+            return false;
+        }
+
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cout << "ERROR::HEADLESS::NO_OPENGL_API" << std::endl;
+            return false;
+        }
+
+        const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE,
+                                            EGL_OPENGL_BIT,
+                                            EGL_NONE };
+        EGLConfig config = NULL;
+        EGLint configCount = 0;
+        eglChooseConfig(display, configAttributes, &config, 1, &configCount);
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION,
+            major,
+            EGL_CONTEXT_MINOR_VERSION,
+            minor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK,
+            EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display,
+                                   configCount ? config : NULL,
+                                   EGL_NO_CONTEXT,
+                                   contextAttributes);
+
+        // no surface, rendering only ever goes to framebuffer objects
+        if (context == EGL_NO_CONTEXT ||
+            !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            std::cout << "ERROR::HEADLESS::CONTEXT_CREATION_FAILED "
+                      << std::hex << eglGetError() << std::dec << std::endl;
+            return false;
+        }
+
+        return loadFunctions((GLADloadproc)eglGetProcAddress);
+#else
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+        window = glfwCreateWindow(1, 1, "headless", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "ERROR::HEADLESS::CONTEXT_CREATION_FAILED"
+                      << std::endl;
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+
+        return loadFunctions((GLADloadproc)glfwGetProcAddress);
+#endif
+    }
+
+    void destroy()
+    {
+#ifdef __linux__
+        if (display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(display,
+                           EGL_NO_SURFACE,
+                           EGL_NO_SURFACE,
+                           EGL_NO_CONTEXT);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+        }
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+#else
+        if (window != NULL)
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+        window = NULL;
+#endif
+    }
+
+  private:
+#ifdef __linux__
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#else
+    GLFWwindow* window = NULL;
+#endif
+
+    static bool loadFunctions(GLADloadproc loader)
+    {
+        if (!gladLoadGLLoader(loader))
+        {
+            std::cout << "ERROR::HEADLESS::GLAD_INITIALIZATION_FAILED"
+                      << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+};
+
+// Framebuffer standing in for the window's default framebuffer: sRGB color
+// and a packed depth stencil buffer
+class OffscreenTarget
+{
+  public:
+    unsigned int FBO = 0;
+
+    OffscreenTarget(int width, int height)
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenRenderbuffers(1, &colorBuffer);
+        glGenRenderbuffers(1, &depthStencilBuffer);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, depthStencilBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER,
+                              GL_DEPTH24_STENCIL8,
+                              width,
+                              height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                  GL_COLOR_ATTACHMENT0,
+                                  GL_RENDERBUFFER,
+                                  colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                  GL_DEPTH_STENCIL_ATTACHMENT,
+                                  GL_RENDERBUFFER,
+                                  depthStencilBuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+            GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~OffscreenTarget()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        glDeleteRenderbuffers(1, &depthStencilBuffer);
+    }
+
+  private:
+    unsigned int colorBuffer = 0, depthStencilBuffer = 0;
+};
+
+#endif
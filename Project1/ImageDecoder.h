@@ -0,0 +1,191 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BlockCompression.h"
+#include "Mipmaps.h"
+#include "ThreadPool.h"
+#include "stb_image.h"
+
+// pixels of a decoded image file, data is NULL if it failed to load
+struct DecodedImage
+{
+    unsigned char* data = NULL;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+
+    std::string path;
+    // caller chosen value identifying what the image is for
+    unsigned int tag = 0;
+
+    // levels 1 and down of the mip chain when it was requested, level 0 is
+    // data
+    std::vector<std::vector<unsigned char>> mipmaps;
+
+    // block compressed images (TextureBaker) keep level 0 in blocks, data
+    // points into it instead of stb allocated pixels
+    BlockFormat blockFormat = BlockFormat::None;
+    std::vector<unsigned char> blocks;
+
+    bool isCompressed() const { return blockFormat != BlockFormat::None; }
+
+    int getLevelCount() const { return 1 + (int)mipmaps.size(); }
+    int getLevelWidth(int level) const { return std::max(width >> level, 1); }
+    int getLevelHeight(int level) const
+    {
+        return std::max(height >> level, 1);
+    }
+
+    // rows of texels of a level, or rows of blocks when compressed
+    int getRowCount(int level) const
+    {
+        int levelHeight = getLevelHeight(level);
+        return isCompressed() ? (levelHeight + 3) / 4 : levelHeight;
+    }
+
+    size_t getRowSize(int level) const
+    {
+        int levelWidth = getLevelWidth(level);
+        return isCompressed()
+                 ? (size_t)((levelWidth + 3) / 4) * getBlockSize(blockFormat)
+                 : (size_t)levelWidth * components;
+    }
+
+    size_t getLevelSize(int level) const
+    {
+        return getRowCount(level) * getRowSize(level);
+    }
+
+    const unsigned char* getLevelData(int level) const
+    {
+        return level == 0 ? data : mipmaps[level - 1].data();
+    }
+
+    void free()
+    {
+        if (!isCompressed())
+            stbi_image_free(data);
+        data = NULL;
+        mipmaps.clear();
+        blocks = std::vector<unsigned char>();
+    }
+};
+
+// decodes an image file on the calling thread, with its whole mip chain
+// generated with the given options when mipmaps is set
+inline DecodedImage
+decodeImage(const std::string& path,
+            unsigned int tag,
+            bool mipmaps = false,
+            const MipmapOptions& options = MipmapOptions())
+{
+    DecodedImage image;
+    image.path = path;
+    image.tag = tag;
+    image.data = stbi_load(path.c_str(),
+                           &image.width,
+                           &image.height,
+                           &image.components,
+                           0);
+
+    if (image.data && mipmaps)
+    {
+        generateMipmaps(image.data,
+                        image.width,
+                        image.height,
+                        image.components,
+                        options,
+                        image.mipmaps);
+    }
+
+    return image;
+}
+
+// Decodes image files on the thread pool, one job per file, and hands them
+// back in completion order so the GL thread can upload each image as soon
+// as it is ready instead of waiting for the slowest one.
+class ImageDecoder
+{
+  public:
+    explicit ImageDecoder(ThreadPool& pool = ThreadPool::shared())
+      : pool(pool)
+    {
+    }
+
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+    // waits for the jobs still running, they write into this decoder
+    ~ImageDecoder()
+    {
+        DecodedImage image;
+        while (next(image))
+        {
+            image.free();
+        }
+    }
+
+    void decode(const std::string& path,
+                unsigned int tag,
+                bool mipmaps = false)
+    {
+        decode([path, tag, mipmaps]
+               { return decodeImage(path, tag, mipmaps); });
+    }
+
+    // runs a job producing the image instead of decodeImage, e.g. reading
+    // a baked texture
+    void decode(std::function<DecodedImage()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending++;
+        }
+
+        pool.submit(
+          [this, job]
+          {
+              DecodedImage image = job();
+
+              // notified under the lock: once next() returns the last image
+              // the decoder may be destroyed, the worker must not touch it
+              // after releasing the lock
+              std::lock_guard<std::mutex> lock(mutex);
+              completed.push_back(std::move(image));
+              imageCompleted.notify_one();
+          });
+    }
+
+    // blocks until the next image is decoded, false once every submitted
+    // image has been returned. The caller owns the returned pixels.
+    bool next(DecodedImage& image)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (pending == 0)
+            return false;
+
+        imageCompleted.wait(lock, [this] { return !completed.empty(); });
+
+        image = std::move(completed.back());
+        completed.pop_back();
+        pending--;
+        return true;
+    }
+
+  private:
+    ThreadPool& pool;
+
+    std::mutex mutex;
+    std::condition_variable imageCompleted;
+    std::vector<DecodedImage> completed;
+    unsigned int pending = 0;
+};
+
+#endif
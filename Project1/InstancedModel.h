@@ -0,0 +1,366 @@
+#ifndef INSTANCED_MODEL_H
+#define INSTANCED_MODEL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "BoundingBox.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "LodSelector.h"
+#include "Model.h"
+#include "Shader.h"
+
+// work of the last Draw(), nothing is uploaded when the instances did not
+// change
+struct InstancedModelStats
+{
+    unsigned int instances = 0;
+    // instances of the cells in the frustum
+    unsigned int visible = 0;
+    unsigned int cells = 0;
+    unsigned int visibleCells = 0;
+    unsigned int drawCalls = 0;
+    size_t uploadedBytes = 0;
+};
+
+// Many copies of a Model drawn with hardware instancing: each mesh is drawn
+// by glDrawElementsInstancedBaseVertex for a range of instances, reading the
+// instance's model matrix and normal matrix from per-instance attributes.
+//
+// The normal matrices are computed once per instance when it is added
+// instead of per vertex in the shader. At the first draw after the
+// instances changed they are split into cells of neighbouring instances
+// (halving the longest side of their bounds until a cell has at most
+// CELL_INSTANCES) and uploaded once, ordered by cell. Every frame only the
+// cells are frustum culled and given a level of detail per mesh, the one of
+// their nearest and largest instance, and runs of consecutive visible cells
+// at the same level are drawn by one instanced draw. GL 3.3 has no base
+// instance, the instance attributes are pointed at the run before its draw.
+//
+// The instance attributes follow the mesh's (0 to 4) and the geometry
+// buffers' draw index (5):
+//   6..9   mat4 instanceMatrix
+//   10..12 mat3 normalMatrix
+// The vertexTransform of packed meshes is not part of the instance matrix,
+// it is set per mesh to the shader's vertexTransform uniform (see
+// VertexShaderInstancingAsteroidsPacked.glsl).
+class InstancedModel
+{
+  public:
+    static constexpr unsigned int INSTANCE_MATRIX_LOCATION = 6;
+    static constexpr unsigned int NORMAL_MATRIX_LOCATION = 10;
+    static constexpr size_t CELL_INSTANCES = 1024;
+
+    InstancedModelStats lastStats;
+
+    explicit InstancedModel(Model& model)
+      : model(model)
+    {
+        glGenBuffers(1, &instanceBuffer);
+    }
+
+    ~InstancedModel()
+    {
+        for (int format = 0; format < FORMAT_COUNT; format++)
+        {
+            if (vertexArrays[format])
+                Mesh::getGeometryBuffer((VertexFormat)format)
+                  .releaseVertexArray(vertexArrays[format]);
+        }
+        glDeleteBuffers(1, &instanceBuffer);
+    }
+
+    InstancedModel(const InstancedModel&) = delete;
+    InstancedModel& operator=(const InstancedModel&) = delete;
+
+    void clear()
+    {
+        instances.clear();
+        dirty = true;
+    }
+
+    void reserve(size_t count) { instances.reserve(count); }
+
+    void add(const glm::mat4& instanceModel)
+    {
+        instances.push_back(
+          { instanceModel,
+            glm::mat3(glm::transpose(glm::inverse(instanceModel))) });
+        dirty = true;
+    }
+
+    size_t size() const { return instances.size(); }
+
+    // draws the instances of the cells intersecting frustum, each mesh at
+    // the level of detail lodSelector picks for the cell
+    void Draw(Shader& shader,
+              Uniform<glm::mat4> vertexTransformUniform,
+              const Frustum& frustum,
+              const LodSelector& lodSelector)
+    {
+        lastStats = InstancedModelStats();
+        lastStats.instances = (unsigned int)instances.size();
+        if (instances.empty())
+            return;
+
+        if (dirty)
+            buildCells();
+        lastStats.cells = (unsigned int)cells.size();
+
+        visibleCells.assign(cells.size(), false);
+        for (size_t i = 0; i < cells.size(); i++)
+        {
+            if (!frustum.intersects(cells[i].sphere))
+                continue;
+
+            visibleCells[i] = true;
+            lastStats.visibleCells++;
+            lastStats.visible += cells[i].count;
+        }
+        if (lastStats.visibleCells == 0)
+            return;
+
+        shader.use();
+        for (Mesh& mesh : model.meshes)
+        {
+            // run of consecutive visible cells at the same level
+            uint32_t first = 0, count = 0;
+            unsigned int runLod = 0;
+
+            for (size_t i = 0; i < cells.size(); i++)
+            {
+                if (!visibleCells[i])
+                    continue;
+
+                const Cell& cell = cells[i];
+                unsigned int lod =
+                  lodSelector.select(mesh, cell.sphere, cell.scale);
+                if (count > 0 && first + count == cell.first && lod == runLod)
+                {
+                    count += cell.count;
+                    continue;
+                }
+
+                if (count > 0)
+                {
+                    draw(shader,
+                         vertexTransformUniform,
+                         mesh,
+                         runLod,
+                         first,
+                         count);
+                }
+                first = cell.first;
+                count = cell.count;
+                runLod = lod;
+            }
+
+            if (count > 0)
+            {
+                draw(
+                  shader, vertexTransformUniform, mesh, runLod, first, count);
+            }
+        }
+    }
+
+  private:
+    // 100 bytes, the normal matrix columns are read as tightly packed vec3
+    struct Instance
+    {
+        glm::mat4 model;
+        glm::mat3 normalMatrix;
+    };
+
+    // range of the instance buffer and the sphere bounding its instances
+    struct Cell
+    {
+        uint32_t first;
+        uint32_t count;
+        BoundingSphere sphere;
+        // largest scale of the model in the cell
+        float scale;
+    };
+
+    static constexpr int FORMAT_COUNT = 2;
+
+    Model& model;
+    std::vector<Instance> instances;
+    std::vector<Cell> cells;
+    std::vector<bool> visibleCells;
+    bool dirty = false;
+
+    unsigned int instanceBuffer = 0;
+    unsigned int vertexArrays[FORMAT_COUNT] = {};
+
+    // splits the instances into cells, reorders them cell by cell and
+    // uploads them
+    void buildCells()
+    {
+        std::vector<BoundingSphere> spheres(instances.size());
+        for (size_t i = 0; i < instances.size(); i++)
+        {
+            spheres[i] = model.boundingSphere.transformed(instances[i].model);
+        }
+
+        std::vector<uint32_t> order(instances.size());
+        std::iota(order.begin(), order.end(), 0);
+
+        cells.clear();
+        split(order, 0, (uint32_t)order.size(), spheres);
+
+        std::vector<Instance> sorted(instances.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            sorted[i] = instances[order[i]];
+        }
+        instances.swap(sorted);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER,
+                     instances.size() * sizeof(Instance),
+                     instances.data(),
+                     GL_STATIC_DRAW);
+
+        lastStats.uploadedBytes = instances.size() * sizeof(Instance);
+        dirty = false;
+    }
+
+    // cells of order[first, first + count), which it sorts along the way
+    void split(std::vector<uint32_t>& order,
+               uint32_t first,
+               uint32_t count,
+               const std::vector<BoundingSphere>& spheres)
+    {
+        BoundingBox centers;
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            centers.extend(spheres[order[i]].center);
+        }
+
+        if (count <= CELL_INSTANCES)
+        {
+            Cell cell;
+            cell.first = first;
+            cell.count = count;
+            cell.sphere.center = centers.getCenter();
+            cell.sphere.radius = 0.0f;
+            cell.scale = 0.0f;
+
+            float modelRadius = model.boundingSphere.radius;
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                const BoundingSphere& sphere = spheres[order[i]];
+                cell.sphere.radius = std::max(
+                  cell.sphere.radius,
+                  glm::distance(cell.sphere.center, sphere.center) +
+                    sphere.radius);
+                if (modelRadius > 0.0f)
+                    cell.scale =
+                      std::max(cell.scale, sphere.radius / modelRadius);
+            }
+
+            cells.push_back(cell);
+            return;
+        }
+
+        glm::vec3 extent = centers.max - centers.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                       : (extent.y > extent.z ? 1 : 2);
+
+        uint32_t half = count / 2;
+        std::nth_element(order.begin() + first,
+                         order.begin() + first + half,
+                         order.begin() + first + count,
+                         [&](uint32_t a, uint32_t b)
+                         {
+                             return spheres[a].center[axis] <
+                                    spheres[b].center[axis];
+                         });
+
+        split(order, first, half, spheres);
+        split(order, first + half, count - half, spheres);
+    }
+
+    // draws count instances from firstInstance in the instance buffer
+    void draw(Shader& shader,
+              Uniform<glm::mat4> vertexTransformUniform,
+              Mesh& mesh,
+              unsigned int lod,
+              uint32_t firstInstance,
+              uint32_t count)
+    {
+        unsigned int vertexArray = getVertexArray(mesh.format);
+        GLState::bindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        pointInstanceAttributes(firstInstance);
+
+        mesh.DrawInstanced(
+          shader, vertexTransformUniform, vertexArray, (GLsizei)count, lod);
+        lastStats.drawCalls++;
+    }
+
+    unsigned int getVertexArray(VertexFormat format)
+    {
+        unsigned int& vertexArray = vertexArrays[(int)format];
+        if (!vertexArray)
+            vertexArray =
+              Mesh::getGeometryBuffer(format).createInstancedVertexArray(
+                instanceBuffer, setupInstanceAttributes);
+        return vertexArray;
+    }
+
+    // one attribute per matrix column, advancing once per instance
+    static void setupInstanceAttributes()
+    {
+        for (unsigned int column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(INSTANCE_MATRIX_LOCATION + column);
+            glVertexAttribDivisor(INSTANCE_MATRIX_LOCATION + column, 1);
+        }
+        for (unsigned int column = 0; column < 3; column++)
+        {
+            glEnableVertexAttribArray(NORMAL_MATRIX_LOCATION + column);
+            glVertexAttribDivisor(NORMAL_MATRIX_LOCATION + column, 1);
+        }
+        pointInstanceAttributes(0);
+    }
+
+    // points the attributes of the bound vertex array at the instances from
+    // firstInstance in the bound array buffer
+    static void pointInstanceAttributes(uint32_t firstInstance)
+    {
+        size_t first = firstInstance * sizeof(Instance);
+
+        for (unsigned int column = 0; column < 4; column++)
+        {
+            glVertexAttribPointer(INSTANCE_MATRIX_LOCATION + column,
+                                  4,
+                                  GL_FLOAT,
+                                  GL_FALSE,
+                                  sizeof(Instance),
+                                  (void*)(first + offsetof(Instance, model) +
+                                          column * sizeof(glm::vec4)));
+        }
+
+        for (unsigned int column = 0; column < 3; column++)
+        {
+            glVertexAttribPointer(
+              NORMAL_MATRIX_LOCATION + column,
+              3,
+              GL_FLOAT,
+              GL_FALSE,
+              sizeof(Instance),
+              (void*)(first + offsetof(Instance, normalMatrix) +
+                      column * sizeof(glm::vec3)));
+        }
+    }
+};
+
+#endif
@@ -2,14 +2,114 @@
 #define LIGHT
 
 #include "Shader.h"
+#include <cfloat>
+#include <memory>
 #include <random>
 
+// must match the lit shaders, the whole LightBlock has to stay below the
+// 16KB guaranteed by GL_MAX_UNIFORM_BLOCK_SIZE
+#define MAX_NR_DIRECTIONAL_LIGHTS 4
+#define MAX_NR_POINT_LIGHTS 192
+#define MAX_NR_SPOT_LIGHTS 32
+
+// lights are culled once their attenuated contribution drops below this
+#define LIGHT_CUTOFF_INTENSITY (5.0f / 256.0f)
+
+// std140 mirrors of the structs of the LightBlock uniform block declared in
+// the lit shaders, vec3s are followed by a scalar to fill their 16 bytes
+struct DirectionalLightStd140
+{
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct PointLightStd140
+{
+    glm::vec3 position;
+    int casts_shadows;
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+};
+
+struct SpotLightStd140
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 direction;
+    float linear;
+    glm::vec3 ambient;
+    float quadratic;
+    glm::vec3 diffuse;
+    float innerCutoff;
+    glm::vec3 specular;
+    float outerCutoff;
+};
+
+// froxel grid used by the fragment shader to find its light cluster
+struct ClusterGridStd140
+{
+    int size[4];          // x tiles, y tiles, z slices, unused
+    float tileSize[4];    // tile width, tile height in pixels, unused
+    float depthParams[4]; // near, far, slice scale, slice bias
+};
+
+struct LightBlockStd140
+{
+    int NUMBER_OF_DIRECTIONAL_LIGHTS;
+    int NUMBER_OF_POINT_LIGHTS;
+    int NUMBER_OF_SPOT_LIGHTS;
+    int padding;
+
+    ClusterGridStd140 clusterGrid;
+
+    DirectionalLightStd140 directionalLights[MAX_NR_DIRECTIONAL_LIGHTS];
+    PointLightStd140 pointLights[MAX_NR_POINT_LIGHTS];
+    SpotLightStd140 spotLights[MAX_NR_SPOT_LIGHTS];
+};
+
+static_assert(sizeof(DirectionalLightStd140) == 64, "std140 layout");
+static_assert(sizeof(PointLightStd140) == 64, "std140 layout");
+static_assert(sizeof(SpotLightStd140) == 80, "std140 layout");
+static_assert(sizeof(LightBlockStd140) <= 16384, "LightBlock too large");
+
+// distance at which an attenuated light falls below LIGHT_CUTOFF_INTENSITY
+inline float
+attenuationRadius(float constant,
+                  float linear,
+                  float quadratic,
+                  float maxIntensity)
+{
+    float c = constant - maxIntensity / LIGHT_CUTOFF_INTENSITY;
+    if (quadratic <= 0.0f)
+        return linear > 0.0f ? -c / linear : FLT_MAX;
+
+    return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) /
+           (2.0f * quadratic);
+}
+
+inline float
+maxComponent(glm::vec3 v)
+{
+    return std::max(v.x, std::max(v.y, v.z));
+}
+
 class Light
 {
   public:
     int GetLightId() const { return id; }
 
-    virtual void setUniforms(Shader& shader) const = 0;
+    // writes the light at its id in the uniform block data
+    virtual void writeToBlock(LightBlockStd140& block) const = 0;
 
   protected:
     static int directionalLightsCounter;
@@ -43,18 +143,20 @@ class DirectionalLight : public Light
         std::cout << "directional light id : " << GetLightId() << std::endl;
     }
 
-    void setUniforms(Shader& shader) const override
+    void writeToBlock(LightBlockStd140& block) const override
     {
-        shader.setInt("NUMBER_OF_DIRECTIONAL_LIGHTS",
-                      Light::directionalLightsCounter);
+        if (GetLightId() >= MAX_NR_DIRECTIONAL_LIGHTS)
+            return;
+
+        block.NUMBER_OF_DIRECTIONAL_LIGHTS =
+          std::max(block.NUMBER_OF_DIRECTIONAL_LIGHTS, GetLightId() + 1);
 
-        string lightGLID =
-          "directionalLights[" + std::to_string(GetLightId()) + "]";
+        DirectionalLightStd140& light = block.directionalLights[GetLightId()];
 
-        shader.setVec3(lightGLID + ".direction", direction);
-        shader.setVec3(lightGLID + ".ambient", ambient);
-        shader.setVec3(lightGLID + ".diffuse", diffuse);
-        shader.setVec3(lightGLID + ".specular", specular);
+        light.direction = direction;
+        light.ambient = ambient;
+        light.diffuse = diffuse;
+        light.specular = specular;
     }
 
   private:
@@ -90,26 +192,37 @@ class PointLight : public Light
         std::cout << "point light id : " << GetLightId() << std::endl;
     }
 
-    void setUniforms(Shader& shader) const override
+    void writeToBlock(LightBlockStd140& block) const override
     {
-        shader.setInt("NUMBER_OF_POINT_LIGHTS",
-                      Light::pointLightsCounter);
-
-        const string lightGLID =
-          "pointLights[" + std::to_string(GetLightId()) + "]";
-
-        shader.setBool(lightGLID + ".casts_shadows", casts_shadows);
-        shader.setVec3(lightGLID + ".ambient", ambient);
-        shader.setVec3(lightGLID + ".position", position);
-        shader.setVec3(lightGLID + ".diffuse", diffuse);
-        shader.setVec3(lightGLID + ".specular", specular);
-        shader.setFloat(lightGLID + ".constant", constant);
-        shader.setFloat(lightGLID + ".linear", linear);
-        shader.setFloat(lightGLID + ".quadratic", quadratic);
+        if (GetLightId() >= MAX_NR_POINT_LIGHTS)
+            return;
+
+        block.NUMBER_OF_POINT_LIGHTS =
+          std::max(block.NUMBER_OF_POINT_LIGHTS, GetLightId() + 1);
+
+        PointLightStd140& light = block.pointLights[GetLightId()];
+
+        light.position = position;
+        light.casts_shadows = casts_shadows;
+        light.ambient = ambient;
+        light.diffuse = diffuse;
+        light.specular = specular;
+        light.constant = constant;
+        light.linear = linear;
+        light.quadratic = quadratic;
     }
 
-    glm::vec3 getPosition() { return position; }
-    glm::vec3 getDiffuse() { return diffuse; }
+    glm::vec3 getPosition() const { return position; }
+    glm::vec3 getDiffuse() const { return diffuse; }
+
+    float getRadius() const
+    {
+        return attenuationRadius(constant,
+                                 linear,
+                                 quadratic,
+                                 std::max(maxComponent(diffuse),
+                                          maxComponent(specular)));
+    }
 
     glm::vec3 position;
 
@@ -156,23 +269,37 @@ class SpotLight : public Light
         std::cout << "spot light id : " << GetLightId() << std::endl;
     }
 
-    void setUniforms(Shader& shader) const override
+    void writeToBlock(LightBlockStd140& block) const override
+    {
+        if (GetLightId() >= MAX_NR_SPOT_LIGHTS)
+            return;
+
+        block.NUMBER_OF_SPOT_LIGHTS =
+          std::max(block.NUMBER_OF_SPOT_LIGHTS, GetLightId() + 1);
+
+        SpotLightStd140& light = block.spotLights[GetLightId()];
+
+        light.position = position;
+        light.direction = direction;
+        light.ambient = ambient;
+        light.diffuse = diffuse;
+        light.specular = specular;
+        light.constant = constant;
+        light.linear = linear;
+        light.quadratic = quadratic;
+        light.innerCutoff = innerCutoff;
+        light.outerCutoff = outerCutoff;
+    }
+
+    glm::vec3 getPosition() const { return position; }
+
+    float getRadius() const
     {
-        shader.setInt("NUMBER_OF_SPOT_LIGHTS", Light::spotLightsCounter);
- 
-        const string lightGLID =
-          "spotLights[" + std::to_string(GetLightId()) + "]";
-
-        shader.setVec3(lightGLID + ".position", position);
-        shader.setVec3(lightGLID + ".direction", direction);
-        shader.setVec3(lightGLID + ".ambient", ambient);
-        shader.setVec3(lightGLID + ".diffuse", diffuse);
-        shader.setVec3(lightGLID + ".specular", specular);
-        shader.setFloat(lightGLID + ".constant", constant);
-        shader.setFloat(lightGLID + ".linear", linear);
-        shader.setFloat(lightGLID + ".quadratic", quadratic);
-        shader.setFloat(lightGLID + ".innerCutoff", innerCutoff);
-        shader.setFloat(lightGLID + ".outerCutoff", outerCutoff);
+        return attenuationRadius(constant,
+                                 linear,
+                                 quadratic,
+                                 std::max(maxComponent(diffuse),
+                                          maxComponent(specular)));
     }
 
   private:
@@ -193,4 +320,50 @@ class SpotLight : public Light
     float outerCutoff;
 };
 
+// LightBlock uniform buffer, filled once per frame from every light and bound
+// to a fixed binding point shared by all lit shaders
+class LightUniformBuffer
+{
+  public:
+    static const unsigned int BINDING = 2;
+
+    LightUniformBuffer()
+    {
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER,
+                     sizeof(LightBlockStd140),
+                     NULL,
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, UBO);
+    }
+
+    void attach(const Shader& shader) const
+    {
+        shader.setUniformBlock("LightBlock", BINDING);
+    }
+
+    void update(const vector<std::shared_ptr<Light>>& lights,
+                const ClusterGridStd140& clusterGrid)
+    {
+        block = LightBlockStd140();
+        block.clusterGrid = clusterGrid;
+
+        for (auto& light : lights)
+        {
+            light->writeToBlock(block);
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightBlockStd140), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+  private:
+    unsigned int UBO;
+    LightBlockStd140 block;
+};
+
 #endif
@@ -0,0 +1,403 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Light.h"
+
+// must match the texture units sampled by the clustered lit shaders
+#define LIGHT_CLUSTERS_TEXTURE_UNIT 11
+#define LIGHT_INDICES_TEXTURE_UNIT 12
+
+struct LightClusterStats
+{
+    unsigned int lights = 0;
+    unsigned int indices = 0;
+    unsigned int maxLightsPerCluster = 0;
+};
+
+// Clustered forward light assignment: the view frustum is split into a grid
+// of froxels (screen tiles x exponential depth slices), every point and spot
+// light is binned into the froxels its bounding sphere touches and the
+// per-cluster light lists are uploaded as texture buffers.
+//
+// lightClusters (RG32UI, one texel per cluster)
+//   x: offset in lightIndices, y: point count | spot count << 16
+// lightIndices (R16UI)
+//   point light ids of the cluster followed by its spot light ids
+class LightClusters
+{
+  public:
+    static const int GRID_X = 16;
+    static const int GRID_Y = 9;
+    static const int GRID_Z = 24;
+    static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+
+    // GL_MAX_TEXTURE_BUFFER_SIZE is at least 65536 texels
+    static const int MAX_LIGHT_INDICES = 65536;
+
+    LightClusterStats lastFrameStats;
+
+    LightClusters()
+    {
+        glGenBuffers(1, &clustersBuffer);
+        glGenBuffers(1, &indicesBuffer);
+        glGenTextures(1, &clustersTexture);
+        glGenTextures(1, &indicesTexture);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, clustersBuffer);
+        glBufferData(GL_TEXTURE_BUFFER,
+                     CLUSTER_COUNT * 2 * sizeof(uint32_t),
+                     NULL,
+                     GL_STREAM_DRAW);
+        GLState::bindTexture(0, GL_TEXTURE_BUFFER, clustersTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, clustersBuffer);
+
+        glBindBuffer(GL_TEXTURE_BUFFER, indicesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER,
+                     MAX_LIGHT_INDICES * sizeof(uint16_t),
+                     NULL,
+                     GL_STREAM_DRAW);
+        GLState::bindTexture(0, GL_TEXTURE_BUFFER, indicesTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, indicesBuffer);
+
+        GLState::bindTexture(0, GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        clusterData.resize(CLUSTER_COUNT * 2);
+        clusterCounts.resize(CLUSTER_COUNT);
+    }
+
+    void attach(const Shader& shader) const
+    {
+        shader.use();
+        shader.setInt("lightClusters", LIGHT_CLUSTERS_TEXTURE_UNIT);
+        shader.setInt("lightIndices", LIGHT_INDICES_TEXTURE_UNIT);
+    }
+
+    void bind() const
+    {
+        GLState::bindTexture(LIGHT_CLUSTERS_TEXTURE_UNIT,
+                             GL_TEXTURE_BUFFER,
+                             clustersTexture);
+        GLState::bindTexture(LIGHT_INDICES_TEXTURE_UNIT,
+                             GL_TEXTURE_BUFFER,
+                             indicesTexture);
+    }
+
+    // projection must be a symmetric perspective projection using the given
+    // near and far planes
+    void update(const vector<std::shared_ptr<Light>>& lights,
+                const glm::mat4& view,
+                const glm::mat4& projection,
+                float nearPlane,
+                float farPlane,
+                int viewportWidth,
+                int viewportHeight)
+    {
+        if (projection != cachedProjection || nearPlane != zNear ||
+            farPlane != zFar)
+        {
+            buildFroxels(projection, nearPlane, farPlane);
+        }
+
+        grid.size[0] = GRID_X;
+        grid.size[1] = GRID_Y;
+        grid.size[2] = GRID_Z;
+        // not rounded so the shader's pixel to tile mapping matches the ndc
+        // tiles lights are binned into
+        grid.tileSize[0] = (float)viewportWidth / GRID_X;
+        grid.tileSize[1] = (float)viewportHeight / GRID_Y;
+        grid.depthParams[0] = zNear;
+        grid.depthParams[1] = zFar;
+        grid.depthParams[2] = sliceScale;
+        grid.depthParams[3] = sliceBias;
+
+        assignments.clear();
+        lastFrameStats = LightClusterStats();
+
+        // point lights first so the counting sort below keeps every cluster's
+        // point lights ahead of its spot lights
+        for (auto& light : lights)
+        {
+            auto pointLight = dynamic_cast<const PointLight*>(light.get());
+            if (pointLight && pointLight->GetLightId() < MAX_NR_POINT_LIGHTS)
+            {
+                assignLight(pointLight->GetLightId(),
+                            false,
+                            glm::vec3(view *
+                                      glm::vec4(pointLight->getPosition(), 1)),
+                            pointLight->getRadius());
+            }
+        }
+        for (auto& light : lights)
+        {
+            auto spotLight = dynamic_cast<const SpotLight*>(light.get());
+            if (spotLight && spotLight->GetLightId() < MAX_NR_SPOT_LIGHTS)
+            {
+                assignLight(spotLight->GetLightId(),
+                            true,
+                            glm::vec3(view *
+                                      glm::vec4(spotLight->getPosition(), 1)),
+                            spotLight->getRadius());
+            }
+        }
+
+        buildLightLists();
+
+        glBindBuffer(GL_TEXTURE_BUFFER, clustersBuffer);
+        glBufferData(GL_TEXTURE_BUFFER,
+                     clusterData.size() * sizeof(uint32_t),
+                     NULL,
+                     GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER,
+                        0,
+                        clusterData.size() * sizeof(uint32_t),
+                        clusterData.data());
+
+        glBindBuffer(GL_TEXTURE_BUFFER, indicesBuffer);
+        glBufferData(GL_TEXTURE_BUFFER,
+                     MAX_LIGHT_INDICES * sizeof(uint16_t),
+                     NULL,
+                     GL_STREAM_DRAW);
+        if (!lightIndices.empty())
+        {
+            glBufferSubData(GL_TEXTURE_BUFFER,
+                            0,
+                            lightIndices.size() * sizeof(uint16_t),
+                            lightIndices.data());
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    const ClusterGridStd140& getGrid() const { return grid; }
+
+  private:
+    struct Froxel
+    {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    struct Assignment
+    {
+        uint32_t cluster;
+        uint16_t lightId;
+        bool spot;
+    };
+
+    unsigned int clustersBuffer, indicesBuffer;
+    unsigned int clustersTexture, indicesTexture;
+
+    ClusterGridStd140 grid = {};
+
+    glm::mat4 cachedProjection = glm::mat4(0.0f);
+    float zNear = 0.0f, zFar = 0.0f;
+    float sliceScale = 0.0f, sliceBias = 0.0f;
+    float projectionScaleX = 1.0f, projectionScaleY = 1.0f;
+
+    vector<Froxel> froxels;
+    vector<float> sliceDepths;
+
+    vector<Assignment> assignments;
+    vector<uint32_t> clusterCounts;
+    vector<uint32_t> clusterData;
+    vector<uint16_t> lightIndices;
+
+    static int clusterIndex(int x, int y, int z)
+    {
+        return x + GRID_X * (y + GRID_Y * z);
+    }
+
+    // view space bounds of every froxel, only depends on the projection
+    void buildFroxels(const glm::mat4& projection,
+                      float nearPlane,
+                      float farPlane)
+    {
+        cachedProjection = projection;
+        zNear = nearPlane;
+        zFar = farPlane;
+
+        projectionScaleX = projection[0][0];
+        projectionScaleY = projection[1][1];
+
+        // slice = log(depth) * scale - bias
+        sliceScale = GRID_Z / std::log(zFar / zNear);
+        sliceBias = GRID_Z * std::log(zNear) / std::log(zFar / zNear);
+
+        sliceDepths.resize(GRID_Z + 1);
+        for (int z = 0; z <= GRID_Z; z++)
+        {
+            sliceDepths[z] = zNear * std::pow(zFar / zNear, (float)z / GRID_Z);
+        }
+
+        froxels.resize(CLUSTER_COUNT);
+        for (int z = 0; z < GRID_Z; z++)
+        {
+            for (int y = 0; y < GRID_Y; y++)
+            {
+                for (int x = 0; x < GRID_X; x++)
+                {
+                    float ndcX0 = -1.0f + 2.0f * x / GRID_X;
+                    float ndcX1 = -1.0f + 2.0f * (x + 1) / GRID_X;
+                    float ndcY0 = -1.0f + 2.0f * y / GRID_Y;
+                    float ndcY1 = -1.0f + 2.0f * (y + 1) / GRID_Y;
+
+                    Froxel froxel;
+                    froxel.min = glm::vec3(FLT_MAX);
+                    froxel.max = glm::vec3(-FLT_MAX);
+
+                    for (float depth : { sliceDepths[z], sliceDepths[z + 1] })
+                    {
+                        for (float ndcX : { ndcX0, ndcX1 })
+                        {
+                            for (float ndcY : { ndcY0, ndcY1 })
+                            {
+                                glm::vec3 corner(
+                                  ndcX * depth / projectionScaleX,
+                                  ndcY * depth / projectionScaleY,
+                                  -depth);
+                                froxel.min = glm::min(froxel.min, corner);
+                                froxel.max = glm::max(froxel.max, corner);
+                            }
+                        }
+                    }
+
+                    froxels[clusterIndex(x, y, z)] = froxel;
+                }
+            }
+        }
+    }
+
+    int depthToSlice(float depth) const
+    {
+        if (depth <= zNear)
+            return 0;
+
+        int slice = (int)(std::log(depth) * sliceScale - sliceBias);
+        return std::clamp(slice, 0, GRID_Z - 1);
+    }
+
+    int ndcToTile(float ndc, int tiles) const
+    {
+        int tile = (int)std::floor((ndc + 1.0f) * 0.5f * tiles);
+        return std::clamp(tile, 0, tiles - 1);
+    }
+
+    void assignLight(int lightId, bool spot, glm::vec3 center, float radius)
+    {
+        float depth = -center.z;
+        if (depth + radius < zNear || depth - radius > zFar)
+            return;
+
+        lastFrameStats.lights++;
+
+        float minDepth = std::max(depth - radius, zNear);
+        float maxDepth = std::min(depth + radius, zFar);
+
+        int z0 = depthToSlice(minDepth);
+        int z1 = depthToSlice(maxDepth);
+
+        // conservative screen tile range of the sphere's view space bounds
+        float ndcMinX = FLT_MAX, ndcMaxX = -FLT_MAX;
+        float ndcMinY = FLT_MAX, ndcMaxY = -FLT_MAX;
+        for (float d : { minDepth, maxDepth })
+        {
+            for (float x : { center.x - radius, center.x + radius })
+            {
+                float ndc = x * projectionScaleX / d;
+                ndcMinX = std::min(ndcMinX, ndc);
+                ndcMaxX = std::max(ndcMaxX, ndc);
+            }
+            for (float y : { center.y - radius, center.y + radius })
+            {
+                float ndc = y * projectionScaleY / d;
+                ndcMinY = std::min(ndcMinY, ndc);
+                ndcMaxY = std::max(ndcMaxY, ndc);
+            }
+        }
+
+        if (ndcMinX > 1.0f || ndcMaxX < -1.0f || ndcMinY > 1.0f ||
+            ndcMaxY < -1.0f)
+        {
+            return;
+        }
+
+        int x0 = ndcToTile(ndcMinX, GRID_X), x1 = ndcToTile(ndcMaxX, GRID_X);
+        int y0 = ndcToTile(ndcMinY, GRID_Y), y1 = ndcToTile(ndcMaxY, GRID_Y);
+
+        float radiusSquared = radius * radius;
+
+        for (int z = z0; z <= z1; z++)
+        {
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    int cluster = clusterIndex(x, y, z);
+                    const Froxel& froxel = froxels[cluster];
+
+                    glm::vec3 closest =
+                      glm::max(froxel.min, glm::min(center, froxel.max));
+                    glm::vec3 delta = closest - center;
+
+                    if (glm::dot(delta, delta) <= radiusSquared)
+                    {
+                        assignments.push_back(
+                          { (uint32_t)cluster, (uint16_t)lightId, spot });
+                    }
+                }
+            }
+        }
+    }
+
+    // counting sort of the assignments by cluster into the final lists
+    void buildLightLists()
+    {
+        std::fill(clusterCounts.begin(), clusterCounts.end(), 0);
+        std::fill(clusterData.begin(), clusterData.end(), 0);
+
+        size_t indexCount =
+          std::min(assignments.size(), (size_t)MAX_LIGHT_INDICES);
+        lightIndices.resize(indexCount);
+
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            const Assignment& assignment = assignments[i];
+            clusterCounts[assignment.cluster]++;
+            clusterData[assignment.cluster * 2 + 1] +=
+              assignment.spot ? (1u << 16) : 1u;
+        }
+
+        uint32_t offset = 0;
+        for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+        {
+            clusterData[cluster * 2] = offset;
+            offset += clusterCounts[cluster];
+
+            lastFrameStats.maxLightsPerCluster =
+              std::max(lastFrameStats.maxLightsPerCluster,
+                       clusterCounts[cluster]);
+            clusterCounts[cluster] = clusterData[cluster * 2];
+        }
+
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            const Assignment& assignment = assignments[i];
+            lightIndices[clusterCounts[assignment.cluster]++] =
+              assignment.lightId;
+        }
+
+        lastFrameStats.indices = (unsigned int)indexCount;
+    }
+};
+
+#endif
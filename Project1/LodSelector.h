@@ -0,0 +1,85 @@
+#ifndef LOD_SELECTOR_H
+#define LOD_SELECTOR_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include "Mesh.h"
+
+// triangles drawn against the triangles of the full detail meshes
+struct LodStats
+{
+    unsigned int triangles = 0;
+    unsigned int fullTriangles = 0;
+};
+
+// Picks the coarsest level of detail of a mesh whose error, projected at the
+// distance of the mesh from a viewpoint, stays under a number of pixels.
+// Built per frame and view: the camera for the main pass, the light with the
+// shadow map's resolution for the shadow pass (a 90 degree face per
+// direction), so that shadow LODs only change when the light or the casters
+// move and cached shadow faces stay valid.
+class LodSelector
+{
+  public:
+    // largest error allowed, in pixels
+    static constexpr float DEFAULT_THRESHOLD = 1.0f;
+
+    // fieldOfView is vertical, in degrees (Camera::Zoom)
+    LodSelector(const glm::vec3& viewPosition,
+                float fieldOfView,
+                float viewportHeight,
+                float threshold = DEFAULT_THRESHOLD)
+      : viewPosition(viewPosition)
+      , threshold(threshold)
+    {
+        // pixels covered by one unit at a distance of one unit
+        pixelsPerUnit =
+          viewportHeight / (2.0f * std::tan(glm::radians(fieldOfView) * 0.5f));
+    }
+
+    unsigned int select(const Mesh& mesh, const glm::mat4& model) const
+    {
+        if (mesh.lods.size() <= 1 || mesh.boundingSphere.radius <= 0.0f)
+            return 0;
+
+        BoundingSphere sphere = mesh.boundingSphere.transformed(model);
+        return select(
+          mesh, sphere, sphere.radius / mesh.boundingSphere.radius);
+    }
+
+    // same for copies of a mesh scaled by up to scale anywhere within
+    // bounds (e.g. a cell of instances), the level of the nearest one
+    unsigned int select(const Mesh& mesh,
+                        const BoundingSphere& bounds,
+                        float scale) const
+    {
+        if (mesh.lods.size() <= 1)
+            return 0;
+
+        float distance =
+          glm::distance(bounds.center, viewPosition) - bounds.radius;
+        if (distance <= 0.0f)
+            return 0;
+
+        // object space error to pixels
+        scale *= pixelsPerUnit / distance;
+
+        unsigned int lod = 0;
+        while (lod + 1 < mesh.lods.size() &&
+               mesh.lods[lod + 1].error * scale <= threshold)
+        {
+            lod++;
+        }
+        return lod;
+    }
+
+  private:
+    glm::vec3 viewPosition;
+    float threshold;
+    float pixelsPerUnit;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "GLState.h"
+#include "Shader.h"
+
+// first texture unit used by material samplers, unit 0 is the omni shadow map
+#define MATERIAL_FIRST_TEXTURE_UNIT 1
+// samplers per texture type (material.texture_diffuse1, ...2)
+#define MATERIAL_TEXTURES_PER_TYPE 2
+
+struct Texture
+{
+    unsigned int id;
+    string type;
+    string path;
+};
+
+// texture named by a mesh before it is loaded, path relative to the model
+struct TextureRef
+{
+    string type;
+    string path;
+};
+
+// Textures of a mesh and the texture units they are bound to.
+//
+// Every material sampler of the shaders (material.texture_<type><n>) has a
+// fixed unit, so the sampler uniforms only have to be pointed at their
+// units once per shader with attach(), and binding a material when drawing
+// only binds its textures, without any uniform writes or string building.
+class Material
+{
+  public:
+    static const int TYPE_COUNT = 4;
+
+    Material() = default;
+
+    explicit Material(const vector<Texture>& textures)
+      : textures(textures)
+    {
+        unsigned int typeCounts[TYPE_COUNT] = {};
+
+        for (const Texture& texture : textures)
+        {
+            int type = getTypeIndex(texture.type);
+            if (type < 0 || typeCounts[type] >= MATERIAL_TEXTURES_PER_TYPE)
+            {
+                cout << "ERROR::MATERIAL::UNSUPPORTED_TEXTURE " << texture.type
+                     << " " << texture.path << endl;
+                continue;
+            }
+
+            bindings.push_back(
+              { getTextureUnit(type, typeCounts[type]++), texture.id });
+        }
+
+        // 16 bit hash of the texture names, the render queue sort key
+        uint32_t hash = 2166136261u;
+        for (const Binding& binding : bindings)
+        {
+            hash = (hash ^ binding.unit) * 16777619u;
+            hash = (hash ^ binding.texture) * 16777619u;
+        }
+        sortKey = (uint16_t)(hash ^ (hash >> 16));
+    }
+
+    // points the material samplers of a shader used to draw meshes at their
+    // units, once after compiling it
+    static void attach(const Shader& shader)
+    {
+        shader.use();
+
+        for (int type = 0; type < TYPE_COUNT; type++)
+        {
+            for (unsigned int i = 0; i < MATERIAL_TEXTURES_PER_TYPE; i++)
+            {
+                shader.setInt("material." + string(TYPE_NAMES[type]) +
+                                to_string(i + 1),
+                              getTextureUnit(type, i));
+            }
+        }
+    }
+
+    void bind() const
+    {
+        for (const Binding& binding : bindings)
+        {
+            GLState::bindTexture(binding.unit, GL_TEXTURE_2D, binding.texture);
+        }
+    }
+
+    const vector<Texture>& getTextures() const { return textures; }
+    uint16_t getSortKey() const { return sortKey; }
+
+    // binds the same textures to the same units, draws of both materials
+    // can share one bind
+    bool bindsSameTextures(const Material& other) const
+    {
+        if (bindings.size() != other.bindings.size())
+            return false;
+
+        for (size_t i = 0; i < bindings.size(); i++)
+        {
+            if (bindings[i].unit != other.bindings[i].unit ||
+                bindings[i].texture != other.bindings[i].texture)
+                return false;
+        }
+        return true;
+    }
+
+  private:
+    struct Binding
+    {
+        unsigned int unit;
+        unsigned int texture;
+    };
+
+    static constexpr const char* TYPE_NAMES[TYPE_COUNT] = {
+        "texture_diffuse",
+        "texture_specular",
+        "texture_normal",
+        "texture_parallax"
+    };
+
+    vector<Texture> textures;
+    vector<Binding> bindings;
+    uint16_t sortKey = 0;
+
+    static int getTypeIndex(const string& type)
+    {
+        for (int i = 0; i < TYPE_COUNT; i++)
+        {
+            if (type == TYPE_NAMES[i])
+                return i;
+        }
+
+        return -1;
+    }
+
+    static unsigned int getTextureUnit(int type, unsigned int index)
+    {
+        return MATERIAL_FIRST_TEXTURE_UNIT + index * TYPE_COUNT + type;
+    }
+};
+
+#endif
@@ -1,5 +1,15 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <glm/gtc/packing.hpp>
+
+#include <cmath>
+#include <cstdint>
 #include <string>
 
+#include "BoundingBox.h"
+#include "GeometryBuffer.h"
+#include "Material.h"
 #include "Shader.h"
 
 struct Vertex
@@ -11,83 +21,518 @@ struct Vertex
     glm::vec2 TexCoords;
 };
 
-struct Texture
+// layout of the vertices uploaded to the GPU
+enum class VertexFormat
+{
+    // Vertex as is, 56 bytes
+    Float,
+    // PackedVertex, 20 bytes
+    Packed
+};
+
+// Quantized vertex. Positions are 16 bit unorm within the mesh bounds (see
+// Mesh::vertexTransform), normal and tangent are octahedral encoded 16 bit
+// snorm, the bitangent is rebuilt from them and the sign stored in the w of
+// the position (0 or 1), texture coordinates are half floats.
+struct PackedVertex
 {
-    unsigned int id;
-    string type;
-    string path;
+    uint16_t Position[4];
+    int16_t Normal[2];
+    int16_t Tangent[2];
+    uint16_t TexCoords[2];
+};
+
+namespace VertexPacking
+{
+inline uint16_t
+packUnorm(float value)
+{
+    return (uint16_t)std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+inline int16_t
+packSnorm(float value)
+{
+    return (int16_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+// unit vector to the octahedron folded onto the [-1, 1] square
+inline void
+packOctahedral(const glm::vec3& direction, int16_t packed[2])
+{
+    float length =
+      std::fabs(direction.x) + std::fabs(direction.y) + std::fabs(direction.z);
+    if (length == 0.0f)
+    {
+        packed[0] = packed[1] = 0;
+        return;
+    }
+
+    float x = direction.x / length;
+    float y = direction.y / length;
+    if (direction.z < 0.0f)
+    {
+        float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+
+    packed[0] = packSnorm(x);
+    packed[1] = packSnorm(y);
+}
+
+// origin and uniform scale mapping [0, 1] positions back to the bounds. The
+// scale is the same on every axis so that normals transformed by the model
+// matrix only need the renormalization the shaders already do.
+inline glm::mat4
+getDequantization(const BoundingBox& bounds)
+{
+    if (bounds.isEmpty())
+        return glm::mat4(1.0f);
+
+    glm::vec3 extent = bounds.max - bounds.min;
+    float scale = std::max({ extent.x, extent.y, extent.z });
+    if (scale == 0.0f)
+        scale = 1.0f;
+
+    glm::mat4 transform(scale);
+    transform[3] = glm::vec4(bounds.min, 1.0f);
+    return transform;
+}
+
+inline PackedVertex
+packVertex(const Vertex& vertex, const glm::vec3& origin, float inverseScale)
+{
+    PackedVertex packed;
+
+    glm::vec3 position = (vertex.Position - origin) * inverseScale;
+    packed.Position[0] = packUnorm(position.x);
+    packed.Position[1] = packUnorm(position.y);
+    packed.Position[2] = packUnorm(position.z);
+
+    float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent),
+                                vertex.Bitangent);
+    packed.Position[3] = handedness < 0.0f ? 0 : 65535;
+
+    packOctahedral(vertex.Normal, packed.Normal);
+    packOctahedral(vertex.Tangent, packed.Tangent);
+
+    packed.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+    packed.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+    return packed;
+}
+
+} // namespace VertexPacking
+
+// one draw of glMultiDrawElementsIndirect, layout fixed by GL
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// range of a mesh's index buffer drawing it at a level of detail
+struct MeshLod
+{
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // object space distance to the full detail surface
+    float error;
+};
+
+// Cluster of up to MeshletBuilder::MAX_TRIANGLES neighbouring triangles of
+// the full detail level, culled on its own. Object space.
+struct Meshlet
+{
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    glm::vec3 center;
+    float radius;
+    // every triangle faces away from the viewpoints p where
+    // dot(center - p, coneAxis) >= coneCutoff * |center - p| + radius,
+    // a cutoff of 1 when the triangles face too many ways to be culled
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// index ranges of a mesh drawn by one glMultiDrawElements
+struct DrawRanges
+{
+    vector<GLsizei> counts;
+    vector<const void*> offsets;
+
+    void clear()
+    {
+        counts.clear();
+        offsets.clear();
+    }
+
+    bool empty() const { return counts.empty(); }
+
+    // a range starting where the last one ends extends it
+    void add(unsigned int firstIndex, unsigned int indexCount, size_t indexSize)
+    {
+        uintptr_t offset = firstIndex * indexSize;
+        if (!counts.empty() &&
+            (uintptr_t)offsets.back() + counts.back() * indexSize == offset)
+        {
+            counts.back() += indexCount;
+            return;
+        }
+
+        counts.push_back(indexCount);
+        offsets.push_back((const void*)offset);
+    }
+};
+
+// mesh as produced by an importer, nothing uploaded yet
+struct MeshData
+{
+    vector<Vertex> vertices;
+    // every level of detail one after the other
+    vector<unsigned int> indices;
+    vector<TextureRef> textures;
+    // empty when the indices are a single level
+    vector<MeshLod> lods;
+    // partition of the full detail level, empty when not built
+    vector<Meshlet> meshlets;
+
+    // set instead of vertices and indices when they are read in place from
+    // a mapped file, which must outlive the upload
+    const Vertex* mappedVertices = nullptr;
+    const unsigned int* mappedIndices = nullptr;
+    size_t mappedVertexCount = 0;
+    size_t mappedIndexCount = 0;
+
+    const Vertex* getVertices() const
+    {
+        return mappedVertices ? mappedVertices : vertices.data();
+    }
+
+    size_t getVertexCount() const
+    {
+        return mappedVertices ? mappedVertexCount : vertices.size();
+    }
+
+    const unsigned int* getIndices() const
+    {
+        return mappedIndices ? mappedIndices : indices.data();
+    }
+
+    size_t getIndexCount() const
+    {
+        return mappedIndices ? mappedIndexCount : indices.size();
+    }
 };
 
 class Mesh
 {
   public:
-    unsigned int VAO, VBO, EBO;
+    // vertex array of the format's GeometryBuffer, shared by every mesh of
+    // the format
+    unsigned int VAO;
+    // allocation of the vertices and indices in that buffer, freed by
+    // releaseGeometry()
+    unsigned int geometry;
 
+    // full precision copy, whatever the uploaded format. Empty when built
+    // from pointers.
     vector<Vertex> vertices;
     vector<unsigned int> indices;
-    vector<Texture> textures;
+    Material material;
+
+    // levels of detail in the index buffer, lods[0] is the full mesh and
+    // the errors increase
+    vector<MeshLod> lods;
+    // partition of lods[0] into clusters culled by MeshletCuller, may be
+    // empty
+    vector<Meshlet> meshlets;
+
+    // object space bounds of the vertices
+    BoundingBox bounds;
+    BoundingSphere boundingSphere;
+
+    VertexFormat format;
+    // GL_UNSIGNED_SHORT whenever the vertices can be addressed with 16 bits,
+    // GL_UNSIGNED_INT otherwise
+    GLenum indexType;
+    // maps the uploaded positions to object space, identity unless packed.
+    // Folded into the model matrix by Draw(shader, modelUniform, model).
+    glm::mat4 vertexTransform = glm::mat4(1.0f);
 
     Mesh(vector<Vertex> vertices,
          vector<unsigned int> indices,
-         vector<Texture> textures)
+         Material material,
+         VertexFormat format = VertexFormat::Float,
+         vector<MeshLod> lods = {},
+         vector<Meshlet> meshlets = {})
     {
         this->vertices = vertices;
         this->indices = indices;
-        this->textures = textures;
-
-        setupMesh();
-    }
-    void Draw(Shader& shader)
-    {
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int parallaxNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++) {
-            glActiveTexture(GL_TEXTURE1 + i);
-
-            string number;
-            string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++);
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++);
-            else if (name == "texture_parallax")
-                number = std::to_string(parallaxNr++);
-
-            shader.setInt(("material." + name + number).c_str(), i + 1);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        this->material = material;
+        this->format = format;
+        this->lods = lods;
+        this->meshlets = meshlets;
+
+        setupMesh(this->vertices.data(),
+                  this->vertices.size(),
+                  this->indices.data(),
+                  this->indices.size());
+    }
+
+    // builds the mesh from already interleaved data (e.g. a mapped mesh
+    // cache), uploading straight from the given pointers without keeping a
+    // copy
+    Mesh(const Vertex* vertexData,
+         size_t vertexCount,
+         const unsigned int* indexData,
+         size_t indexCount,
+         Material material,
+         VertexFormat format = VertexFormat::Float,
+         vector<MeshLod> lods = {},
+         vector<Meshlet> meshlets = {})
+    {
+        this->material = material;
+        this->format = format;
+        this->lods = lods;
+        this->meshlets = meshlets;
+
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
+    }
+
+    // buffer the meshes of a vertex format are uploaded to
+    static GeometryBuffer& getGeometryBuffer(VertexFormat format)
+    {
+        static GeometryBuffer floatBuffer(sizeof(Vertex),
+                                          setupVertexAttributes);
+        static GeometryBuffer packedBuffer(sizeof(PackedVertex),
+                                           setupPackedVertexAttributes);
+
+        return format == VertexFormat::Packed ? packedBuffer : floatBuffer;
+    }
+
+    // gives the mesh's range of the geometry buffer back, the mesh cannot be
+    // drawn anymore. Meshes are copied around by value, only their owner
+    // (the Model) calls this.
+    void releaseGeometry() { getGeometryBuffer(format).free(geometry); }
+
+    static size_t getVertexSize(VertexFormat format)
+    {
+        return format == VertexFormat::Packed ? sizeof(PackedVertex)
+                                              : sizeof(Vertex);
+    }
+
+    static GLenum getIndexType(size_t vertexCount)
+    {
+        return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    static size_t getIndexSize(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t)
+                                              : sizeof(unsigned int);
+    }
+
+    // the shader is already in use, the material binds its textures to
+    // fixed units
+    void Draw(Shader&, unsigned int lod = 0)
+    {
+        material.bind();
+
+        const MeshLod& range =
+          lods[std::min(lod, (unsigned int)lods.size() - 1)];
+        const GeometryBuffer& buffer = getGeometryBuffer(format);
+
+        GLState::bindVertexArray(VAO);
+        glDrawElementsBaseVertex(
+          GL_TRIANGLES,
+          range.indexCount,
+          indexType,
+          (void*)(buffer.getIndexOffset(geometry) +
+                  range.firstIndex * getIndexSize(indexType)),
+          buffer.getBaseVertex(geometry));
+    }
+
+    // draws with the object's model matrix, set along with the mesh's
+    // vertexTransform
+    void Draw(Shader& shader,
+              Uniform<glm::mat4> modelUniform,
+              const glm::mat4& model,
+              unsigned int lod = 0)
+    {
+        shader.set(modelUniform, model * vertexTransform);
+        Draw(shader, lod);
+    }
+
+    // draws instanceCount instances with the instance attributes of
+    // vertexArray, an instanced vertex array of the mesh's geometry buffer.
+    // The instance matrices do not include the vertexTransform, it is set
+    // for all of them.
+    void DrawInstanced(Shader& shader,
+                       Uniform<glm::mat4> vertexTransformUniform,
+                       unsigned int vertexArray,
+                       GLsizei instanceCount,
+                       unsigned int lod = 0)
+    {
+        shader.set(vertexTransformUniform, vertexTransform);
+        material.bind();
+
+        const MeshLod& range =
+          lods[std::min(lod, (unsigned int)lods.size() - 1)];
+        const GeometryBuffer& buffer = getGeometryBuffer(format);
+
+        GLState::bindVertexArray(vertexArray);
+        glDrawElementsInstancedBaseVertex(
+          GL_TRIANGLES,
+          range.indexCount,
+          indexType,
+          (void*)(buffer.getIndexOffset(geometry) +
+                  range.firstIndex * getIndexSize(indexType)),
+          instanceCount,
+          buffer.getBaseVertex(geometry));
+    }
+
+    // draws the given ranges only, e.g. the visible meshlets
+    void Draw(Shader&, const DrawRanges& ranges)
+    {
+        if (ranges.empty())
+            return;
+
+        material.bind();
+
+        // ranges are relative to the mesh, moved to its allocation
+        static vector<const void*> offsets;
+        static vector<GLint> baseVertices;
+
+        const GeometryBuffer& buffer = getGeometryBuffer(format);
+        uintptr_t indexOffset = buffer.getIndexOffset(geometry);
+
+        offsets.resize(ranges.offsets.size());
+        for (size_t i = 0; i < offsets.size(); i++)
+        {
+            offsets[i] =
+              (const void*)((uintptr_t)ranges.offsets[i] + indexOffset);
+        }
+        baseVertices.assign(ranges.counts.size(),
+                            buffer.getBaseVertex(geometry));
+
+        GLState::bindVertexArray(VAO);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES,
+                                      ranges.counts.data(),
+                                      indexType,
+                                      offsets.data(),
+                                      (GLsizei)ranges.counts.size(),
+                                      baseVertices.data());
+    }
+
+    void Draw(Shader& shader,
+              Uniform<glm::mat4> modelUniform,
+              const glm::mat4& model,
+              const DrawRanges& ranges)
+    {
+        shader.set(modelUniform, model * vertexTransform);
+        Draw(shader, ranges);
+    }
+
+    // the indirect draws equivalent to Draw(shader, lod), or to the ranges
+    // if not null, with drawIndex as their baseInstance
+    void appendIndirectCommands(
+      unsigned int lod,
+      const DrawRanges* ranges,
+      GLuint drawIndex,
+      vector<DrawElementsIndirectCommand>& commands) const
+    {
+        const GeometryBuffer& buffer = getGeometryBuffer(format);
+        size_t indexSize = getIndexSize(indexType);
+        GLuint firstIndex =
+          (GLuint)(buffer.getIndexOffset(geometry) / indexSize);
+        GLint baseVertex = buffer.getBaseVertex(geometry);
+
+        if (!ranges)
+        {
+            const MeshLod& range =
+              lods[std::min(lod, (unsigned int)lods.size() - 1)];
+            commands.push_back({ range.indexCount,
+                                 1,
+                                 firstIndex + range.firstIndex,
+                                 baseVertex,
+                                 drawIndex });
+            return;
         }
-        glActiveTexture(GL_TEXTURE0);
 
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        for (size_t i = 0; i < ranges->counts.size(); i++)
+        {
+            commands.push_back(
+              { (GLuint)ranges->counts[i],
+                1,
+                firstIndex +
+                  (GLuint)((uintptr_t)ranges->offsets[i] / indexSize),
+                baseVertex,
+                drawIndex });
+        }
     }
 
   private:
-    void setupMesh()
+    void setupMesh(const Vertex* vertexData,
+                   size_t vertexCount,
+                   const unsigned int* indexData,
+                   size_t indexCount)
     {
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        if (lods.empty())
+            lods.push_back({ 0, (unsigned int)indexCount, 0.0f });
 
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            bounds.extend(vertexData[i].Position);
+        }
 
-        glBufferData(GL_ARRAY_BUFFER,
-                     vertices.size() * sizeof(Vertex),
-                     &vertices[0],
-                     GL_STATIC_DRAW);
+        // centered on the box, tighter than the box's half diagonal
+        if (!bounds.isEmpty())
+        {
+            boundingSphere.center = bounds.getCenter();
+            boundingSphere.radius = 0.0f;
+            for (size_t i = 0; i < vertexCount; i++)
+            {
+                boundingSphere.radius =
+                  std::max(boundingSphere.radius,
+                           glm::distance(boundingSphere.center,
+                                         vertexData[i].Position));
+            }
+        }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                     indices.size() * sizeof(unsigned int),
-                     &indices[0],
-                     GL_STATIC_DRAW);
+        GeometryBuffer& buffer = getGeometryBuffer(format);
+        VAO = buffer.getVertexArray();
 
+        vector<PackedVertex> packed;
+        const void* uploadedVertices = vertexData;
+        if (format == VertexFormat::Packed)
+        {
+            packed = packVertices(vertexData, vertexCount);
+            uploadedVertices = packed.data();
+        }
+
+        indexType = getIndexType(vertexCount);
+        vector<uint16_t> narrowed;
+        const void* uploadedIndices = indexData;
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            narrowed.assign(indexData, indexData + indexCount);
+            uploadedIndices = narrowed.data();
+        }
+
+        geometry = buffer.allocate(uploadedVertices,
+                                   vertexCount,
+                                   uploadedIndices,
+                                   indexCount,
+                                   getIndexSize(indexType));
+    }
+
+    static void setupVertexAttributes()
+    {
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0,
                               3,
@@ -127,7 +572,61 @@ class Mesh
                               GL_FALSE,
                               sizeof(Vertex),
                               (void*)offsetof(Vertex, TexCoords));
+    }
+
+    vector<PackedVertex> packVertices(const Vertex* vertexData,
+                                      size_t vertexCount)
+    {
+        vertexTransform = VertexPacking::getDequantization(bounds);
+        glm::vec3 origin = glm::vec3(vertexTransform[3]);
+        float inverseScale = 1.0f / vertexTransform[0][0];
+
+        vector<PackedVertex> packed(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            packed[i] =
+              VertexPacking::packVertex(vertexData[i], origin, inverseScale);
+        }
+        return packed;
+    }
+
+    // attributes are decoded by the fetch (unorm, snorm, half float), the
+    // shaders only unfold the octahedral vectors. Location 3 (bitangent) is
+    // left disabled.
+    static void setupPackedVertexAttributes()
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0,
+                              4,
+                              GL_UNSIGNED_SHORT,
+                              GL_TRUE,
+                              sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, Position));
 
-        glBindVertexArray(0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1,
+                              2,
+                              GL_SHORT,
+                              GL_TRUE,
+                              sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, Normal));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2,
+                              2,
+                              GL_SHORT,
+                              GL_TRUE,
+                              sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, Tangent));
+
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4,
+                              2,
+                              GL_HALF_FLOAT,
+                              GL_FALSE,
+                              sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, TexCoords));
     }
-};
\ No newline at end of file
+};
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Mesh.h"
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path)
+    {
+        close();
+
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(),
+                           GENERIC_READ,
+                           FILE_SHARE_READ,
+                           NULL,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            close();
+            return false;
+        }
+        size = (size_t)fileSize.QuadPart;
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            close();
+            return false;
+        }
+
+        data = (const unsigned char*)MapViewOfFile(mapping,
+                                                   FILE_MAP_READ,
+                                                   0,
+                                                   0,
+                                                   0);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close();
+            return false;
+        }
+        size = (size_t)st.st_size;
+
+        void* ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = ptr == MAP_FAILED ? nullptr : (const unsigned char*)ptr;
+#endif
+
+        if (!data)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap((void*)data, size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const unsigned char* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+  private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+// A mesh as stored in the cache, vertex and index pointers point into the
+// mapped file and are only valid while the MeshCache is alive
+struct CachedMesh
+{
+    const Vertex* vertices;
+    uint32_t vertexCount;
+    const unsigned int* indices;
+    uint32_t indexCount;
+    vector<TextureRef> textures;
+    vector<MeshLod> lods;
+    vector<Meshlet> meshlets;
+};
+
+// Binary cache of the final interleaved mesh data of a model, stored next to
+// the source file and keyed by source path, modification time and the import
+// settings used to produce it (assimp flags, mesh size limit).
+//
+// layout (little endian, every array aligned to DATA_ALIGNMENT):
+//   header   magic, version, vertex size, import flags, max mesh vertices,
+//            source mtime, source path, mesh count
+//   per mesh vertex count, index count, lod count, meshlet count, texture
+//            refs (type, path), MeshLod[lod count], Meshlet[meshlet count],
+//            Vertex[vertex count], unsigned int[index count]
+class MeshCache
+{
+  public:
+    static constexpr uint32_t MAGIC = 0x434D4C4F; // "OLMC"
+    static constexpr uint32_t VERSION = 5;
+    static constexpr size_t DATA_ALIGNMENT = 16;
+
+    static string getCachePath(const string& sourcePath)
+    {
+        return sourcePath + ".meshcache";
+    }
+
+    // maps the cache of sourcePath, returns false if it is missing, stale or
+    // was produced with different import settings
+    bool open(const string& sourcePath,
+              unsigned int importFlags,
+              unsigned int maxMeshVertices)
+    {
+        meshes.clear();
+
+        int64_t sourceTime;
+        if (!getSourceTime(sourcePath, sourceTime))
+            return false;
+
+        if (!file.open(getCachePath(sourcePath)))
+            return false;
+
+        offset = 0;
+
+        uint32_t magic, version, vertexSize, flags, maxVertices, meshCount;
+        int64_t cachedTime;
+        string cachedPath;
+
+        if (!read(magic) || magic != MAGIC || !read(version) ||
+            version != VERSION || !read(vertexSize) ||
+            vertexSize != sizeof(Vertex) || !read(flags) ||
+            flags != importFlags || !read(maxVertices) ||
+            maxVertices != maxMeshVertices || !read(cachedTime) ||
+            cachedTime != sourceTime || !readString(cachedPath) ||
+            cachedPath != sourcePath || !read(meshCount))
+        {
+            file.close();
+            return false;
+        }
+
+        for (uint32_t i = 0; i < meshCount; i++)
+        {
+            CachedMesh mesh;
+            uint32_t lodCount, meshletCount, textureCount;
+
+            if (!read(mesh.vertexCount) || !read(mesh.indexCount) ||
+                !read(lodCount) || !read(meshletCount) || !read(textureCount))
+            {
+                return fail(sourcePath);
+            }
+
+            for (uint32_t j = 0; j < textureCount; j++)
+            {
+                TextureRef texture;
+                if (!readString(texture.type) || !readString(texture.path))
+                    return fail(sourcePath);
+                mesh.textures.push_back(texture);
+            }
+
+            const MeshLod* lods =
+              (const MeshLod*)readArray(lodCount * sizeof(MeshLod));
+            if (!lods)
+                return fail(sourcePath);
+            mesh.lods.assign(lods, lods + lodCount);
+
+            const Meshlet* meshlets =
+              (const Meshlet*)readArray(meshletCount * sizeof(Meshlet));
+            if (!meshlets)
+                return fail(sourcePath);
+            mesh.meshlets.assign(meshlets, meshlets + meshletCount);
+
+            mesh.vertices =
+              (const Vertex*)readArray(mesh.vertexCount * sizeof(Vertex));
+            mesh.indices = (const unsigned int*)readArray(
+              mesh.indexCount * sizeof(unsigned int));
+
+            if (!mesh.vertices || !mesh.indices)
+                return fail(sourcePath);
+
+            meshes.push_back(mesh);
+        }
+
+        return true;
+    }
+
+    const vector<CachedMesh>& getMeshes() const { return meshes; }
+
+    static void write(const string& sourcePath,
+                      unsigned int importFlags,
+                      unsigned int maxMeshVertices,
+                      const vector<MeshData>& meshes)
+    {
+        int64_t sourceTime;
+        if (!getSourceTime(sourcePath, sourceTime))
+            return;
+
+        // written next to the cache and renamed over it once complete, so
+        // that a reader never maps a partial file. Per thread, two imports of
+        // the same model may write at once.
+        const string cachePath = getCachePath(sourcePath);
+        const string writePath =
+          cachePath + ".tmp" +
+          std::to_string(std::hash<std::thread::id>()(
+            std::this_thread::get_id()));
+
+        std::ofstream out(writePath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            cout << "ERROR::MESH_CACHE::COULD_NOT_WRITE " << writePath
+                 << endl;
+            return;
+        }
+
+        writeValue(out, MAGIC);
+        writeValue(out, VERSION);
+        writeValue(out, (uint32_t)sizeof(Vertex));
+        writeValue(out, (uint32_t)importFlags);
+        writeValue(out, (uint32_t)maxMeshVertices);
+        writeValue(out, sourceTime);
+        writeString(out, sourcePath);
+        writeValue(out, (uint32_t)meshes.size());
+
+        for (const MeshData& mesh : meshes)
+        {
+            writeValue(out, (uint32_t)mesh.vertices.size());
+            writeValue(out, (uint32_t)mesh.indices.size());
+            writeValue(out, (uint32_t)mesh.lods.size());
+            writeValue(out, (uint32_t)mesh.meshlets.size());
+            writeValue(out, (uint32_t)mesh.textures.size());
+
+            for (const TextureRef& texture : mesh.textures)
+            {
+                writeString(out, texture.type);
+                writeString(out, texture.path);
+            }
+
+            writeArray(out,
+                       mesh.lods.data(),
+                       mesh.lods.size() * sizeof(MeshLod));
+            writeArray(out,
+                       mesh.meshlets.data(),
+                       mesh.meshlets.size() * sizeof(Meshlet));
+            writeArray(out,
+                       mesh.vertices.data(),
+                       mesh.vertices.size() * sizeof(Vertex));
+            writeArray(out,
+                       mesh.indices.data(),
+                       mesh.indices.size() * sizeof(unsigned int));
+        }
+
+        out.close();
+        std::error_code error;
+        if (!out)
+        {
+            cout << "ERROR::MESH_CACHE::COULD_NOT_WRITE " << writePath
+                 << endl;
+            std::filesystem::remove(writePath, error);
+            return;
+        }
+
+        std::filesystem::rename(writePath, cachePath, error);
+        if (error)
+        {
+            cout << "ERROR::MESH_CACHE::COULD_NOT_WRITE " << cachePath << " "
+                 << error.message() << endl;
+            std::filesystem::remove(writePath, error);
+        }
+    }
+
+  private:
+    MappedFile file;
+    size_t offset = 0;
+    vector<CachedMesh> meshes;
+
+    static bool getSourceTime(const string& sourcePath, int64_t& time)
+    {
+        std::error_code error;
+        auto lastWrite = std::filesystem::last_write_time(sourcePath, error);
+        if (error)
+            return false;
+
+        time = (int64_t)lastWrite.time_since_epoch().count();
+        return true;
+    }
+
+    bool fail(const string& sourcePath)
+    {
+        cout << "ERROR::MESH_CACHE::CORRUPTED " << getCachePath(sourcePath)
+             << endl;
+        meshes.clear();
+        file.close();
+        return false;
+    }
+
+    template<typename T>
+    bool read(T& value)
+    {
+        if (offset + sizeof(T) > file.getSize())
+            return false;
+
+        std::memcpy(&value, file.getData() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    bool readString(string& value)
+    {
+        uint32_t length;
+        if (!read(length) || offset + length > file.getSize())
+            return false;
+
+        value.assign((const char*)file.getData() + offset, length);
+        offset += length;
+        return true;
+    }
+
+    const void* readArray(size_t byteSize)
+    {
+        offset = align(offset);
+        if (offset + byteSize > file.getSize())
+            return nullptr;
+
+        const void* data = file.getData() + offset;
+        offset += byteSize;
+        return data;
+    }
+
+    static size_t align(size_t value)
+    {
+        return (value + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+    }
+
+    template<typename T>
+    static void writeValue(std::ofstream& out, const T& value)
+    {
+        out.write((const char*)&value, sizeof(T));
+    }
+
+    static void writeString(std::ofstream& out, const string& value)
+    {
+        writeValue(out, (uint32_t)value.size());
+        out.write(value.data(), value.size());
+    }
+
+    static void writeArray(std::ofstream& out, const void* data, size_t size)
+    {
+        static const char padding[DATA_ALIGNMENT] = {};
+
+        size_t position = (size_t)out.tellp();
+        out.write(padding, align(position) - position);
+        out.write((const char*)data, size);
+    }
+};
+
+#endif
@@ -0,0 +1,472 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+
+// post-transform vertex cache efficiency of an index buffer
+struct VertexCacheStats
+{
+    unsigned int triangles = 0;
+    unsigned int vertices = 0;
+    // vertices shaded (cache misses)
+    unsigned int transformed = 0;
+
+    // average cache miss ratio, shaded vertices per triangle: 3 at worst,
+    // about 0.5 for a regular grid
+    float getACMR() const
+    {
+        return triangles ? (float)transformed / triangles : 0.0f;
+    }
+
+    // average transform to vertex ratio, 1 when every vertex is shaded once
+    float getATVR() const
+    {
+        return vertices ? (float)transformed / vertices : 0.0f;
+    }
+
+    VertexCacheStats& operator+=(const VertexCacheStats& other)
+    {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        transformed += other.transformed;
+        return *this;
+    }
+};
+
+// Reorders the triangles and vertices of imported meshes for the GPU, once
+// at import time (the result is what the MeshCache stores):
+//   1. triangles for the post-transform vertex cache, Forsyth's linear-speed
+//      optimizer on a simulated LRU cache
+//   2. runs of that order (clusters) sorted outside-in so that triangles
+//      facing away from the mesh center are drawn first and occlude the
+//      rest, while keeping most of the cache locality
+//   3. vertices in the order the triangles first use them, for the
+//      pre-transform (fetch) cache, dropping unreferenced ones
+class MeshOptimizer
+{
+  public:
+    // cache simulated by analyze(), a FIFO of typical hardware size
+    static constexpr unsigned int ANALYZE_CACHE_SIZE = 16;
+    // cache the triangle order is optimized for
+    static constexpr unsigned int OPTIMIZE_CACHE_SIZE = 32;
+    // a cluster may end wherever its ACMR is within this factor of the
+    // whole mesh's, higher values give more clusters (less overdraw) at the
+    // cost of cache efficiency
+    static constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+    // runs the three passes, stats is filled with the cache efficiency
+    // before and after
+    static void optimize(MeshData& mesh,
+                         VertexCacheStats& before,
+                         VertexCacheStats& after)
+    {
+        before = analyze(mesh.indices, mesh.vertices.size());
+
+        optimizeVertexCache(mesh.indices, mesh.vertices.size());
+        optimizeOverdraw(mesh.indices, mesh.vertices);
+        optimizeVertexFetch(mesh.indices, mesh.vertices);
+
+        after = analyze(mesh.indices, mesh.vertices.size());
+    }
+
+    static VertexCacheStats analyze(const vector<unsigned int>& indices,
+                                    size_t vertexCount)
+    {
+        VertexCacheStats stats;
+        stats.triangles = (unsigned int)(indices.size() / 3);
+        stats.vertices = (unsigned int)vertexCount;
+
+        Fifo cache(vertexCount);
+        for (size_t t = 0; t < stats.triangles; t++)
+        {
+            stats.transformed += cache.access(&indices[t * 3]);
+        }
+
+        return stats;
+    }
+
+    static void optimizeVertexCache(vector<unsigned int>& indices,
+                                    size_t vertexCount)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // triangles of each vertex, the first remaining[v] entries are the
+        // ones not emitted yet
+        vector<unsigned int> offsets(vertexCount + 1, 0);
+        for (unsigned int index : indices)
+        {
+            offsets[index + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+
+        vector<unsigned int> remaining(vertexCount, 0);
+        vector<unsigned int> adjacency(indices.size());
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            unsigned int index = indices[i];
+            adjacency[offsets[index] + remaining[index]++] =
+              (unsigned int)(i / 3);
+        }
+
+        vector<float> vertexScores(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            vertexScores[v] = getVertexScore(-1, remaining[v]);
+        }
+
+        vector<bool> emitted(triangleCount, false);
+        vector<unsigned int> output;
+        output.reserve(indices.size());
+
+        // LRU, most recent first, with room for the 3 vertices pushed in
+        // before the oldest are evicted
+        vector<unsigned int> cache, nextCache;
+        cache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+        nextCache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+
+        size_t scanCursor = 0;
+        int best = -1;
+
+        for (size_t emittedCount = 0; emittedCount < triangleCount;
+             emittedCount++)
+        {
+            // no candidate around the cache, restart from the first
+            // triangle left
+            if (best < 0)
+            {
+                while (emitted[scanCursor])
+                {
+                    scanCursor++;
+                }
+                best = (int)scanCursor;
+            }
+
+            emitted[best] = true;
+            const unsigned int* triangle = &indices[best * 3];
+
+            nextCache.assign(triangle, triangle + 3);
+            for (unsigned int vertex : cache)
+            {
+                if (vertex != triangle[0] && vertex != triangle[1] &&
+                    vertex != triangle[2])
+                    nextCache.push_back(vertex);
+            }
+
+            for (int i = 0; i < 3; i++)
+            {
+                unsigned int vertex = triangle[i];
+                output.push_back(vertex);
+
+                unsigned int* first = &adjacency[offsets[vertex]];
+                unsigned int* last = first + remaining[vertex];
+                *std::find(first, last, (unsigned int)best) = *(last - 1);
+                remaining[vertex]--;
+            }
+
+            // evicted vertices leave the cache, the others get their new
+            // position and score
+            for (size_t i = OPTIMIZE_CACHE_SIZE; i < nextCache.size(); i++)
+            {
+                unsigned int vertex = nextCache[i];
+                vertexScores[vertex] = getVertexScore(-1, remaining[vertex]);
+            }
+            if (nextCache.size() > OPTIMIZE_CACHE_SIZE)
+                nextCache.resize(OPTIMIZE_CACHE_SIZE);
+
+            for (size_t i = 0; i < nextCache.size(); i++)
+            {
+                unsigned int vertex = nextCache[i];
+                vertexScores[vertex] =
+                  getVertexScore((int)i, remaining[vertex]);
+            }
+
+            // triangles around the cache are the only ones whose score
+            // changed, the best of them is emitted next
+            best = -1;
+            float bestScore = -1.0f;
+            for (unsigned int vertex : nextCache)
+            {
+                const unsigned int* first = &adjacency[offsets[vertex]];
+                for (unsigned int i = 0; i < remaining[vertex]; i++)
+                {
+                    unsigned int t = first[i];
+                    float score = vertexScores[indices[t * 3]] +
+                                  vertexScores[indices[t * 3 + 1]] +
+                                  vertexScores[indices[t * 3 + 2]];
+
+                    if (score > bestScore)
+                    {
+                        bestScore = score;
+                        best = (int)t;
+                    }
+                }
+            }
+
+            cache.swap(nextCache);
+        }
+
+        indices.swap(output);
+    }
+
+    static void optimizeOverdraw(vector<unsigned int>& indices,
+                                 const vector<Vertex>& vertices)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        vector<unsigned int> clusters =
+          getClusters(indices, vertices.size());
+
+        glm::vec3 meshCenter(0.0f);
+        for (unsigned int index : indices)
+        {
+            meshCenter += vertices[index].Position;
+        }
+        meshCenter /= (float)indices.size();
+
+        // how much each cluster faces outwards, area weighted
+        vector<float> sortKeys(clusters.size());
+        for (size_t cluster = 0; cluster < clusters.size(); cluster++)
+        {
+            size_t first = clusters[cluster];
+            size_t last = cluster + 1 < clusters.size() ? clusters[cluster + 1]
+                                                        : triangleCount;
+
+            glm::vec3 center(0.0f), normal(0.0f);
+            float area = 0.0f;
+            for (size_t t = first; t < last; t++)
+            {
+                const glm::vec3& a = vertices[indices[t * 3]].Position;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+
+                glm::vec3 weightedNormal = glm::cross(b - a, c - a);
+                float triangleArea = glm::length(weightedNormal);
+
+                center += (a + b + c) * (triangleArea / 3.0f);
+                normal += weightedNormal;
+                area += triangleArea;
+            }
+
+            if (area > 0.0f)
+                center /= area;
+            float normalLength = glm::length(normal);
+            if (normalLength > 0.0f)
+                normal /= normalLength;
+
+            sortKeys[cluster] = glm::dot(center - meshCenter, normal);
+        }
+
+        vector<unsigned int> order(clusters.size());
+        for (size_t cluster = 0; cluster < order.size(); cluster++)
+        {
+            order[cluster] = (unsigned int)cluster;
+        }
+        std::stable_sort(order.begin(),
+                         order.end(),
+                         [&sortKeys](unsigned int a, unsigned int b)
+                         { return sortKeys[a] > sortKeys[b]; });
+
+        vector<unsigned int> output;
+        output.reserve(indices.size());
+        for (unsigned int cluster : order)
+        {
+            size_t first = clusters[cluster];
+            size_t last = cluster + 1 < clusters.size() ? clusters[cluster + 1]
+                                                        : triangleCount;
+            output.insert(output.end(),
+                          indices.begin() + first * 3,
+                          indices.begin() + last * 3);
+        }
+
+        indices.swap(output);
+    }
+
+    static void optimizeVertexFetch(vector<unsigned int>& indices,
+                                    vector<Vertex>& vertices)
+    {
+        const unsigned int UNUSED = ~0u;
+        vector<unsigned int> remap(vertices.size(), UNUSED);
+        vector<Vertex> output;
+        output.reserve(vertices.size());
+
+        for (unsigned int& index : indices)
+        {
+            if (remap[index] == UNUSED)
+            {
+                remap[index] = (unsigned int)output.size();
+                output.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(output);
+    }
+
+    // splits a mesh into parts of at most maxVertices vertices (65536 for
+    // 16 bit indices), cutting its triangle order so that each part keeps
+    // the cache locality. A mesh small enough is moved as is.
+    static void split(MeshData& mesh,
+                      size_t maxVertices,
+                      vector<MeshData>& parts)
+    {
+        if (maxVertices < 3 || mesh.vertices.size() <= maxVertices)
+        {
+            parts.push_back(std::move(mesh));
+            return;
+        }
+
+        const unsigned int UNUSED = ~0u;
+        vector<unsigned int> remap(mesh.vertices.size(), UNUSED);
+        // source vertices of the current part, to reset their remap
+        vector<unsigned int> sources;
+
+        MeshData part;
+        part.textures = mesh.textures;
+
+        for (size_t t = 0; t < mesh.indices.size() / 3; t++)
+        {
+            const unsigned int* triangle = &mesh.indices[t * 3];
+
+            size_t newVertices = 0;
+            for (int i = 0; i < 3; i++)
+            {
+                newVertices += remap[triangle[i]] == UNUSED;
+            }
+
+            if (part.vertices.size() + newVertices > maxVertices)
+            {
+                for (unsigned int source : sources)
+                {
+                    remap[source] = UNUSED;
+                }
+                sources.clear();
+
+                parts.push_back(std::move(part));
+                part = MeshData();
+                part.textures = mesh.textures;
+            }
+
+            for (int i = 0; i < 3; i++)
+            {
+                unsigned int index = triangle[i];
+                if (remap[index] == UNUSED)
+                {
+                    remap[index] = (unsigned int)part.vertices.size();
+                    part.vertices.push_back(mesh.vertices[index]);
+                    sources.push_back(index);
+                }
+                part.indices.push_back(remap[index]);
+            }
+        }
+
+        if (!part.indices.empty())
+            parts.push_back(std::move(part));
+    }
+
+  private:
+    // Forsyth's scoring: vertices recently used score higher (the last
+    // triangle's a bit less, to avoid strips), vertices with few triangles
+    // left score higher so they are finished instead of left stranded
+    static float getVertexScore(int cachePosition, unsigned int remaining)
+    {
+        if (remaining == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 3)
+        {
+            float scale = 1.0f / (OPTIMIZE_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, 1.5f);
+        }
+        else if (cachePosition >= 0)
+        {
+            score = 0.75f;
+        }
+
+        return score + 2.0f / std::sqrt((float)remaining);
+    }
+
+    // first triangle of each cluster. A cluster ends where the cache is
+    // flushed (a triangle missing all its vertices) or, before that, as soon
+    // as its ACMR from a cold cache is within the threshold of the whole
+    // mesh's, so that reordering the clusters costs little cache efficiency
+    static vector<unsigned int> getClusters(const vector<unsigned int>& indices,
+                                            size_t vertexCount)
+    {
+        float threshold =
+          analyze(indices, vertexCount).getACMR() * OVERDRAW_THRESHOLD;
+
+        vector<unsigned int> clusters;
+        // FIFO of the whole index buffer, and of the current cluster alone
+        Fifo mesh(vertexCount), cluster(vertexCount);
+        unsigned int clusterTriangles = 0, clusterMisses = 0;
+
+        for (size_t t = 0; t < indices.size() / 3; t++)
+        {
+            const unsigned int* triangle = &indices[t * 3];
+
+            bool flushed = mesh.access(triangle) == 3;
+            bool efficient =
+              clusterTriangles > 0 &&
+              (float)clusterMisses / clusterTriangles <= threshold;
+
+            if (clusters.empty() || flushed || efficient)
+            {
+                clusters.push_back((unsigned int)t);
+                cluster.flush();
+                clusterTriangles = 0;
+                clusterMisses = 0;
+            }
+
+            clusterTriangles++;
+            clusterMisses += cluster.access(triangle);
+        }
+
+        return clusters;
+    }
+
+    // ANALYZE_CACHE_SIZE entries FIFO, by timestamp of each vertex's entry
+    struct Fifo
+    {
+        vector<unsigned int> entries;
+        unsigned int time = ANALYZE_CACHE_SIZE + 1;
+
+        explicit Fifo(size_t vertexCount)
+          : entries(vertexCount, 0)
+        {
+        }
+
+        void flush() { time += ANALYZE_CACHE_SIZE + 1; }
+
+        // cache misses of a triangle
+        unsigned int access(const unsigned int* triangle)
+        {
+            unsigned int misses = 0;
+            for (int i = 0; i < 3; i++)
+            {
+                if (time - entries[triangle[i]] > ANALYZE_CACHE_SIZE)
+                {
+                    entries[triangle[i]] = time++;
+                    misses++;
+                }
+            }
+            return misses;
+        }
+    };
+};
+
+#endif
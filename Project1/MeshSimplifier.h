@@ -0,0 +1,645 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.h"
+#include "MeshOptimizer.h"
+
+// Simplifies the index buffer of a mesh by edge collapses ordered by their
+// quadric error (Garland & Heckbert), collapsing vertices onto one of their
+// neighbors so that the vertices are shared by every level of detail.
+//
+// Vertices keep their attributes, what has to be preserved is where they
+// are discontinuous: vertices sharing a position (UV seams, hard normal or
+// tangent frame edges) only collapse along their seam, together with their
+// twin on the other side, and open borders only collapse along themselves.
+// Vertices where more than two wedges meet are never moved.
+//
+// reduce() can be called with decreasing targets, each level continues from
+// the previous one and its error is measured against the original mesh.
+class MeshSimplifier
+{
+  public:
+    MeshSimplifier(const vector<Vertex>& vertices,
+                   const vector<unsigned int>& indices)
+      : vertices(vertices)
+      , indices(indices)
+    {
+        buildWedges();
+        classifyVertices();
+        buildQuadrics();
+    }
+
+    // collapses edges until at most targetIndexCount indices are left or
+    // the next collapse would move the surface by more than maxError
+    // (object space distance)
+    void reduce(size_t targetIndexCount, float maxError)
+    {
+        float errorLimit = maxError * maxError;
+
+        while (indices.size() > targetIndexCount)
+        {
+            size_t collapsed =
+              collapseEdges(indices.size() - targetIndexCount, errorLimit);
+            if (collapsed == 0)
+                break;
+
+            removeDegenerateTriangles();
+        }
+    }
+
+    const vector<unsigned int>& getIndices() const { return indices; }
+
+    // appends up to MAX_LODS - 1 simplified levels to the mesh's indices,
+    // each with about half the triangles of the previous one. Stops early
+    // when a level cannot get much smaller within MAX_LOD_ERROR.
+    static void generateLods(MeshData& mesh)
+    {
+        size_t indexCount = mesh.indices.size();
+        mesh.lods = { { 0, (unsigned int)indexCount, 0.0f } };
+        if (indexCount < MIN_LOD_INDICES)
+            return;
+
+        BoundingBox bounds;
+        for (const Vertex& vertex : mesh.vertices)
+        {
+            bounds.extend(vertex.Position);
+        }
+        float maxError = glm::length(bounds.max - bounds.min) * MAX_LOD_ERROR;
+
+        MeshSimplifier simplifier(mesh.vertices, mesh.indices);
+        size_t target = indexCount;
+
+        for (unsigned int lod = 1; lod < MAX_LODS; lod++)
+        {
+            target = target / 6 * 3;
+            simplifier.reduce(target, maxError);
+
+            size_t previousCount = mesh.lods.back().indexCount;
+            vector<unsigned int> indices = simplifier.getIndices();
+            if (indices.size() < MIN_LOD_INDICES ||
+                indices.size() > previousCount * MIN_LOD_REDUCTION)
+                break;
+
+            MeshOptimizer::optimizeVertexCache(indices, mesh.vertices.size());
+            mesh.lods.push_back({ (unsigned int)mesh.indices.size(),
+                                  (unsigned int)indices.size(),
+                                  simplifier.getError() });
+            mesh.indices.insert(mesh.indices.end(),
+                                indices.begin(),
+                                indices.end());
+        }
+    }
+
+    // largest distance between the simplified and the original surface
+    // introduced so far, as estimated by the quadrics
+    float getError() const { return std::sqrt(error); }
+
+  private:
+    enum VertexKind
+    {
+        // interior vertex, collapses onto any neighbor
+        MANIFOLD,
+        // on an open border, collapses along it
+        BORDER,
+        // one of the two wedges of a seam, collapses along it with its twin
+        SEAM,
+        // never moves
+        LOCKED
+    };
+
+    // squared distance to a set of planes, weighted by their area
+    struct Quadric
+    {
+        double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0;
+        double weight = 0;
+
+        static Quadric fromPlane(const glm::vec3& normal,
+                                 float distance,
+                                 float weight)
+        {
+            Quadric q;
+            double x = normal.x, y = normal.y, z = normal.z, d = distance;
+            q.a00 = x * x * weight;
+            q.a01 = x * y * weight;
+            q.a02 = x * z * weight;
+            q.a11 = y * y * weight;
+            q.a12 = y * z * weight;
+            q.a22 = z * z * weight;
+            q.b0 = x * d * weight;
+            q.b1 = y * d * weight;
+            q.b2 = z * d * weight;
+            q.c = d * d * weight;
+            q.weight = weight;
+            return q;
+        }
+
+        Quadric& operator+=(const Quadric& other)
+        {
+            a00 += other.a00;
+            a01 += other.a01;
+            a02 += other.a02;
+            a11 += other.a11;
+            a12 += other.a12;
+            a22 += other.a22;
+            b0 += other.b0;
+            b1 += other.b1;
+            b2 += other.b2;
+            c += other.c;
+            weight += other.weight;
+            return *this;
+        }
+
+        // mean squared distance of p to the planes
+        float evaluate(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double value = a00 * x * x + a11 * y * y + a22 * z * z +
+                           2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                           2.0 * (b0 * x + b1 * y + b2 * z) + c;
+            return weight > 0.0 ? (float)(std::max(value, 0.0) / weight)
+                                : 0.0f;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int vertex;
+        unsigned int target;
+        float error;
+    };
+
+    // levels of detail per mesh, the full detail one included
+    static constexpr unsigned int MAX_LODS = 5;
+    // meshes and levels smaller than this are not simplified further
+    static constexpr size_t MIN_LOD_INDICES = 3 * 64;
+    // a level needs to have at most this fraction of the previous one's
+    // triangles to be kept
+    static constexpr float MIN_LOD_REDUCTION = 0.8f;
+    // largest error of a level, relative to the mesh's bounding box diagonal
+    static constexpr float MAX_LOD_ERROR = 0.05f;
+
+    static constexpr unsigned int NONE = ~0u;
+    // weight of the planes keeping borders and seams in place, relative to
+    // the surface
+    static constexpr float BORDER_WEIGHT = 10.0f;
+
+    const vector<Vertex>& vertices;
+    vector<unsigned int> indices;
+
+    // first vertex of each position, and the next vertex sharing it (a
+    // circular list)
+    vector<unsigned int> positions;
+    vector<unsigned int> wedges;
+
+    vector<VertexKind> kinds;
+    // along open edges (index space), the vertex after and before
+    vector<unsigned int> borderNext;
+    vector<unsigned int> borderPrevious;
+
+    // open edges of the original mesh, sorted
+    vector<uint64_t> openHalfEdges;
+
+    // one per position
+    vector<Quadric> quadrics;
+    float error = 0.0f;
+
+    void buildWedges()
+    {
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3& p) const
+            {
+                uint32_t bits[3];
+                std::memcpy(bits, &p, sizeof(bits));
+                return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^
+                                bits[2] * 83492791u);
+            }
+        };
+
+        std::unordered_map<glm::vec3, unsigned int, PositionHash> first;
+        first.reserve(vertices.size());
+
+        positions.resize(vertices.size());
+        wedges.resize(vertices.size());
+
+        for (unsigned int v = 0; v < vertices.size(); v++)
+        {
+            auto inserted = first.emplace(vertices[v].Position, v);
+            unsigned int position = inserted.first->second;
+            positions[v] = position;
+
+            if (inserted.second)
+            {
+                wedges[v] = v;
+            }
+            else
+            {
+                wedges[v] = wedges[position];
+                wedges[position] = v;
+            }
+        }
+    }
+
+    void classifyVertices()
+    {
+        size_t vertexCount = vertices.size();
+        borderNext.assign(vertexCount, NONE);
+        borderPrevious.assign(vertexCount, NONE);
+        vector<unsigned int> openEdges(vertexCount, 0);
+
+        // half edges a -> b, an edge is open when b -> a does not exist
+        vector<uint64_t> halfEdges;
+        halfEdges.reserve(indices.size());
+        forEachHalfEdge([&halfEdges](unsigned int a, unsigned int b)
+                        { halfEdges.push_back((uint64_t)a << 32 | b); });
+        std::sort(halfEdges.begin(), halfEdges.end());
+
+        // a vertex with several open edges out (or in) points to itself
+        forEachHalfEdge(
+          [&](unsigned int a, unsigned int b)
+          {
+              if (std::binary_search(
+                    halfEdges.begin(), halfEdges.end(), (uint64_t)b << 32 | a))
+                  return;
+
+              borderNext[a] = borderNext[a] == NONE ? b : a;
+              borderPrevious[b] = borderPrevious[b] == NONE ? a : b;
+              openEdges[a]++;
+              openEdges[b]++;
+              openHalfEdges.push_back((uint64_t)a << 32 | b);
+          });
+        std::sort(openHalfEdges.begin(), openHalfEdges.end());
+
+        kinds.assign(vertexCount, LOCKED);
+        for (unsigned int v = 0; v < vertexCount; v++)
+        {
+            unsigned int twin = wedges[v];
+
+            if (twin == v)
+            {
+                if (openEdges[v] == 0)
+                    kinds[v] = MANIFOLD;
+                else if (isSimpleBorder(v, openEdges))
+                    kinds[v] = BORDER;
+            }
+            else if (wedges[twin] == v && isSimpleBorder(v, openEdges) &&
+                     isSimpleBorder(twin, openEdges) &&
+                     positions[borderNext[v]] ==
+                       positions[borderPrevious[twin]] &&
+                     positions[borderPrevious[v]] ==
+                       positions[borderNext[twin]])
+            {
+                // both wedges open on the same edges, mirrored: the edges
+                // are a seam and not a border of the surface
+                kinds[v] = SEAM;
+            }
+        }
+    }
+
+    // exactly one open edge in and one out, to different vertices
+    bool isSimpleBorder(unsigned int v,
+                        const vector<unsigned int>& openEdges) const
+    {
+        return openEdges[v] == 2 && borderNext[v] != NONE &&
+               borderNext[v] != v && borderPrevious[v] != NONE &&
+               borderPrevious[v] != v;
+    }
+
+    template<typename F>
+    void forEachHalfEdge(F function) const
+    {
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                function(indices[t + i], indices[t + (i + 1) % 3]);
+            }
+        }
+    }
+
+    void buildQuadrics()
+    {
+        quadrics.assign(vertices.size(), Quadric());
+
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            glm::vec3 normal;
+            float area;
+            if (!getTriangleNormal(t, normal, area))
+                continue;
+
+            const glm::vec3& p0 = vertices[indices[t]].Position;
+            Quadric plane =
+              Quadric::fromPlane(normal, -glm::dot(normal, p0), area);
+
+            for (int i = 0; i < 3; i++)
+            {
+                quadrics[positions[indices[t + i]]] += plane;
+            }
+
+            // planes through the open edges, perpendicular to the triangle
+            for (int i = 0; i < 3; i++)
+            {
+                unsigned int a = indices[t + i];
+                unsigned int b = indices[t + (i + 1) % 3];
+                if (!std::binary_search(openHalfEdges.begin(),
+                                        openHalfEdges.end(),
+                                        (uint64_t)a << 32 | b))
+                    continue;
+
+                glm::vec3 edge = vertices[b].Position - vertices[a].Position;
+                float length = glm::length(edge);
+                if (length == 0.0f)
+                    continue;
+
+                glm::vec3 edgeNormal = glm::normalize(glm::cross(edge, normal));
+                Quadric border = Quadric::fromPlane(
+                  edgeNormal,
+                  -glm::dot(edgeNormal, vertices[a].Position),
+                  length * length * BORDER_WEIGHT);
+
+                quadrics[positions[a]] += border;
+                quadrics[positions[b]] += border;
+            }
+        }
+    }
+
+    bool getTriangleNormal(size_t t, glm::vec3& normal, float& area) const
+    {
+        const glm::vec3& p0 = vertices[indices[t]].Position;
+        const glm::vec3& p1 = vertices[indices[t + 1]].Position;
+        const glm::vec3& p2 = vertices[indices[t + 2]].Position;
+
+        normal = glm::cross(p1 - p0, p2 - p0);
+        area = glm::length(normal);
+        if (area == 0.0f)
+            return false;
+
+        normal /= area;
+        area *= 0.5f;
+        return true;
+    }
+
+    // the twin target of a seam collapse vertex -> target, mirrored on the
+    // other side of the seam
+    unsigned int getTwinTarget(unsigned int vertex, unsigned int target) const
+    {
+        unsigned int twin = wedges[vertex];
+        return target == borderNext[vertex] ? borderPrevious[twin]
+                                            : borderNext[twin];
+    }
+
+    bool canCollapse(unsigned int vertex, unsigned int target) const
+    {
+        switch (kinds[vertex])
+        {
+            case MANIFOLD:
+                return true;
+            case BORDER:
+            case SEAM:
+                return target == borderNext[vertex] ||
+                       target == borderPrevious[vertex];
+            default:
+                return false;
+        }
+    }
+
+    // one pass of collapses in increasing error, each triangle is changed
+    // by one collapse at most. Returns how many were done.
+    size_t collapseEdges(size_t indicesToRemove, float errorLimit)
+    {
+        vector<Collapse> collapses;
+        forEachHalfEdge(
+          [&](unsigned int a, unsigned int b)
+          {
+              if (positions[a] == positions[b])
+                  return;
+
+              // interior edges are seen twice, the duplicates are skipped
+              // as their vertices are locked by then
+              if (canCollapse(a, b))
+              {
+                  collapses.push_back(
+                    { a, b, quadrics[positions[a]].evaluate(
+                              vertices[b].Position) });
+              }
+              if (canCollapse(b, a))
+              {
+                  collapses.push_back(
+                    { b, a, quadrics[positions[b]].evaluate(
+                              vertices[a].Position) });
+              }
+          });
+
+        std::sort(collapses.begin(),
+                  collapses.end(),
+                  [](const Collapse& x, const Collapse& y)
+                  { return x.error < y.error; });
+
+        vector<unsigned int> adjacencyOffsets, adjacency;
+        buildAdjacency(adjacencyOffsets, adjacency);
+
+        vector<unsigned int> remap(vertices.size());
+        for (unsigned int v = 0; v < remap.size(); v++)
+        {
+            remap[v] = v;
+        }
+        vector<bool> locked(vertices.size(), false);
+
+        size_t collapsed = 0, removed = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapse.error > errorLimit || removed >= indicesToRemove)
+                break;
+
+            unsigned int vertex = collapse.vertex;
+            unsigned int target = collapse.target;
+            bool seam = kinds[vertex] == SEAM;
+            unsigned int twin = seam ? wedges[vertex] : NONE;
+            unsigned int twinTarget =
+              seam ? getTwinTarget(vertex, target) : NONE;
+
+            if (locked[vertex] || locked[target] ||
+                (seam && (twinTarget == NONE || locked[twin] ||
+                          locked[twinTarget] ||
+                          positions[twinTarget] != positions[target])))
+                continue;
+
+            const glm::vec3& position = vertices[target].Position;
+            if (flipsTriangles(vertex, target, position, adjacencyOffsets,
+                               adjacency) ||
+                (seam && flipsTriangles(twin, twinTarget, position,
+                                        adjacencyOffsets, adjacency)))
+                continue;
+
+            remap[vertex] = target;
+            lockNeighbors(vertex, adjacencyOffsets, adjacency, locked);
+            removed += countSharedTriangles(vertex, target, adjacencyOffsets,
+                                            adjacency) * 3;
+            updateBorder(vertex, target);
+
+            if (seam)
+            {
+                remap[twin] = twinTarget;
+                lockNeighbors(twin, adjacencyOffsets, adjacency, locked);
+                removed += countSharedTriangles(twin, twinTarget,
+                                                adjacencyOffsets, adjacency) *
+                           3;
+                updateBorder(twin, twinTarget);
+            }
+
+            quadrics[positions[target]] += quadrics[positions[vertex]];
+            error = std::max(error, collapse.error);
+            collapsed++;
+        }
+
+        for (unsigned int& index : indices)
+        {
+            index = remap[index];
+        }
+        for (unsigned int v = 0; v < vertices.size(); v++)
+        {
+            if (borderNext[v] != NONE)
+                borderNext[v] = remap[borderNext[v]];
+            if (borderPrevious[v] != NONE)
+                borderPrevious[v] = remap[borderPrevious[v]];
+        }
+
+        return collapsed;
+    }
+
+    // the vertex and every vertex sharing a triangle with it (the target
+    // among them) take no other collapse in this pass, so that a triangle
+    // has one vertex moved at most and flipsTriangles() stays exact
+    void lockNeighbors(unsigned int vertex,
+                       const vector<unsigned int>& offsets,
+                       const vector<unsigned int>& adjacency,
+                       vector<bool>& locked) const
+    {
+        locked[vertex] = true;
+        for (unsigned int i = offsets[vertex]; i < offsets[vertex + 1]; i++)
+        {
+            size_t t = adjacency[i];
+            locked[indices[t]] = true;
+            locked[indices[t + 1]] = true;
+            locked[indices[t + 2]] = true;
+        }
+    }
+
+    // vertex -> target along an open edge, the target's neighbor on that
+    // side becomes the vertex's other neighbor
+    void updateBorder(unsigned int vertex, unsigned int target)
+    {
+        if (borderPrevious[target] == vertex)
+            borderPrevious[target] = borderPrevious[vertex];
+        if (borderNext[target] == vertex)
+            borderNext[target] = borderNext[vertex];
+    }
+
+    // triangles of each vertex in the current index buffer
+    void buildAdjacency(vector<unsigned int>& offsets,
+                        vector<unsigned int>& adjacency) const
+    {
+        offsets.assign(vertices.size() + 1, 0);
+        for (unsigned int index : indices)
+        {
+            offsets[index + 1]++;
+        }
+        for (size_t v = 0; v < vertices.size(); v++)
+        {
+            offsets[v + 1] += offsets[v];
+        }
+
+        vector<unsigned int> counts(vertices.size(), 0);
+        adjacency.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            unsigned int index = indices[i];
+            adjacency[offsets[index] + counts[index]++] =
+              (unsigned int)(i / 3 * 3);
+        }
+    }
+
+    // a triangle around vertex turns over (or close to it) once vertex is
+    // moved to position
+    bool flipsTriangles(unsigned int vertex,
+                        unsigned int target,
+                        const glm::vec3& position,
+                        const vector<unsigned int>& offsets,
+                        const vector<unsigned int>& adjacency) const
+    {
+        for (unsigned int i = offsets[vertex]; i < offsets[vertex + 1]; i++)
+        {
+            size_t t = adjacency[i];
+            glm::vec3 before[3], after[3];
+            bool shared = false;
+
+            for (int j = 0; j < 3; j++)
+            {
+                unsigned int index = indices[t + j];
+                shared |= index == target;
+                before[j] = vertices[index].Position;
+                after[j] = index == vertex ? position : before[j];
+            }
+
+            // removed by the collapse
+            if (shared)
+                continue;
+
+            glm::vec3 normalBefore =
+              glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 normalAfter =
+              glm::cross(after[1] - after[0], after[2] - after[0]);
+
+            if (glm::dot(normalBefore, normalAfter) <=
+                0.25f * glm::length(normalBefore) * glm::length(normalAfter))
+                return true;
+        }
+        return false;
+    }
+
+    unsigned int countSharedTriangles(
+      unsigned int vertex,
+      unsigned int target,
+      const vector<unsigned int>& offsets,
+      const vector<unsigned int>& adjacency) const
+    {
+        unsigned int count = 0;
+        for (unsigned int i = offsets[vertex]; i < offsets[vertex + 1]; i++)
+        {
+            size_t t = adjacency[i];
+            count += indices[t] == target || indices[t + 1] == target ||
+                     indices[t + 2] == target;
+        }
+        return count;
+    }
+
+    void removeDegenerateTriangles()
+    {
+        size_t kept = 0;
+        for (size_t t = 0; t < indices.size(); t += 3)
+        {
+            unsigned int a = indices[t], b = indices[t + 1],
+                         c = indices[t + 2];
+            if (a == b || b == c || a == c)
+                continue;
+
+            indices[kept++] = a;
+            indices[kept++] = b;
+            indices[kept++] = c;
+        }
+        indices.resize(kept);
+    }
+};
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef MESHLET_BUILDER_H
+#define MESHLET_BUILDER_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+
+// Partitions the full detail level of a mesh into meshlets, once at import
+// time. Each meshlet grows from the first triangle left in the vertex cache
+// order over the triangles sharing its vertices, preferring the ones adding
+// the fewest new vertices, and stops at MAX_VERTICES, MAX_TRIANGLES or when
+// no neighbour faces close enough to the meshlet's average normal, so that
+// meshlets stay compact and flat enough for their normal cone to cull.
+//
+// The triangles of lods[0] are rewritten in meshlet order, every meshlet is
+// a contiguous index range. Coarser levels are left as they are.
+class MeshletBuilder
+{
+  public:
+    static constexpr unsigned int MAX_VERTICES = 64;
+    static constexpr unsigned int MAX_TRIANGLES = 124;
+    // cosine of the largest angle between a triangle added to a meshlet and
+    // the meshlet's average normal (60 degrees)
+    static constexpr float MIN_NORMAL_DOT = 0.5f;
+    // a cone whose triangles spread further than this (cosine to the axis)
+    // is made uncullable, it would only be culled from grazing angles
+    static constexpr float MIN_CONE_DOT = 0.1f;
+
+    static void build(MeshData& mesh)
+    {
+        mesh.meshlets.clear();
+
+        unsigned int indexCount = mesh.lods.empty()
+                                    ? (unsigned int)mesh.indices.size()
+                                    : mesh.lods[0].indexCount;
+        unsigned int firstIndex =
+          mesh.lods.empty() ? 0 : mesh.lods[0].firstIndex;
+        if (indexCount < 3)
+            return;
+
+        MeshletBuilder builder(mesh, firstIndex, indexCount);
+        builder.run();
+    }
+
+  private:
+    MeshData& mesh;
+    unsigned int firstIndex;
+    size_t triangleCount;
+
+    // unit normals and twice the areas of the triangles
+    vector<glm::vec3> normals;
+    vector<float> areas;
+    // triangles using each vertex, offsets into vertexTriangles
+    vector<unsigned int> vertexOffsets;
+    vector<unsigned int> vertexTriangles;
+
+    vector<bool> emitted;
+    vector<unsigned int> output;
+
+    // meshlet the vertex was last added to, for membership tests
+    vector<int> vertexMeshlet;
+
+    // meshlet being grown
+    vector<unsigned int> meshletVertices;
+    vector<unsigned int> meshletTriangles;
+    glm::vec3 normalSum;
+
+    MeshletBuilder(MeshData& mesh,
+                   unsigned int firstIndex,
+                   unsigned int indexCount)
+      : mesh(mesh)
+      , firstIndex(firstIndex)
+      , triangleCount(indexCount / 3)
+    {
+        const unsigned int* indices = mesh.indices.data() + firstIndex;
+        size_t vertexCount = mesh.vertices.size();
+
+        normals.resize(triangleCount);
+        areas.resize(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            const glm::vec3& a = mesh.vertices[indices[t * 3]].Position;
+            const glm::vec3& b = mesh.vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& c = mesh.vertices[indices[t * 3 + 2]].Position;
+
+            // faces the side its vertex normals face whatever the winding,
+            // nothing else decides what is back facing while face culling
+            // is off
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            glm::vec3 shading = mesh.vertices[indices[t * 3]].Normal +
+                                mesh.vertices[indices[t * 3 + 1]].Normal +
+                                mesh.vertices[indices[t * 3 + 2]].Normal;
+            if (glm::dot(normal, shading) < 0.0f)
+                normal = -normal;
+
+            areas[t] = glm::length(normal);
+            normals[t] =
+              areas[t] > 0.0f ? normal / areas[t] : glm::vec3(0.0f);
+        }
+
+        vertexOffsets.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+        {
+            vertexOffsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++)
+        {
+            vertexOffsets[v + 1] += vertexOffsets[v];
+        }
+
+        vector<unsigned int> fill(vertexOffsets.begin(),
+                                  vertexOffsets.end() - 1);
+        vertexTriangles.resize(triangleCount * 3);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+        {
+            vertexTriangles[fill[indices[i]]++] = (unsigned int)(i / 3);
+        }
+
+        emitted.assign(triangleCount, false);
+        vertexMeshlet.assign(vertexCount, -1);
+        output.reserve(triangleCount * 3);
+    }
+
+    void run()
+    {
+        size_t seed = 0;
+        while (true)
+        {
+            while (seed < triangleCount && emitted[seed])
+            {
+                seed++;
+            }
+            if (seed == triangleCount)
+                break;
+
+            int meshlet = (int)mesh.meshlets.size();
+            meshletVertices.clear();
+            meshletTriangles.clear();
+            normalSum = glm::vec3(0.0f);
+
+            addTriangle((unsigned int)seed, meshlet);
+            while (meshletTriangles.size() < MAX_TRIANGLES)
+            {
+                int next = findNeighbour(meshlet);
+                if (next < 0)
+                    break;
+                addTriangle((unsigned int)next, meshlet);
+            }
+
+            finishMeshlet();
+        }
+
+        std::copy(output.begin(),
+                  output.end(),
+                  mesh.indices.begin() + firstIndex);
+    }
+
+    unsigned int getNewVertices(unsigned int triangle, int meshlet) const
+    {
+        const unsigned int* indices = mesh.indices.data() + firstIndex;
+
+        unsigned int count = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if (vertexMeshlet[indices[triangle * 3 + k]] != meshlet)
+                count++;
+        }
+        return count;
+    }
+
+    // best unemitted triangle sharing a vertex with the meshlet, -1 if none
+    // fits
+    int findNeighbour(int meshlet) const
+    {
+        glm::vec3 axis = glm::length(normalSum) > 0.0f
+                           ? glm::normalize(normalSum)
+                           : glm::vec3(0.0f);
+
+        int best = -1;
+        float bestScore = 0.0f;
+        for (unsigned int vertex : meshletVertices)
+        {
+            for (unsigned int i = vertexOffsets[vertex];
+                 i < vertexOffsets[vertex + 1];
+                 i++)
+            {
+                unsigned int triangle = vertexTriangles[i];
+                if (emitted[triangle])
+                    continue;
+
+                unsigned int added = getNewVertices(triangle, meshlet);
+                if (meshletVertices.size() + added > MAX_VERTICES)
+                    continue;
+
+                // degenerate triangles never cull, they fit anywhere
+                float dot = areas[triangle] > 0.0f && axis != glm::vec3(0.0f)
+                              ? glm::dot(normals[triangle], axis)
+                              : 1.0f;
+                if (dot < MIN_NORMAL_DOT)
+                    continue;
+
+                float score = (float)added + (1.0f - dot);
+                if (best < 0 || score < bestScore)
+                {
+                    best = (int)triangle;
+                    bestScore = score;
+                }
+            }
+        }
+        return best;
+    }
+
+    void addTriangle(unsigned int triangle, int meshlet)
+    {
+        const unsigned int* indices = mesh.indices.data() + firstIndex;
+
+        emitted[triangle] = true;
+        meshletTriangles.push_back(triangle);
+        normalSum += normals[triangle] * areas[triangle];
+
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int vertex = indices[triangle * 3 + k];
+            if (vertexMeshlet[vertex] != meshlet)
+            {
+                vertexMeshlet[vertex] = meshlet;
+                meshletVertices.push_back(vertex);
+            }
+        }
+    }
+
+    // appends the meshlet's triangles to the output with their bounds and
+    // normal cone
+    void finishMeshlet()
+    {
+        const unsigned int* indices = mesh.indices.data() + firstIndex;
+
+        Meshlet meshlet;
+        meshlet.firstIndex = firstIndex + (unsigned int)output.size();
+        meshlet.indexCount = (unsigned int)meshletTriangles.size() * 3;
+
+        for (unsigned int triangle : meshletTriangles)
+        {
+            output.insert(output.end(),
+                          indices + triangle * 3,
+                          indices + triangle * 3 + 3);
+        }
+
+        // sphere centered on the box, like Mesh::boundingSphere
+        BoundingBox box;
+        for (unsigned int vertex : meshletVertices)
+        {
+            box.extend(mesh.vertices[vertex].Position);
+        }
+        meshlet.center = box.getCenter();
+        meshlet.radius = 0.0f;
+        for (unsigned int vertex : meshletVertices)
+        {
+            meshlet.radius =
+              std::max(meshlet.radius,
+                       glm::distance(meshlet.center,
+                                     mesh.vertices[vertex].Position));
+        }
+
+        // axis averaging the unit normals, the cutoff is the sine of the
+        // widest angle between it and a triangle
+        glm::vec3 axis(0.0f);
+        for (unsigned int triangle : meshletTriangles)
+        {
+            axis += normals[triangle];
+        }
+
+        float minDot = -1.0f;
+        if (glm::length(axis) > 0.0f)
+        {
+            axis = glm::normalize(axis);
+            minDot = 1.0f;
+            for (unsigned int triangle : meshletTriangles)
+            {
+                if (areas[triangle] > 0.0f)
+                    minDot =
+                      std::min(minDot, glm::dot(normals[triangle], axis));
+            }
+        }
+
+        meshlet.coneAxis = axis;
+        meshlet.coneCutoff = minDot <= MIN_CONE_DOT
+                               ? 1.0f
+                               : std::sqrt(1.0f - minDot * minDot);
+
+        mesh.meshlets.push_back(meshlet);
+    }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef MESHLET_CULLER_H
+#define MESHLET_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include "BoundingBox.h"
+#include "Frustum.h"
+#include "Mesh.h"
+
+// meshlets tested and rejected since the last reset
+struct MeshletCullStats
+{
+    unsigned int tested = 0;
+    unsigned int backfacing = 0;
+    unsigned int outsideFrustum = 0;
+};
+
+// Culls the meshlets of a visible mesh against a viewpoint, built per frame
+// and view. A meshlet is rejected when its normal cone faces away from the
+// viewpoint (every triangle is back facing) or its sphere is outside the
+// frustum, the visible ones are merged into as few index ranges as possible
+// for Mesh::Draw(shader, ranges).
+class MeshletCuller
+{
+  public:
+    MeshletCuller(const Frustum& frustum, const glm::vec3& viewPosition)
+      : frustum(frustum)
+      , viewPosition(viewPosition)
+    {
+    }
+
+    // false when the mesh has no meshlets, ranges is then left empty and
+    // the mesh should be drawn whole
+    bool cull(const Mesh& mesh,
+              const glm::mat4& model,
+              DrawRanges& ranges,
+              MeshletCullStats& stats) const
+    {
+        ranges.clear();
+        if (mesh.meshlets.empty())
+            return false;
+
+        // the cone test is done in object space, where the cones are
+        glm::vec3 objectViewPosition =
+          glm::vec3(glm::inverse(model) * glm::vec4(viewPosition, 1.0f));
+        size_t indexSize = Mesh::getIndexSize(mesh.indexType);
+
+        for (const Meshlet& meshlet : mesh.meshlets)
+        {
+            stats.tested++;
+
+            glm::vec3 toMeshlet = meshlet.center - objectViewPosition;
+            if (glm::dot(toMeshlet, meshlet.coneAxis) >=
+                meshlet.coneCutoff * glm::length(toMeshlet) + meshlet.radius)
+            {
+                stats.backfacing++;
+                continue;
+            }
+
+            BoundingSphere sphere{ meshlet.center, meshlet.radius };
+            if (!frustum.intersects(sphere.transformed(model)))
+            {
+                stats.outsideFrustum++;
+                continue;
+            }
+
+            ranges.add(meshlet.firstIndex, meshlet.indexCount, indexSize);
+        }
+        return true;
+    }
+
+  private:
+    const Frustum& frustum;
+    glm::vec3 viewPosition;
+};
+
+#endif
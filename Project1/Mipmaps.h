@@ -0,0 +1,496 @@
+#ifndef MIPMAPS_H
+#define MIPMAPS_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// SSE2 is part of every x64 target, the scalar path covers the others
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPMAPS_SSE2
+#include <emmintrin.h>
+#endif
+
+enum class MipmapFilter
+{
+    // 2x2 average
+    Box,
+    // 8x8 Kaiser windowed sinc, sharper levels without aliasing
+    Kaiser
+};
+
+// what the texel values mean, which decides how they are averaged
+enum class MipmapEncoding
+{
+    Linear,
+    // color channels are sRGB encoded, filtered in linear space
+    SRGB,
+    // RGB is a unit vector packed to [0, 1], renormalized after filtering
+    Normal
+};
+
+struct MipmapOptions
+{
+    MipmapFilter filter = MipmapFilter::Box;
+    MipmapEncoding encoding = MipmapEncoding::Linear;
+};
+
+// levels of a full mip chain down to 1x1
+inline int
+getMipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        levels++;
+    }
+    return levels;
+}
+
+namespace Mipmaps
+{
+// RGBA of a texel being filtered
+#ifdef MIPMAPS_SSE2
+struct Texel
+{
+    __m128 value;
+
+    static Texel load(const float* texel) { return { _mm_loadu_ps(texel) }; }
+    void store(float* texel) const { _mm_storeu_ps(texel, value); }
+
+    static Texel zero() { return { _mm_setzero_ps() }; }
+    static Texel set(float r, float g, float b, float a)
+    {
+        return { _mm_setr_ps(r, g, b, a) };
+    }
+
+    // this + texel * weight
+    Texel add(const Texel& texel, float weight) const
+    {
+        return { _mm_add_ps(value,
+                            _mm_mul_ps(texel.value, _mm_set1_ps(weight))) };
+    }
+
+    // this * scale + bias, clamped to [0, maximum]
+    Texel scale(const Texel& scale, const Texel& bias, float maximum) const
+    {
+        __m128 scaled = _mm_add_ps(_mm_mul_ps(value, scale.value), bias.value);
+        return { _mm_min_ps(_mm_max_ps(scaled, _mm_setzero_ps()),
+                            _mm_set1_ps(maximum)) };
+    }
+
+    // truncated toward zero
+    void toIntegers(int* integers) const
+    {
+        _mm_storeu_si128((__m128i*)integers, _mm_cvttps_epi32(value));
+    }
+};
+#else
+struct Texel
+{
+    float value[4];
+
+    static Texel load(const float* texel)
+    {
+        return { { texel[0], texel[1], texel[2], texel[3] } };
+    }
+    void store(float* texel) const
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            texel[c] = value[c];
+        }
+    }
+
+    static Texel zero() { return { { 0.0f, 0.0f, 0.0f, 0.0f } }; }
+    static Texel set(float r, float g, float b, float a)
+    {
+        return { { r, g, b, a } };
+    }
+
+    Texel add(const Texel& texel, float weight) const
+    {
+        Texel sum;
+        for (int c = 0; c < 4; c++)
+        {
+            sum.value[c] = value[c] + texel.value[c] * weight;
+        }
+        return sum;
+    }
+
+    Texel scale(const Texel& scale, const Texel& bias, float maximum) const
+    {
+        Texel scaled;
+        for (int c = 0; c < 4; c++)
+        {
+            scaled.value[c] = std::clamp(
+              value[c] * scale.value[c] + bias.value[c], 0.0f, maximum);
+        }
+        return scaled;
+    }
+
+    void toIntegers(int* integers) const
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            integers[c] = (int)value[c];
+        }
+    }
+};
+#endif
+
+// source texels a destination texel is filtered from: texel x of the
+// destination covers source texels 2x and 2x + 1, tap i reads 2x + offset + i
+struct Kernel
+{
+    int offset;
+    int size;
+    float weights[8];
+};
+
+// zeroth order modified Bessel function of the first kind
+inline float
+besselI0(float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 20; k++)
+    {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+inline const Kernel&
+getKernel(MipmapFilter filter)
+{
+    static const Kernel box = { 0, 2, { 0.5f, 0.5f } };
+
+    // sinc windowed by Kaiser (alpha 4) over 2 destination texels on each
+    // side of the center, which sits between source texels 2x and 2x + 1
+    static const Kernel kaiser = []
+    {
+        const float PI = 3.14159265f;
+        const float ALPHA = 4.0f;
+        const float WIDTH = 2.0f;
+
+        Kernel kernel = { -3, 8, {} };
+        float sum = 0.0f;
+        for (int i = 0; i < kernel.size; i++)
+        {
+            // distance in destination texels
+            float t = (kernel.offset + i + 0.5f - 1.0f) / 2.0f;
+            float sinc = std::sin(PI * t) / (PI * t);
+            float x = std::max(1.0f - (t / WIDTH) * (t / WIDTH), 0.0f);
+            float window = besselI0(ALPHA * std::sqrt(x)) / besselI0(ALPHA);
+
+            kernel.weights[i] = sinc * window;
+            sum += kernel.weights[i];
+        }
+        for (int i = 0; i < kernel.size; i++)
+        {
+            kernel.weights[i] /= sum;
+        }
+        return kernel;
+    }();
+
+    return filter == MipmapFilter::Kaiser ? kaiser : box;
+}
+
+inline float
+toLinear(float srgb)
+{
+    return srgb <= 0.04045f ? srgb / 12.92f
+                            : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float
+toSRGB(float linear)
+{
+    return linear <= 0.0031308f
+             ? linear * 12.92f
+             : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+// 8 bit values to the working values of an encoding
+inline const float*
+getDecodeTable(MipmapEncoding encoding)
+{
+    static const std::vector<float> tables = []
+    {
+        std::vector<float> values(3 * 256);
+        for (int i = 0; i < 256; i++)
+        {
+            values[(int)MipmapEncoding::Linear * 256 + i] = i / 255.0f;
+            values[(int)MipmapEncoding::SRGB * 256 + i] = toLinear(i / 255.0f);
+            values[(int)MipmapEncoding::Normal * 256 + i] = i / 127.5f - 1.0f;
+        }
+        return values;
+    }();
+    return tables.data() + (int)encoding * 256;
+}
+
+// linear quantized to SRGB_TABLE_SIZE steps to 8 bit sRGB, fine enough for
+// the steep start of the curve to hit every dark value
+constexpr int SRGB_TABLE_SIZE = 16384;
+
+inline const unsigned char*
+getSRGBTable()
+{
+    static const std::vector<unsigned char> table = []
+    {
+        std::vector<unsigned char> values(SRGB_TABLE_SIZE);
+        for (int i = 0; i < SRGB_TABLE_SIZE; i++)
+        {
+            values[i] = (unsigned char)std::lround(
+              toSRGB(i / (float)(SRGB_TABLE_SIZE - 1)) * 255.0f);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+// texels of an 8 bit image to the RGBA working values of the encoding.
+// Images with less than 3 components are gray (+ alpha), alpha defaults to 1
+inline void
+decodeRow(const unsigned char* source,
+          int width,
+          int components,
+          MipmapEncoding encoding,
+          float* destination)
+{
+    const float* color = getDecodeTable(encoding);
+    const float* linear = getDecodeTable(MipmapEncoding::Linear);
+    bool gray = components < 3;
+    bool alpha = components == 2 || components == 4;
+
+    for (int x = 0; x < width; x++)
+    {
+        const unsigned char* texel = source + x * components;
+        float* rgba = destination + x * 4;
+
+        rgba[0] = color[texel[0]];
+        rgba[1] = color[texel[gray ? 0 : 1]];
+        rgba[2] = color[texel[gray ? 0 : 2]];
+        rgba[3] = alpha ? linear[texel[components - 1]] : 1.0f;
+    }
+}
+
+// working values back to 8 bit texels: scaled and rounded to integers in
+// one go, which are the 8 bit values or, for sRGB colors, indices in the
+// sRGB table
+inline void
+encodeRow(const float* source,
+          int width,
+          int components,
+          MipmapEncoding encoding,
+          unsigned char* destination)
+{
+    const unsigned char* srgb = getSRGBTable();
+    bool isSRGB = encoding == MipmapEncoding::SRGB;
+    int colors = components < 3 ? 1 : 3;
+    bool alpha = components == 2 || components == 4;
+
+    float colorScale = isSRGB ? SRGB_TABLE_SIZE - 1 : 255.0f;
+    float colorBias = 0.5f;
+    if (encoding == MipmapEncoding::Normal)
+    {
+        // [-1, 1] to [0, 255]
+        colorScale = 127.5f;
+        colorBias = 128.0f;
+    }
+    Texel scale = Texel::set(colorScale, colorScale, colorScale, 255.0f);
+    Texel bias = Texel::set(colorBias, colorBias, colorBias, 0.5f);
+    float maximum = isSRGB ? SRGB_TABLE_SIZE - 0.5f : 255.5f;
+
+    int integers[4];
+    for (int x = 0; x < width; x++)
+    {
+        Texel::load(source + x * 4)
+          .scale(scale, bias, maximum)
+          .toIntegers(integers);
+        unsigned char* texel = destination + x * components;
+
+        for (int c = 0; c < colors; c++)
+        {
+            texel[c] = isSRGB ? srgb[integers[c]] : (unsigned char)integers[c];
+        }
+        if (alpha)
+            texel[components - 1] = (unsigned char)std::min(integers[3], 255);
+    }
+}
+
+// RGB back to unit length, a filtered normal is shorter
+inline void
+normalizeRow(float* texels, int width)
+{
+    for (int x = 0; x < width; x++)
+    {
+        float* rgba = texels + x * 4;
+        float length = std::sqrt(rgba[0] * rgba[0] + rgba[1] * rgba[1] +
+                                 rgba[2] * rgba[2]);
+        if (length < 1e-6f)
+        {
+            rgba[0] = rgba[1] = 0.0f;
+            rgba[2] = 1.0f;
+            continue;
+        }
+        for (int c = 0; c < 3; c++)
+        {
+            rgba[c] /= length;
+        }
+    }
+}
+
+// filters a row of RGBA texels to half its width
+inline void
+filterRow(const float* source,
+          int width,
+          const Kernel& kernel,
+          float* destination)
+{
+    int destinationWidth = std::max(width / 2, 1);
+
+    for (int x = 0; x < destinationWidth; x++)
+    {
+        int first = 2 * x + kernel.offset;
+        Texel sum = Texel::zero();
+
+        // texels away from the edges read their taps without clamping
+        if (first >= 0 && first + kernel.size <= width)
+        {
+            const float* texel = source + first * 4;
+            for (int i = 0; i < kernel.size; i++)
+            {
+                sum = sum.add(Texel::load(texel + i * 4), kernel.weights[i]);
+            }
+        }
+        else
+        {
+            for (int i = 0; i < kernel.size; i++)
+            {
+                int sourceX = std::clamp(first + i, 0, width - 1);
+                sum = sum.add(Texel::load(source + sourceX * 4),
+                              kernel.weights[i]);
+            }
+        }
+        sum.store(destination + x * 4);
+    }
+}
+
+// filters kernel.size rows of RGBA texels, the ones read by a destination
+// row, into that row
+inline void
+filterColumns(const float* const* rows,
+              int width,
+              const Kernel& kernel,
+              float* destination)
+{
+    for (int x = 0; x < width; x++)
+    {
+        Texel sum = Texel::zero();
+        for (int i = 0; i < kernel.size; i++)
+        {
+            sum = sum.add(Texel::load(rows[i] + x * 4), kernel.weights[i]);
+        }
+        sum.store(destination + x * 4);
+    }
+}
+
+} // namespace Mipmaps
+
+// Levels 1 and down of the mip chain of an 8 bit per channel image (1 to 4
+// components), each resized to its texels.
+//
+// Filtering runs on RGBA floats, a whole texel per SSE register: a
+// horizontal then a vertical pass of the separable filter per level. Every
+// level is filtered from the unrounded previous one, in linear space for
+// sRGB colors, and normals are renormalized at each level.
+//
+// Only the levels below 0 are kept as floats. Source rows are decoded and
+// filtered horizontally as the vertical pass first reads them, into a ring
+// of kernel.size rows.
+inline void
+generateMipmaps(const unsigned char* pixels,
+                int width,
+                int height,
+                int components,
+                const MipmapOptions& options,
+                std::vector<std::vector<unsigned char>>& mipmaps)
+{
+    int levels = getMipLevelCount(width, height);
+    mipmaps.resize(levels - 1);
+    if (levels == 1)
+        return;
+
+    const Mipmaps::Kernel& kernel = Mipmaps::getKernel(options.filter);
+
+    std::vector<float> decodedRow((size_t)width * 4);
+    std::vector<float> level, next, ring;
+
+    for (int i = 1; i < levels; i++)
+    {
+        int nextWidth = std::max(width / 2, 1);
+        int nextHeight = std::max(height / 2, 1);
+        size_t rowSize = (size_t)nextWidth * 4;
+
+        next.resize(rowSize * nextHeight);
+        ring.resize(rowSize * kernel.size);
+        int ringRows[8];
+        std::fill(ringRows, ringRows + kernel.size, -1);
+
+        for (int y = 0; y < nextHeight; y++)
+        {
+            const float* rows[8];
+            for (int tap = 0; tap < kernel.size; tap++)
+            {
+                int sourceY =
+                  std::clamp(2 * y + kernel.offset + tap, 0, height - 1);
+                int slot = sourceY % kernel.size;
+                float* filtered = ring.data() + slot * rowSize;
+
+                if (ringRows[slot] != sourceY)
+                {
+                    const float* row = level.data() + sourceY * width * 4;
+                    if (i == 1)
+                    {
+                        Mipmaps::decodeRow(
+                          pixels + (size_t)sourceY * width * components,
+                          width,
+                          components,
+                          options.encoding,
+                          decodedRow.data());
+                        row = decodedRow.data();
+                    }
+
+                    Mipmaps::filterRow(row, width, kernel, filtered);
+                    ringRows[slot] = sourceY;
+                }
+                rows[tap] = filtered;
+            }
+
+            Mipmaps::filterColumns(
+              rows, nextWidth, kernel, next.data() + y * rowSize);
+        }
+
+        if (options.encoding == MipmapEncoding::Normal)
+            Mipmaps::normalizeRow(next.data(), nextWidth * nextHeight);
+
+        std::vector<unsigned char>& mipmap = mipmaps[i - 1];
+        mipmap.resize((size_t)nextWidth * nextHeight * components);
+        Mipmaps::encodeRow(next.data(),
+                           nextWidth * nextHeight,
+                           components,
+                           options.encoding,
+                           mipmap.data());
+
+        std::swap(level, next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
+
+#endif
@@ -1,256 +1,238 @@
 #ifndef MODEL
 #define MODEL
 
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
-#include <assimp/Importer.hpp>
+#include <unordered_map>
 
-#include "stb_image.h"
+#include "ImageDecoder.h"
+#include "LodSelector.h"
 #include "Mesh.h"
+#include "ModelImporter.h"
+#include "TextureBaker.h"
+#include "TextureCache.h"
+#include "TextureUploader.h"
 
 class Model
 {
   public:
     vector<Mesh> meshes;
-    Model(string path) { loadModel(path); }
-    void Draw(Shader& shader)
+
+    // object space bounds of all meshes
+    BoundingBox bounds;
+    BoundingSphere boundingSphere;
+
+    // imports and uploads the model, blocking until it is done
+    Model(string path, VertexFormat vertexFormat = VertexFormat::Float)
     {
-        for (unsigned int i = 0; i < meshes.size(); i++)
+        ModelData data;
+        ModelImporter::import(path, data);
+
+        std::unordered_map<string, unsigned int> textureIDs =
+          loadTextures(data);
+
+        for (MeshData& mesh : data.meshes)
         {
-            meshes[i].Draw(shader);
+            meshes.push_back(Mesh(mesh.getVertices(),
+                                  mesh.getVertexCount(),
+                                  mesh.getIndices(),
+                                  mesh.getIndexCount(),
+                                  createMaterial(mesh.textures, textureIDs),
+                                  vertexFormat,
+                                  std::move(mesh.lods),
+                                  std::move(mesh.meshlets)));
         }
-    }
 
-  private:
-    string directory;
-    vector<Texture> loaded_textures;
+        computeBounds();
+    }
 
-    void loadModel(string path)
+    // model made of already uploaded meshes, taking over the texture cache
+    // references of their textures
+    explicit Model(vector<Mesh> meshes, vector<unsigned int> textures = {})
+      : meshes(std::move(meshes))
+      , textures(std::move(textures))
     {
-        Assimp::Importer importer;
+        computeBounds();
+    }
 
-        const aiScene* scene =
-          importer.ReadFile(
-              path, 
-              aiProcess_Triangulate | aiProcess_CalcTangentSpace
-          );
+    Model(Model&&) = default;
 
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
-            !scene->mRootNode)
+    ~Model()
+    {
+        for (Mesh& mesh : meshes)
         {
-            cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
-            return;
+            mesh.releaseGeometry();
         }
-        directory = path.substr(0, path.find_last_of('/'));
 
-        processNode(scene->mRootNode, scene);
+        for (unsigned int texture : textures)
+        {
+            TextureCache::shared().release(texture);
+        }
     }
 
-    void processNode(aiNode* node, const aiScene* scene)
+    void Draw(Shader& shader)
     {
-        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        for (unsigned int i = 0; i < meshes.size(); i++)
         {
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            meshes[i].Draw(shader);
         }
+    }
 
-        for (unsigned int i = 0; i < node->mNumChildren; i++)
+    // draws with the object's model matrix, combined with the vertex
+    // transform of each mesh (packed meshes)
+    void Draw(Shader& shader,
+              Uniform<glm::mat4> modelUniform,
+              const glm::mat4& model)
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
         {
-            processNode(node->mChildren[i], scene);
+            meshes[i].Draw(shader, modelUniform, model);
         }
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // same with the level of detail of each mesh picked by lodSelector
+    void Draw(Shader& shader,
+              Uniform<glm::mat4> modelUniform,
+              const glm::mat4& model,
+              const LodSelector& lodSelector)
     {
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
-
-        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        for (unsigned int i = 0; i < meshes.size(); i++)
         {
-            Vertex vertex;
-
-            glm::vec3 vector;
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-
-            vertex.Position = vector;
-
-            vector.x = mesh->mNormals[i].x;
-            vector.y = mesh->mNormals[i].y;
-            vector.z = mesh->mNormals[i].z;
-
-            vertex.Normal = vector;
-
-            vector.x = mesh->mTangents[i].x;
-            vector.y = mesh->mTangents[i].y;
-            vector.z = mesh->mTangents[i].z;
+            meshes[i].Draw(shader,
+                           modelUniform,
+                           model,
+                           lodSelector.select(meshes[i], model));
+        }
+    }
 
-            vertex.Tangent = vector;
+    // material of a mesh given the names of the model's uploaded textures
+    static Material createMaterial(
+      const vector<TextureRef>& textures,
+      const std::unordered_map<string, unsigned int>& textureIDs)
+    {
+        vector<Texture> materialTextures;
+        for (const TextureRef& texture : textures)
+        {
+            materialTextures.push_back(
+              { textureIDs.at(texture.path), texture.type, texture.path });
+        }
 
-            vector.x = mesh->mBitangents[i].x;
-            vector.y = mesh->mBitangents[i].y;
-            vector.z = mesh->mBitangents[i].z;
+        return Material(materialTextures);
+    }
 
-            // change of handedness since assimp uses the opposite
-            vertex.Bitangent = -vector;
+    // loads a texture file, on any thread: its baked block compressed
+    // version when compress is set (TextureUploader::supportsCompression),
+    // otherwise the decoded image with its mip chain filtered for its type
+    static DecodedImage loadTexture(const string& path,
+                                    unsigned int tag,
+                                    const string& type,
+                                    bool compress)
+    {
+        TextureUsage usage = TextureBaker::getUsage(type);
+        if (!compress)
+        {
+            return decodeImage(
+              path, tag, true, TextureBaker::getMipmapOptions(usage));
+        }
 
-            if (mesh->mTextureCoords[0])
-            {
-                glm::vec2 vec;
+        return TextureBaker::load(path, tag, usage);
+    }
 
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
+    // cache key of a texture loaded by loadTexture, the same file can be
+    // used as color (sRGB) by a model and as linear data by another
+    static string getTextureKey(const string& path,
+                                const string& type,
+                                bool compress)
+    {
+        TextureUsage usage = TextureBaker::getUsage(type);
+        return TextureCache::getKey(
+          path,
+          to_string((uint32_t)usage) + (compress ? " baked" : " decoded"));
+    }
 
-                vertex.TexCoords = vec;
-            }
-            else
-            {
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-            }
+  private:
+    // references held on the texture cache
+    vector<unsigned int> textures;
 
-            vertices.push_back(vertex);
+    void computeBounds()
+    {
+        for (const Mesh& mesh : meshes)
+        {
+            bounds.extend(mesh.bounds);
         }
 
-        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        if (!bounds.isEmpty())
         {
-            aiFace face = mesh->mFaces[i];
-            for (unsigned int j = 0; j < face.mNumIndices; j++)
+            boundingSphere.center = bounds.getCenter();
+            boundingSphere.radius = 0.0f;
+            for (const Mesh& mesh : meshes)
             {
-                indices.push_back(face.mIndices[j]);
+                if (mesh.boundingSphere.isEmpty())
+                    continue;
+
+                boundingSphere.radius = std::max(
+                  boundingSphere.radius,
+                  glm::distance(boundingSphere.center,
+                                mesh.boundingSphere.center) +
+                    mesh.boundingSphere.radius);
             }
         }
-
-        if (mesh->mMaterialIndex >= 0)
-        {
-            aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-
-            vector<Texture> diffuseMaps =
-              loadMaterialTextures(material,
-                                   aiTextureType_DIFFUSE,
-                                   "texture_diffuse");
-            textures.insert(textures.end(),
-                            diffuseMaps.begin(),
-                            diffuseMaps.end());
-
-            vector<Texture> specularMaps =
-              loadMaterialTextures(material,
-                                   aiTextureType_SPECULAR,
-                                   "texture_specular");
-            textures.insert(textures.end(),
-                            specularMaps.begin(),
-                            specularMaps.end());
-
-            vector<Texture> normalMaps =
-              loadMaterialTextures(material,
-                                   aiTextureType_NORMALS,
-                                   "texture_normal");
-            textures.insert(textures.end(),
-                            normalMaps.begin(),
-                            normalMaps.end());
-
-            vector<Texture> parallaxMaps =
-              loadMaterialTextures(material,
-                                   aiTextureType_HEIGHT,
-                                   "texture_parallax");
-            textures.insert(textures.end(),
-                            parallaxMaps.begin(),
-                            parallaxMaps.end());
-        }
-
-        return Mesh(vertices, indices, textures);
     }
 
-    vector<Texture> loadMaterialTextures(aiMaterial* mat,
-                                         aiTextureType type,
-                                         string typeName)
+    // takes the model's textures from the texture cache, the ones it did
+    // not hold yet are loaded in parallel (baked block compressed textures,
+    // or decoded with their mip chains) and queued for upload as soon as
+    // they are ready. Returns once every texture is uploaded, including the
+    // ones other loaders were still uploading.
+    std::unordered_map<string, unsigned int> loadTextures(
+      const ModelData& data)
     {
-        vector<Texture> textures;
+        std::unordered_map<string, unsigned int> textureIDs;
 
-        for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        TextureUploader uploader;
+        ImageDecoder decoder;
+        bool compress = TextureUploader::supportsCompression();
+        for (unsigned int i = 0; i < data.texturePaths.size(); i++)
         {
-            aiString path;
-            mat->GetTexture(type, i, &path);
-            bool skip = false;
-
-            for (unsigned int j = 0; j < loaded_textures.size(); j++)
-            {
-                if (std::strcmp(loaded_textures[j].path.data(), path.C_Str()) ==
-                    0)
-                {
-                    textures.push_back(loaded_textures[j]);
-                    skip = true;
-                    break;
-                }
-            }
-            if (!skip)
-            {
-                Texture texture;
+            string path = data.directory + "/" + data.texturePaths[i];
 
-                texture.id = TextureFromFile(path.C_Str(), directory);
-                texture.type = typeName;
-                texture.path = path.C_Str();
+            bool created;
+            unsigned int textureID = TextureCache::shared().acquire(
+              getTextureKey(path, data.textureTypes[i], compress), created);
+            textureIDs[data.texturePaths[i]] = textureID;
+            textures.push_back(textureID);
 
-                textures.push_back(texture);
-                loaded_textures.push_back(texture);
+            if (created)
+            {
+                string type = data.textureTypes[i];
+                decoder.decode(
+                  [path, textureID, type, compress]
+                  { return loadTexture(path, textureID, type, compress); });
             }
         }
 
-        return textures;
-    }
-
-    unsigned int TextureFromFile(const char* localPath, string directory)
-    {
-        string filepath = directory + "/" + localPath;
+        DecodedImage image;
+        while (decoder.next(image))
+        {
+            if (!image.data)
+            {
+                std::cout << "Texture failed to load at path: " << image.path
+                          << std::endl;
+            }
+            if (!image.isCompressed() &&
+                TextureUploader::getFormat(image.components) == GL_NONE)
+                throw std::runtime_error("issue with loading the 3D model");
 
-        unsigned int textureID;
-        glGenTextures(1, &textureID);
+            uploader.enqueue(image.tag, std::move(image));
+            uploader.update();
+        }
 
-        int width, height, nrComponents;
-        unsigned char* data =
-          stbi_load(filepath.c_str(), &width, &height, &nrComponents, 0);
+        uploader.finish();
 
-        if (!data)
+        // textures a streaming loader created may still be in flight
+        for (unsigned int textureID : textures)
         {
-            std::cout << "Texture failed to load at path: " << filepath
-                      << std::endl;
-            stbi_image_free(data);
+            TextureCache::shared().waitUntilReady(textureID);
         }
-
-        GLenum format = GL_RGB;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-        else
-            throw std::runtime_error("issue with loading the 3D model");
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D,
-                     0,
-                     format,
-                     width,
-                     height,
-                     0,
-                     format,
-                     GL_UNSIGNED_BYTE,
-                     data);
-
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D,
-                        GL_TEXTURE_MIN_FILTER,
-                        GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-
-        return textureID;
+        return textureIDs;
     }
 };
 #endif
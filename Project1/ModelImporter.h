@@ -0,0 +1,305 @@
+#ifndef MODEL_IMPORTER_H
+#define MODEL_IMPORTER_H
+
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <assimp/Importer.hpp>
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshletBuilder.h"
+
+// CPU side of a model: its meshes and the textures they reference, nothing
+// is uploaded so it can be produced on a worker thread
+struct ModelData
+{
+    // directory the texture paths are relative to
+    string directory;
+    vector<MeshData> meshes;
+    // every texture referenced by the meshes, once, with the type it is
+    // first referenced as
+    vector<string> texturePaths;
+    vector<string> textureTypes;
+    // mapping the meshes' vertices and indices point into when they were
+    // read from the mesh cache
+    std::unique_ptr<MeshCache> cache;
+};
+
+// Reads a model from its mesh cache or, when the cache is missing or stale,
+// imports it with assimp, optimizes its meshes for the vertex caches and
+// overdraw (MeshOptimizer), splits the ones too large for 16 bit indices,
+// generates their levels of detail (MeshSimplifier), partitions them into
+// meshlets (MeshletBuilder) and writes the cache.
+// Makes no GL calls.
+class ModelImporter
+{
+  public:
+    static const unsigned int IMPORT_FLAGS =
+      aiProcess_Triangulate | aiProcess_JoinIdenticalVertices |
+      aiProcess_CalcTangentSpace;
+
+    // meshes with more vertices are split so that every part can use 16
+    // bit indices, 0 keeps them whole
+    static const unsigned int MAX_MESH_VERTICES = 65536;
+
+    static bool import(const string& path, ModelData& data)
+    {
+        data = ModelData();
+        data.directory = path.substr(0, path.find_last_of('/'));
+
+        if (!loadFromCache(path, data))
+        {
+            Assimp::Importer importer;
+
+            const aiScene* scene = importer.ReadFile(path, IMPORT_FLAGS);
+
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
+                !scene->mRootNode)
+            {
+                cout << "ERROR::ASSIMP::" << importer.GetErrorString()
+                     << endl;
+                return false;
+            }
+
+            processNode(scene->mRootNode, scene, data);
+            optimizeMeshes(path, data);
+            generateLods(path, data);
+            buildMeshlets(path, data);
+
+            MeshCache::write(
+              path, IMPORT_FLAGS, MAX_MESH_VERTICES, data.meshes);
+        }
+
+        std::unordered_set<string> seen;
+        for (const MeshData& mesh : data.meshes)
+        {
+            for (const TextureRef& texture : mesh.textures)
+            {
+                if (seen.insert(texture.path).second)
+                {
+                    data.texturePaths.push_back(texture.path);
+                    data.textureTypes.push_back(texture.type);
+                }
+            }
+        }
+
+        return true;
+    }
+
+  private:
+    static void optimizeMeshes(const string& path, ModelData& data)
+    {
+        VertexCacheStats before, after;
+        vector<MeshData> meshes;
+        for (MeshData& mesh : data.meshes)
+        {
+            VertexCacheStats meshBefore, meshAfter;
+            MeshOptimizer::optimize(mesh, meshBefore, meshAfter);
+            before += meshBefore;
+            after += meshAfter;
+
+            MeshOptimizer::split(mesh, MAX_MESH_VERTICES, meshes);
+        }
+
+        cout << "MESH_OPTIMIZER::" << path << " ACMR " << before.getACMR()
+             << " -> " << after.getACMR() << ", ATVR " << before.getATVR()
+             << " -> " << after.getATVR() << ", " << data.meshes.size()
+             << " meshes -> " << meshes.size() << endl;
+
+        data.meshes = std::move(meshes);
+    }
+
+    static void generateLods(const string& path, ModelData& data)
+    {
+        size_t triangles = 0, lodTriangles = 0;
+        unsigned int levels = 0;
+        for (MeshData& mesh : data.meshes)
+        {
+            MeshSimplifier::generateLods(mesh);
+
+            triangles += mesh.lods.front().indexCount / 3;
+            lodTriangles += mesh.lods.back().indexCount / 3;
+            levels = std::max(levels, (unsigned int)mesh.lods.size());
+        }
+
+        cout << "MESH_SIMPLIFIER::" << path << " " << levels
+             << " levels of detail, " << triangles << " -> " << lodTriangles
+             << " triangles" << endl;
+    }
+
+    static void buildMeshlets(const string& path, ModelData& data)
+    {
+        size_t meshlets = 0;
+        for (MeshData& mesh : data.meshes)
+        {
+            MeshletBuilder::build(mesh);
+            meshlets += mesh.meshlets.size();
+        }
+
+        cout << "MESHLET_BUILDER::" << path << " " << meshlets << " meshlets"
+             << endl;
+    }
+
+    // the vertices and indices are left in the mapped cache, which data
+    // keeps open
+    static bool loadFromCache(const string& path, ModelData& data)
+    {
+        auto cache = std::make_unique<MeshCache>();
+        if (!cache->open(path, IMPORT_FLAGS, MAX_MESH_VERTICES))
+            return false;
+
+        for (const CachedMesh& cachedMesh : cache->getMeshes())
+        {
+            MeshData mesh;
+            mesh.mappedVertices = cachedMesh.vertices;
+            mesh.mappedVertexCount = cachedMesh.vertexCount;
+            mesh.mappedIndices = cachedMesh.indices;
+            mesh.mappedIndexCount = cachedMesh.indexCount;
+            mesh.textures = cachedMesh.textures;
+            mesh.lods = cachedMesh.lods;
+            mesh.meshlets = cachedMesh.meshlets;
+
+            data.meshes.push_back(std::move(mesh));
+        }
+
+        data.cache = std::move(cache);
+        return true;
+    }
+
+    static void processNode(aiNode* node, const aiScene* scene, ModelData& data)
+    {
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            data.meshes.push_back(processMesh(mesh, scene));
+        }
+
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene, data);
+        }
+    }
+
+    static MeshData processMesh(aiMesh* mesh, const aiScene* scene)
+    {
+        MeshData data;
+
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            Vertex vertex;
+
+            glm::vec3 vector;
+            vector.x = mesh->mVertices[i].x;
+            vector.y = mesh->mVertices[i].y;
+            vector.z = mesh->mVertices[i].z;
+
+            vertex.Position = vector;
+
+            vector.x = mesh->mNormals[i].x;
+            vector.y = mesh->mNormals[i].y;
+            vector.z = mesh->mNormals[i].z;
+
+            vertex.Normal = vector;
+
+            vector.x = mesh->mTangents[i].x;
+            vector.y = mesh->mTangents[i].y;
+            vector.z = mesh->mTangents[i].z;
+
+            vertex.Tangent = vector;
+
+            vector.x = mesh->mBitangents[i].x;
+            vector.y = mesh->mBitangents[i].y;
+            vector.z = mesh->mBitangents[i].z;
+
+            // change of handedness since assimp uses the opposite
+            vertex.Bitangent = -vector;
+
+            if (mesh->mTextureCoords[0])
+            {
+                glm::vec2 vec;
+
+                vec.x = mesh->mTextureCoords[0][i].x;
+                vec.y = mesh->mTextureCoords[0][i].y;
+
+                vertex.TexCoords = vec;
+            }
+            else
+            {
+                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            }
+
+            data.vertices.push_back(vertex);
+        }
+
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        {
+            aiFace face = mesh->mFaces[i];
+            for (unsigned int j = 0; j < face.mNumIndices; j++)
+            {
+                data.indices.push_back(face.mIndices[j]);
+            }
+        }
+
+        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+
+        vector<TextureRef> diffuseMaps =
+          loadMaterialTextures(material,
+                               aiTextureType_DIFFUSE,
+                               "texture_diffuse");
+        data.textures.insert(data.textures.end(),
+                             diffuseMaps.begin(),
+                             diffuseMaps.end());
+
+        vector<TextureRef> specularMaps =
+          loadMaterialTextures(material,
+                               aiTextureType_SPECULAR,
+                               "texture_specular");
+        data.textures.insert(data.textures.end(),
+                             specularMaps.begin(),
+                             specularMaps.end());
+
+        vector<TextureRef> normalMaps =
+          loadMaterialTextures(material,
+                               aiTextureType_NORMALS,
+                               "texture_normal");
+        data.textures.insert(data.textures.end(),
+                             normalMaps.begin(),
+                             normalMaps.end());
+
+        vector<TextureRef> parallaxMaps =
+          loadMaterialTextures(material,
+                               aiTextureType_HEIGHT,
+                               "texture_parallax");
+        data.textures.insert(data.textures.end(),
+                             parallaxMaps.begin(),
+                             parallaxMaps.end());
+
+        return data;
+    }
+
+    static vector<TextureRef> loadMaterialTextures(aiMaterial* mat,
+                                                   aiTextureType type,
+                                                   string typeName)
+    {
+        vector<TextureRef> textures;
+
+        for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        {
+            aiString path;
+            mat->GetTexture(type, i, &path);
+
+            textures.push_back({ typeName, path.C_Str() });
+        }
+
+        return textures;
+    }
+};
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef MODEL_STREAMER_H
+#define MODEL_STREAMER_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "GLState.h"
+#include "ImageDecoder.h"
+#include "Model.h"
+#include "ModelImporter.h"
+#include "TextureCache.h"
+#include "TextureUploader.h"
+#include "ThreadPool.h"
+
+// upload work done by the streamer during a frame
+struct ModelStreamStats
+{
+    unsigned int pendingModels = 0;
+    unsigned int residentModels = 0;
+    size_t uploadedBytes = 0;
+};
+
+// Handle to a model loaded by the ModelStreamer. Until its data is resident
+// on the GPU, get() returns the streamer's placeholder so the model can be
+// drawn, culled and cast shadows like any other from the first frame.
+class StreamedModel
+{
+  public:
+    bool isResident() const { return model != nullptr; }
+
+    Model& get() { return model ? *model : *placeholder; }
+
+  private:
+    friend class ModelStreamer;
+
+    string path;
+    Model* placeholder = NULL;
+    std::unique_ptr<Model> model;
+
+    // written by the workers, read by the GL thread once imported is set
+    std::mutex mutex;
+    bool imported = false;
+    bool failed = false;
+    ModelData data;
+    vector<DecodedImage> images;
+    vector<bool> decoded;
+
+    // GL thread upload progress
+    std::unordered_map<string, unsigned int> textureIDs;
+    // texture cache references, handed to the model once resident
+    vector<unsigned int> textures;
+    vector<bool> enqueuedTextures;
+    vector<Mesh> meshes;
+};
+
+// Loads models in the background without stalling frames.
+//
+// load() returns at once. The mesh import (mesh cache or assimp) runs as a
+// job on the shared thread pool, then each texture that is not in the
+// TextureCache yet is loaded (baked or decoded) by a job of its own. The GL
+// thread calls update() once per frame, which uploads finished work within a
+// byte budget: whole meshes, then texture slices through the
+// TextureUploader. A model is only swapped in once everything is uploaded.
+class ModelStreamer
+{
+  public:
+    ModelStreamStats lastFrameStats;
+
+    // meshes (and the placeholder) are uploaded in vertexFormat
+    explicit ModelStreamer(VertexFormat vertexFormat = VertexFormat::Float,
+                           size_t bytesPerFrame = 4 * 1024 * 1024)
+      : vertexFormat(vertexFormat)
+      , bytesPerFrame(bytesPerFrame)
+    {
+        createPlaceholder();
+        TextureCache::shared().addLoader(this, [this] { updateTextures(); });
+    }
+
+    ~ModelStreamer() { TextureCache::shared().removeLoader(this); }
+
+    ModelStreamer(const ModelStreamer&) = delete;
+    ModelStreamer& operator=(const ModelStreamer&) = delete;
+
+    std::shared_ptr<StreamedModel> load(const string& path)
+    {
+        auto stream = std::make_shared<StreamedModel>();
+        stream->path = path;
+        stream->placeholder = placeholder.get();
+        pending.push_back(stream);
+
+        ThreadPool::shared().submit(
+          [stream]
+          {
+              bool imported = ModelImporter::import(stream->path, stream->data);
+
+              std::lock_guard<std::mutex> lock(stream->mutex);
+              stream->failed = !imported;
+              stream->imported = true;
+          });
+
+        return stream;
+    }
+
+    // uploads within the frame budget, returns how many models became
+    // resident (their meshes changed, e.g. cached shadows are stale)
+    unsigned int update() { return update(bytesPerFrame); }
+
+    // blocks until every model loaded so far is resident
+    void finish()
+    {
+        while (!pending.empty())
+        {
+            update(SIZE_MAX);
+            if (!pending.empty())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+  private:
+    VertexFormat vertexFormat;
+    size_t bytesPerFrame;
+    TextureUploader uploader;
+
+    std::unique_ptr<Model> placeholder;
+    vector<std::shared_ptr<StreamedModel>> pending;
+
+    unsigned int update(size_t budget)
+    {
+        ModelStreamStats stats;
+        size_t remaining = budget;
+
+        for (const std::shared_ptr<StreamedModel>& stream : pending)
+        {
+            acquireTextures(stream);
+            uploadMeshes(*stream, remaining);
+            enqueueTextures(*stream);
+        }
+
+        remaining -= uploader.update(remaining);
+
+        for (size_t i = 0; i < pending.size();)
+        {
+            StreamedModel& stream = *pending[i];
+
+            if (!isComplete(stream))
+            {
+                i++;
+                continue;
+            }
+
+            if (!stream.failed)
+            {
+                stream.model = std::make_unique<Model>(
+                  std::move(stream.meshes), std::move(stream.textures));
+                stats.residentModels++;
+            }
+            // frees the imported meshes, or unmaps their mesh cache
+            {
+                std::lock_guard<std::mutex> lock(stream.mutex);
+                stream.data = ModelData();
+            }
+            pending.erase(pending.begin() + i);
+        }
+
+        stats.pendingModels = (unsigned int)pending.size();
+        stats.uploadedBytes = budget - remaining;
+        lastFrameStats = stats;
+
+        return stats.residentModels;
+    }
+
+    // uploads every texture decoded so far, without touching the meshes or
+    // the models. Called by the TextureCache while a blocking load waits for
+    // a texture this streamer created.
+    void updateTextures()
+    {
+        for (const std::shared_ptr<StreamedModel>& stream : pending)
+        {
+            acquireTextures(stream);
+            enqueueTextures(*stream);
+        }
+
+        uploader.update(SIZE_MAX);
+    }
+
+    // once the model is imported, takes its textures from the cache and
+    // decodes the ones the cache did not hold yet. Textures already in the
+    // cache count as enqueued, isComplete() still waits for their upload if
+    // another model started it.
+    void acquireTextures(const std::shared_ptr<StreamedModel>& stream)
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (!stream->imported || stream->failed ||
+            stream->textures.size() == stream->data.texturePaths.size())
+            return;
+
+        const ModelData& data = stream->data;
+        size_t textureCount = data.texturePaths.size();
+        bool compress = TextureUploader::supportsCompression();
+        stream->images.resize(textureCount);
+        stream->decoded.assign(textureCount, false);
+        stream->enqueuedTextures.assign(textureCount, false);
+
+        for (unsigned int i = 0; i < textureCount; i++)
+        {
+            string path = data.directory + "/" + data.texturePaths[i];
+
+            bool created;
+            unsigned int textureID = TextureCache::shared().acquire(
+              Model::getTextureKey(path, data.textureTypes[i], compress),
+              created);
+            stream->textureIDs[data.texturePaths[i]] = textureID;
+            stream->textures.push_back(textureID);
+
+            if (!created)
+            {
+                stream->enqueuedTextures[i] = true;
+                continue;
+            }
+
+            string type = data.textureTypes[i];
+            ThreadPool::shared().submit(
+              [stream, path, i, type, compress]
+              {
+                  DecodedImage image =
+                    Model::loadTexture(path, i, type, compress);
+
+                  std::lock_guard<std::mutex> lock(stream->mutex);
+                  stream->images[i] = std::move(image);
+                  stream->decoded[i] = true;
+              });
+        }
+    }
+
+    // uploads whole meshes of an imported model while the budget allows
+    void uploadMeshes(StreamedModel& stream, size_t& remaining)
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (!stream.imported || stream.failed)
+            return;
+
+        ModelData& data = stream.data;
+
+        while (stream.meshes.size() < data.meshes.size() && remaining > 0)
+        {
+            MeshData& mesh = data.meshes[stream.meshes.size()];
+            size_t bytes =
+              mesh.getVertexCount() * Mesh::getVertexSize(vertexFormat) +
+              mesh.getIndexCount() *
+                Mesh::getIndexSize(Mesh::getIndexType(mesh.getVertexCount()));
+
+            stream.meshes.push_back(
+              Mesh(mesh.getVertices(),
+                   mesh.getVertexCount(),
+                   mesh.getIndices(),
+                   mesh.getIndexCount(),
+                   Model::createMaterial(mesh.textures, stream.textureIDs),
+                   vertexFormat,
+                   std::move(mesh.lods),
+                   std::move(mesh.meshlets)));
+            remaining -= std::min(bytes, remaining);
+        }
+    }
+
+    // hands the textures decoded since the last frame to the uploader
+    void enqueueTextures(StreamedModel& stream)
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+
+        for (size_t i = 0; i < stream.enqueuedTextures.size(); i++)
+        {
+            if (stream.enqueuedTextures[i] || !stream.decoded[i])
+                continue;
+
+            uploader.enqueue(
+              stream.textureIDs[stream.data.texturePaths[i]],
+              std::move(stream.images[i]));
+            stream.enqueuedTextures[i] = true;
+        }
+    }
+
+    // every mesh and texture level uploaded, or the import failed
+    bool isComplete(StreamedModel& stream)
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        if (!stream.imported)
+            return false;
+        if (stream.failed)
+            return true;
+
+        if (stream.meshes.size() < stream.data.meshes.size())
+            return false;
+
+        // textures another model created may not even be enqueued yet, the
+        // cache knows when their upload is done
+        for (unsigned int textureID : stream.textures)
+        {
+            if (!TextureCache::shared().isReady(textureID))
+                return false;
+        }
+
+        return true;
+    }
+
+    // unit cube with flat 1x1 textures, drawn in place of models that are
+    // still streaming
+    void createPlaceholder()
+    {
+        MeshData cube;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (float sign : { 1.0f, -1.0f })
+            {
+                glm::vec3 normal(0.0f);
+                normal[axis] = sign;
+                glm::vec3 tangent(0.0f);
+                tangent[(axis + 1) % 3] = sign;
+                glm::vec3 bitangent = glm::cross(normal, tangent);
+
+                unsigned int first = (unsigned int)cube.vertices.size();
+                const glm::vec2 corners[4] = { { 0.0f, 0.0f },
+                                               { 1.0f, 0.0f },
+                                               { 1.0f, 1.0f },
+                                               { 0.0f, 1.0f } };
+
+                for (const glm::vec2& corner : corners)
+                {
+                    Vertex vertex;
+                    vertex.Position = normal * 0.5f +
+                                      tangent * (corner.x - 0.5f) +
+                                      bitangent * (corner.y - 0.5f);
+                    vertex.Normal = normal;
+                    vertex.Tangent = tangent;
+                    // same handedness as the imported meshes
+                    vertex.Bitangent = -bitangent;
+                    vertex.TexCoords = corner;
+                    cube.vertices.push_back(vertex);
+                }
+
+                for (unsigned int index : { 0, 1, 2, 0, 2, 3 })
+                {
+                    cube.indices.push_back(first + index);
+                }
+            }
+        }
+
+        const unsigned char colors[Material::TYPE_COUNT][3] = {
+            { 128, 128, 128 }, // diffuse
+            { 0, 0, 0 },       // specular
+            { 128, 128, 255 }, // flat normal
+            { 0, 0, 0 }        // no parallax depth
+        };
+        const char* types[Material::TYPE_COUNT] = { "texture_diffuse",
+                                                    "texture_specular",
+                                                    "texture_normal",
+                                                    "texture_parallax" };
+
+        vector<Texture> textures;
+        for (int i = 0; i < Material::TYPE_COUNT; i++)
+        {
+            Texture texture;
+            glGenTextures(1, &texture.id);
+            texture.type = types[i];
+            texture.path = "placeholder";
+
+            GLState::bindTexture(0, GL_TEXTURE_2D, texture.id);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D,
+                         0,
+                         GL_RGB,
+                         1,
+                         1,
+                         0,
+                         GL_RGB,
+                         GL_UNSIGNED_BYTE,
+                         colors[i]);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+            textures.push_back(texture);
+        }
+
+        vector<Mesh> meshes;
+        meshes.push_back(Mesh(
+          cube.vertices, cube.indices, Material(textures), vertexFormat));
+        placeholder = std::make_unique<Model>(std::move(meshes));
+    }
+};
+
+#endif
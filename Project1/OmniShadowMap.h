@@ -0,0 +1,313 @@
+#ifndef OMNI_SHADOW_MAP_H
+#define OMNI_SHADOW_MAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "BoundingBox.h"
+#include "Frustum.h"
+#include "GLState.h"
+
+// a model drawn into the shadow map: its model matrix and object space bounds
+struct ShadowCaster
+{
+    glm::mat4 model;
+    BoundingBox bounds;
+};
+
+struct OmniShadowStats
+{
+    unsigned int redrawnFaces = 0;
+    unsigned int castersInRange = 0;
+    // casters rasterized to each redrawn face, summed over the faces
+    unsigned int faceDraws = 0;
+    unsigned int redraws = 0;
+};
+
+#define OMNI_SHADOW_ALL_FACES 0x3F
+
+// Depth cubemap of a point light that is only re-rendered when it is stale.
+//
+// Every frame update() is given the light position, its shadow range (the
+// far plane) and the shadow casters. Each caster's world bounds are tested
+// against the light's range and the six 90 degree face frusta, giving the
+// mask of faces it can be rasterized to. Per face the cache records the
+// transforms of the casters touching it, and only the faces whose casters
+// changed are redrawn (all of them when the light moved or its range
+// changed). The geometry shader only emits to the faces set in faceMask.
+class OmniShadowMap
+{
+  public:
+    OmniShadowStats lastFrameStats;
+
+    OmniShadowMap(unsigned int resolution, float nearPlane)
+      : resolution(resolution)
+      , nearPlane(nearPlane)
+    {
+        glGenFramebuffers(1, &FBO);
+
+        glGenTextures(1, &textureID);
+        GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                         0,
+                         GL_DEPTH_COMPONENT,
+                         resolution,
+                         resolution,
+                         0,
+                         GL_DEPTH_COMPONENT,
+                         GL_FLOAT,
+                         NULL);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP,
+                        GL_TEXTURE_WRAP_S,
+                        GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP,
+                        GL_TEXTURE_WRAP_T,
+                        GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP,
+                        GL_TEXTURE_WRAP_R,
+                        GL_CLAMP_TO_EDGE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureID, 0);
+
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        // clearing a layered attachment clears every face, a single face is
+        // cleared through its own framebuffer
+        glGenFramebuffers(6, faceFBOs);
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, faceFBOs[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER,
+                                   GL_DEPTH_ATTACHMENT,
+                                   GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                                   textureID,
+                                   0);
+
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // compares the light and casters against the ones the cubemap was drawn
+    // with, returns true when at least one face has to be redrawn this frame
+    bool update(const glm::vec3& lightPos,
+                float farPlane,
+                const vector<ShadowCaster>& casters)
+    {
+        staleFaces = 0;
+        if (dirty || lightPos != cachedLightPos || farPlane != cachedFarPlane)
+        {
+            staleFaces = OMNI_SHADOW_ALL_FACES;
+            cachedLightPos = lightPos;
+            cachedFarPlane = farPlane;
+
+            computeShadowTransforms();
+        }
+
+        casterFaces.assign(casters.size(), 0);
+        for (auto& faceCasters : currentCasters)
+        {
+            faceCasters.clear();
+        }
+
+        lastFrameStats.castersInRange = 0;
+
+        for (size_t i = 0; i < casters.size(); i++)
+        {
+            BoundingBox worldBounds =
+              casters[i].bounds.transformed(casters[i].model);
+
+            if (!worldBounds.intersectsSphere(lightPos, farPlane))
+                continue;
+
+            lastFrameStats.castersInRange++;
+
+            for (int face = 0; face < 6; face++)
+            {
+                if (faceFrusta[face].intersects(worldBounds))
+                {
+                    casterFaces[i] |= 1 << face;
+                    currentCasters[face].push_back({ i, casters[i].model });
+                }
+            }
+        }
+
+        for (int face = 0; face < 6; face++)
+        {
+            if (!sameCasters(currentCasters[face], cachedCasters[face]))
+            {
+                staleFaces |= 1 << face;
+                cachedCasters[face].swap(currentCasters[face]);
+            }
+        }
+
+        lastFrameStats.redrawnFaces = 0;
+        lastFrameStats.faceDraws = 0;
+        for (int face = 0; face < 6; face++)
+        {
+            if (staleFaces & (1 << face))
+            {
+                lastFrameStats.redrawnFaces++;
+                lastFrameStats.faceDraws +=
+                  (unsigned int)cachedCasters[face].size();
+            }
+        }
+
+        dirty = staleFaces != 0;
+        return dirty;
+    }
+
+    // forces a full redraw on the next update, e.g. after a caster's mesh
+    // changed
+    void invalidate() { dirty = true; }
+
+    // faces the caster at this index of the last update() has to be drawn to
+    // during this frame's redraw, 0 when it can be skipped
+    unsigned int getFaceMask(size_t casterIndex) const
+    {
+        if (casterIndex >= casterFaces.size())
+            return 0;
+
+        return casterFaces[casterIndex] & staleFaces;
+    }
+
+    // clears the stale faces and binds the layered framebuffer
+    void beginRender()
+    {
+        glViewport(0, 0, resolution, resolution);
+
+        for (int face = 0; face < 6; face++)
+        {
+            if (staleFaces & (1 << face))
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, faceFBOs[face]);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    }
+
+    void endRender()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        dirty = false;
+        staleFaces = 0;
+        lastFrameStats.redraws++;
+    }
+
+    void bindTexture(unsigned int unit) const
+    {
+        GLState::bindTexture(unit, GL_TEXTURE_CUBE_MAP, textureID);
+    }
+
+    const glm::mat4* getShadowTransforms() const { return shadowTransforms; }
+    // world space frusta of the six faces, in face order
+    const Frustum* getFaceFrusta() const { return faceFrusta; }
+    float getFarPlane() const { return cachedFarPlane; }
+    const glm::vec3& getLightPos() const { return cachedLightPos; }
+    unsigned int getResolution() const { return resolution; }
+
+  private:
+    struct CasterState
+    {
+        size_t index;
+        glm::mat4 model;
+    };
+
+    unsigned int FBO, textureID;
+    unsigned int faceFBOs[6];
+    unsigned int resolution;
+    float nearPlane;
+
+    bool dirty = true;
+    glm::vec3 cachedLightPos = glm::vec3(0.0f);
+    float cachedFarPlane = 0.0f;
+    unsigned int staleFaces = 0;
+
+    vector<CasterState> cachedCasters[6];
+    vector<CasterState> currentCasters[6];
+    vector<uint8_t> casterFaces;
+
+    glm::mat4 shadowTransforms[6];
+    Frustum faceFrusta[6];
+
+    // bitwise comparison, a static caster recomputes the exact same matrix
+    // every frame
+    static bool sameCasters(const vector<CasterState>& a,
+                            const vector<CasterState>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            if (a[i].index != b[i].index ||
+                std::memcmp(&a[i].model, &b[i].model, sizeof(glm::mat4)) != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void computeShadowTransforms()
+    {
+        const glm::vec3& lightPos = cachedLightPos;
+        glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f),
+                                                1.0f,
+                                                nearPlane,
+                                                cachedFarPlane);
+
+        shadowTransforms[0] =
+          shadowProj * glm::lookAt(lightPos,
+                                   lightPos + glm::vec3(1.0, 0.0, 0.0),
+                                   glm::vec3(0.0, -1.0, 0.0));
+        shadowTransforms[1] =
+          shadowProj * glm::lookAt(lightPos,
+                                   lightPos + glm::vec3(-1.0, 0.0, 0.0),
+                                   glm::vec3(0.0, -1.0, 0.0));
+
+        shadowTransforms[2] =
+          shadowProj * glm::lookAt(lightPos,
+                                   lightPos + glm::vec3(0.0, 1.0, 0.0),
+                                   glm::vec3(0.0, 0.0, 1.0));
+        shadowTransforms[3] =
+          shadowProj * glm::lookAt(lightPos,
+                                   lightPos + glm::vec3(0.0, -1.0, 0.0),
+                                   glm::vec3(0.0, 0.0, -1.0));
+
+        shadowTransforms[4] =
+          shadowProj * glm::lookAt(lightPos,
+                                   lightPos + glm::vec3(0.0, 0.0, 1.0),
+                                   glm::vec3(0.0, -1.0, 0.0));
+        shadowTransforms[5] =
+          shadowProj * glm::lookAt(lightPos,
+                                   lightPos + glm::vec3(0.0, 0.0, -1.0),
+                                   glm::vec3(0.0, -1.0, 0.0));
+
+        for (int face = 0; face < 6; face++)
+        {
+            faceFrusta[face] = Frustum(shadowTransforms[face]);
+        }
+    }
+};
+
+#endif
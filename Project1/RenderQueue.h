@@ -0,0 +1,326 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+#include "Shader.h"
+
+enum RenderPass
+{
+    RENDER_PASS_OPAQUE = 0,
+    RENDER_PASS_TRANSPARENT = 1
+};
+
+struct RenderQueueStats
+{
+    unsigned int draws = 0;
+    unsigned int drawCalls = 0;
+    bool indirect = false;
+};
+
+struct DrawCommand
+{
+    Shader* shader;
+    Uniform<glm::mat4> modelUniform;
+    glm::mat4 model;
+    Mesh* mesh;
+    unsigned int lod;
+    // index of the command's DrawRanges in the queue, NO_RANGES to draw the
+    // whole lod
+    uint32_t ranges;
+};
+
+// Draws submitted during a frame, sorted by a 64-bit key before being
+// executed so that draws sharing a shader, then material, then vertex array
+// are adjacent and GLState can skip the redundant binds between them.
+//
+// key layout (most significant first)
+//   63..60 pass
+//   59..48 shader program
+//   47..32 material
+//   31..21 vertex array
+//   20     32 bit indices, so that indirect runs are not split by index type
+//   19..0  depth, front to back (back to front for transparent draws)
+//
+// GL object names are truncated to their field, two objects landing on the
+// same value only cost state changes, never correctness.
+//
+// On GL 4.3 contexts the queue can be indirect: the sorted draws are packed
+// into one buffer of DrawElementsIndirectCommand and their model matrices
+// into a shader storage buffer (binding DRAW_DATA_BINDING), uploaded once,
+// and every run of draws sharing a shader, material, vertex array and index
+// type is issued by a single glMultiDrawElementsIndirect. The shaders then
+// read their model matrix at the draw index attribute instead of the model
+// uniform (VertexShader...PackedIndirect.glsl). Textures are still bound
+// per material, there are no bindless textures to index by material.
+class RenderQueue
+{
+  public:
+    static constexpr uint32_t NO_RANGES = UINT32_MAX;
+    static constexpr unsigned int DRAW_DATA_BINDING = 0;
+
+    // draw calls issued by the last execute()
+    RenderQueueStats lastStats;
+
+    explicit RenderQueue(bool indirect = false)
+      : indirect(indirect)
+    {
+    }
+
+    static bool supportsIndirect() { return GLAD_GL_VERSION_4_3 != 0; }
+
+    bool isIndirect() const { return indirect; }
+
+    // empties the queue for the next frame, the range lists are kept to be
+    // reused without allocating
+    void clear()
+    {
+        commands.clear();
+        keys.clear();
+        order.clear();
+        rangeCount = 0;
+    }
+
+    // depth is the view space depth of the draw normalized to [0, 1].
+    // ranges, when given, are copied and drawn instead of the lod (see
+    // MeshletCuller).
+    void submit(RenderPass pass,
+                Shader& shader,
+                Uniform<glm::mat4> modelUniform,
+                Mesh& mesh,
+                const glm::mat4& model,
+                float depth,
+                unsigned int lod = 0,
+                const DrawRanges* ranges = nullptr)
+    {
+        depth = std::clamp(depth, 0.0f, 1.0f);
+        if (pass == RENDER_PASS_TRANSPARENT)
+            depth = 1.0f - depth;
+
+        uint64_t key = (uint64_t)(pass & 0xF) << 60 |
+                       (uint64_t)(shader.ID & 0xFFF) << 48 |
+                       (uint64_t)mesh.material.getSortKey() << 32 |
+                       (uint64_t)(mesh.VAO & 0x7FF) << 21 |
+                       (uint64_t)(mesh.indexType == GL_UNSIGNED_INT) << 20 |
+                       (uint64_t)(depth * 0xFFFFF);
+
+        uint32_t rangeIndex = NO_RANGES;
+        if (ranges)
+        {
+            if (rangeCount == rangeLists.size())
+                rangeLists.emplace_back();
+
+            rangeLists[rangeCount].counts.assign(ranges->counts.begin(),
+                                                 ranges->counts.end());
+            rangeLists[rangeCount].offsets.assign(ranges->offsets.begin(),
+                                                  ranges->offsets.end());
+            rangeIndex = (uint32_t)rangeCount++;
+        }
+
+        keys.push_back(key);
+        commands.push_back(
+          { &shader, modelUniform, model, &mesh, lod, rangeIndex });
+    }
+
+    size_t size() const { return commands.size(); }
+
+    void sort()
+    {
+        size_t count = commands.size();
+
+        order.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            order[i] = (uint32_t)i;
+        }
+
+        sortedKeys.assign(keys.begin(), keys.begin() + count);
+        scratchKeys.resize(count);
+        scratchOrder.resize(count);
+
+        if (count == 0)
+            return;
+
+        // least significant digit radix sort, 8 bits per pass, skipping the
+        // passes where every key has the same digit
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[257] = {};
+            for (size_t i = 0; i < count; i++)
+            {
+                histogram[((sortedKeys[i] >> shift) & 0xFF) + 1]++;
+            }
+
+            if (histogram[((sortedKeys[0] >> shift) & 0xFF) + 1] == count)
+                continue;
+
+            for (int digit = 0; digit < 256; digit++)
+            {
+                histogram[digit + 1] += histogram[digit];
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t destination =
+                  histogram[(sortedKeys[i] >> shift) & 0xFF]++;
+                scratchKeys[destination] = sortedKeys[i];
+                scratchOrder[destination] = order[i];
+            }
+
+            sortedKeys.swap(scratchKeys);
+            order.swap(scratchOrder);
+        }
+    }
+
+    // issues the draws in key order, sort() first
+    void execute()
+    {
+        lastStats = RenderQueueStats();
+        lastStats.draws = (unsigned int)commands.size();
+        lastStats.indirect = indirect;
+
+        if (indirect)
+        {
+            executeIndirect();
+            return;
+        }
+
+        lastStats.drawCalls = (unsigned int)commands.size();
+        for (uint32_t index : order)
+        {
+            DrawCommand& command = commands[index];
+
+            command.shader->use();
+            if (command.ranges != NO_RANGES)
+            {
+                command.mesh->Draw(*command.shader,
+                                   command.modelUniform,
+                                   command.model,
+                                   rangeLists[command.ranges]);
+                continue;
+            }
+
+            command.mesh->Draw(*command.shader,
+                               command.modelUniform,
+                               command.model,
+                               command.lod);
+        }
+    }
+
+  private:
+    // run of sorted commands drawn by one glMultiDrawElementsIndirect
+    struct IndirectBatch
+    {
+        const DrawCommand* command;
+        size_t firstDraw;
+        size_t drawCount;
+    };
+
+    bool indirect;
+
+    std::vector<DrawCommand> commands;
+    std::vector<uint64_t> keys;
+
+    // ranges of the commands drawing meshlets, only the first rangeCount
+    // are in use this frame
+    std::vector<DrawRanges> rangeLists;
+    size_t rangeCount = 0;
+
+    unsigned int indirectBuffer = 0;
+    unsigned int drawDataBuffer = 0;
+    std::vector<DrawElementsIndirectCommand> indirectCommands;
+    std::vector<glm::mat4> drawData;
+    std::vector<IndirectBatch> batches;
+
+    static bool canBatch(const DrawCommand& a, const DrawCommand& b)
+    {
+        return a.shader == b.shader && a.mesh->VAO == b.mesh->VAO &&
+               a.mesh->indexType == b.mesh->indexType &&
+               a.mesh->material.bindsSameTextures(b.mesh->material);
+    }
+
+    void executeIndirect()
+    {
+        indirectCommands.clear();
+        drawData.clear();
+        batches.clear();
+
+        for (uint32_t index : order)
+        {
+            const DrawCommand& command = commands[index];
+
+            if (batches.empty() || !canBatch(*batches.back().command, command))
+                batches.push_back({ &command, indirectCommands.size(), 0 });
+
+            const DrawRanges* ranges = command.ranges != NO_RANGES
+                                         ? &rangeLists[command.ranges]
+                                         : nullptr;
+            command.mesh->appendIndirectCommands(command.lod,
+                                                 ranges,
+                                                 (GLuint)drawData.size(),
+                                                 indirectCommands);
+            drawData.push_back(command.model * command.mesh->vertexTransform);
+
+            batches.back().drawCount =
+              indirectCommands.size() - batches.back().firstDraw;
+        }
+
+        if (indirectCommands.empty())
+            return;
+
+        if (!indirectBuffer)
+        {
+            glGenBuffers(1, &indirectBuffer);
+            glGenBuffers(1, &drawDataBuffer);
+        }
+
+        // orphaned every frame, the driver renames them instead of waiting
+        // for the previous frame's draws
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                     indirectCommands.size() *
+                       sizeof(DrawElementsIndirectCommand),
+                     indirectCommands.data(),
+                     GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER,
+                     drawData.size() * sizeof(glm::mat4),
+                     drawData.data(),
+                     GL_STREAM_DRAW);
+        glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+
+        for (const IndirectBatch& batch : batches)
+        {
+            const DrawCommand& command = *batch.command;
+            if (batch.drawCount == 0)
+                continue;
+
+            Mesh::getGeometryBuffer(command.mesh->format)
+              .reserveDrawIndices(drawData.size());
+
+            command.shader->use();
+            command.mesh->material.bind();
+            GLState::bindVertexArray(command.mesh->VAO);
+            glMultiDrawElementsIndirect(
+              GL_TRIANGLES,
+              command.mesh->indexType,
+              (void*)(batch.firstDraw * sizeof(DrawElementsIndirectCommand)),
+              (GLsizei)batch.drawCount,
+              0);
+            lastStats.drawCalls++;
+        }
+    }
+
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> sortedKeys;
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchOrder;
+};
+
+#endif
@@ -3,18 +3,44 @@
 
 #include <glad/glad.h>
 
+#include <cstring>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include "GLState.h"
+
 using namespace std;
 
+// pre-resolved uniform location, the value type makes sure a handle is only
+// ever used with the matching setter
+template<typename T>
+struct Uniform
+{
+    int location = -1;
+};
+
+// name lookups, glUniform* calls issued through Shader and sets skipped
+// because the uniform already had that value, reset every frame
+struct UniformStats
+{
+    unsigned int lookups = 0;
+    unsigned int sets = 0;
+    unsigned int skipped = 0;
+};
+
 class Shader
 {
   public:
     unsigned int ID;
 
+    inline static UniformStats frameStats;
+    inline static UniformStats lastFrameStats;
+
     Shader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath)
     {
         string vertexCode;
@@ -91,6 +117,8 @@ class Shader
 
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+
+        reflectUniforms();
     }
 
     Shader(const char* vertexShaderFilePath, const char* geometryShaderFilePath, const char* fragmentShaderFilePath)
@@ -191,44 +219,288 @@ class Shader
         glDeleteShader(vertexShader);
         glDeleteShader(geometryShader);
         glDeleteShader(fragmentShader);
+
+        reflectUniforms();
+    }
+
+    // compute program (GL 4.3)
+    explicit Shader(const char* computeShaderFilePath)
+    {
+        string computeCode;
+        ifstream cShaderFile;
+
+        cShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
+
+        try
+        {
+            cShaderFile.open(computeShaderFilePath);
+            stringstream cShaderStream;
+
+            cShaderStream << cShaderFile.rdbuf();
+
+            cShaderFile.close();
+
+            computeCode = cShaderStream.str();
+        }
+        catch (ifstream::failure e)
+        {
+            cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+        }
+
+        const char* cShaderCode = computeCode.c_str();
+
+        unsigned int computeShader;
+        int success;
+        char infoLog[512];
+
+        computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &cShaderCode, NULL);
+        glCompileShader(computeShader);
+
+        glGetShaderiv(computeShader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            glGetShaderInfoLog(computeShader, 512, NULL, infoLog);
+            cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n"
+                 << infoLog << endl;
+        }
+
+        ID = glCreateProgram();
+        glAttachShader(ID, computeShader);
+        glLinkProgram(ID);
+
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glGetProgramInfoLog(ID, 512, NULL, infoLog);
+            cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                 << infoLog << endl;
+        }
+
+        glDeleteShader(computeShader);
+
+        reflectUniforms();
     }
 
-    void use() const { glUseProgram(ID); }
+    void use() const { GLState::useProgram(ID); }
 
-    void setBool(const string& name, bool value) const
+    // call once per frame, keeps the previous frame's counters for display
+    static void beginFrame()
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        lastFrameStats = frameStats;
+        frameStats = UniformStats();
     }
-    void setInt(const string& name, int value) const
+
+    int getUniformLocation(string_view name) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        frameStats.lookups++;
+
+        auto it = uniformLocations.find(name);
+        if (it == uniformLocations.end())
+            return -1;
+
+        return it->second;
     }
-    void setFloat(const string& name, float value) const
+
+    template<typename T>
+    Uniform<T> getUniform(string_view name) const
     {
-        auto location = glGetUniformLocation(ID, name.c_str());
-        glUniform1f(location, value);
+        return Uniform<T>{ getUniformLocation(name) };
     }
-    void setVec2(const string& name, glm::vec2 value) const
+
+    void set(Uniform<bool> uniform, bool value) const
     {
-        auto location = glGetUniformLocation(ID, name.c_str());
-        glUniform2fv(location, 1, glm::value_ptr(value));
+        if (!changeValue(uniform.location, value))
+            return;
+
+        frameStats.sets++;
+        glUniform1i(uniform.location, (int)value);
     }
-    void setVec3(const string& name, glm::vec3 value) const
+    void set(Uniform<int> uniform, int value) const
     {
-        auto location = glGetUniformLocation(ID, name.c_str());
-        glUniform3fv(location, 1, glm::value_ptr(value));
+        if (!changeValue(uniform.location, value))
+            return;
+
+        frameStats.sets++;
+        glUniform1i(uniform.location, value);
+    }
+    void set(Uniform<float> uniform, float value) const
+    {
+        if (!changeValue(uniform.location, value))
+            return;
+
+        frameStats.sets++;
+        glUniform1f(uniform.location, value);
+    }
+    void set(Uniform<glm::vec2> uniform, const glm::vec2& value) const
+    {
+        if (!changeValue(uniform.location, value))
+            return;
+
+        frameStats.sets++;
+        glUniform2fv(uniform.location, 1, glm::value_ptr(value));
     }
-    void setMat4(const string& name, glm::mat4 value) const
+    void set(Uniform<glm::vec3> uniform, const glm::vec3& value) const
     {
-        auto location = glGetUniformLocation(ID, name.c_str());
-        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+        if (!changeValue(uniform.location, value))
+            return;
+
+        frameStats.sets++;
+        glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+    }
+    void set(Uniform<glm::mat4> uniform, const glm::mat4& value) const
+    {
+        if (!changeValue(uniform.location, value))
+            return;
+
+        frameStats.sets++;
+        glUniformMatrix4fv(uniform.location,
+                           1,
+                           GL_FALSE,
+                           glm::value_ptr(value));
     }
-    void setUniformBlock(const string& name, unsigned int buffer) const
+
+    void setBool(string_view name, bool value) const
+    {
+        set(getUniform<bool>(name), value);
+    }
+    void setInt(string_view name, int value) const
+    {
+        set(getUniform<int>(name), value);
+    }
+    void setFloat(string_view name, float value) const
+    {
+        set(getUniform<float>(name), value);
+    }
+    void setVec2(string_view name, glm::vec2 value) const
+    {
+        set(getUniform<glm::vec2>(name), value);
+    }
+    void setVec3(string_view name, glm::vec3 value) const
+    {
+        set(getUniform<glm::vec3>(name), value);
+    }
+    void setMat4(string_view name, glm::mat4 value) const
+    {
+        set(getUniform<glm::mat4>(name), value);
+    }
+    void setUniformBlock(const string& name, unsigned int binding) const
+    {
+        unsigned int blockIndex = glGetUniformBlockIndex(ID, name.c_str());
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, blockIndex, binding);
+    }
+
+  private:
+    struct NameHash
+    {
+        using is_transparent = void;
+
+        size_t operator()(string_view name) const
+        {
+            return hash<string_view>()(name);
+        }
+    };
+
+    unordered_map<string, int, NameHash, equal_to<>> uniformLocations;
+
+    // last value set per uniform location, large enough for a mat4
+    struct UniformValue
+    {
+        bool valid = false;
+        unsigned char data[64];
+    };
+
+    mutable vector<UniformValue> uniformValues;
+
+    // records the value of the uniform at location, returns false when it
+    // already had that value or is not active in the program, the
+    // glUniform* call can be skipped then
+    template<typename T>
+    bool changeValue(int location, const T& value) const
+    {
+        static_assert(sizeof(T) <= sizeof(UniformValue::data));
+
+        if (location < 0)
+            return false;
+        if (location >= (int)uniformValues.size())
+            return true;
+
+        UniformValue& cached = uniformValues[location];
+        if (cached.valid && memcmp(cached.data, &value, sizeof(T)) == 0)
+        {
+            frameStats.skipped++;
+            return false;
+        }
+
+        cached.valid = true;
+        memcpy(cached.data, &value, sizeof(T));
+        return true;
+    }
+
+    // resolves every active uniform once at link time so that setting a
+    // uniform by name is a hash lookup instead of a driver call
+    void reflectUniforms()
+    {
+        int uniformCount = 0, maxNameLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        vector<char> nameBuffer(maxNameLength + 1);
+
+        for (int i = 0; i < uniformCount; i++)
+        {
+            int nameLength, size;
+            GLenum type;
+            glGetActiveUniform(ID,
+                               i,
+                               (GLsizei)nameBuffer.size(),
+                               &nameLength,
+                               &size,
+                               &type,
+                               nameBuffer.data());
+
+            string name(nameBuffer.data(), nameLength);
+
+            // arrays of basic types are reported once as "name[0]"
+            string arrayName;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                arrayName = name.substr(0, name.size() - 3);
+            }
+
+            if (arrayName.empty())
+            {
+                addUniformLocation(name);
+                continue;
+            }
+
+            for (int element = 0; element < size; element++)
+            {
+                addUniformLocation(arrayName + "[" + to_string(element) +
+                                   "]");
+            }
+
+            // the bare array name refers to the first element
+            int firstLocation = glGetUniformLocation(ID, name.c_str());
+            if (firstLocation != -1)
+                uniformLocations[arrayName] = firstLocation;
+        }
+
+        int maxLocation = -1;
+        for (auto& uniform : uniformLocations)
+        {
+            maxLocation = max(maxLocation, uniform.second);
+        }
+        uniformValues.assign(maxLocation + 1, UniformValue());
+    }
+
+    void addUniformLocation(const string& name)
     {
-        unsigned int matricesIndex =
-          glGetUniformBlockIndex(ID, "MatricesBlock");
-        glUniformBlockBinding(ID, matricesIndex, 1);
-        glBindBufferBase(GL_UNIFORM_BUFFER, 1, buffer);
+        // members of uniform blocks have no location
+        int location = glGetUniformLocation(ID, name.c_str());
+        if (location != -1)
+            uniformLocations[name] = location;
     }
 };
 
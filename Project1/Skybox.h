@@ -7,7 +7,8 @@
 #include <array>
 #include <string>
 #include <vector>
-#include "stb_image.h"
+#include "ImageDecoder.h"
+#include "TextureCache.h"
 #include <iostream>
 #include "Shader.h"
 
@@ -20,10 +21,14 @@ class Skybox
       : directory(path)
       , shader(shader)
     {
+        skyboxUniform = shader.getUniform<int>("skybox");
+        viewUniform = shader.getUniform<glm::mat4>("view");
+        projectionUniform = shader.getUniform<glm::mat4>("projection");
+
         glGenVertexArrays(1, &skyboxVAO);
         glGenBuffers(1, &skyboxVBO);
 
-        glBindVertexArray(skyboxVAO);
+        GLState::bindVertexArray(skyboxVAO);
 
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER,
@@ -48,37 +53,49 @@ class Skybox
         textureId = loadCubemap(faces_filepaths);
     }
 
+    Skybox(const Skybox&) = delete;
+    Skybox& operator=(const Skybox&) = delete;
+
+    ~Skybox() { TextureCache::shared().release(textureId); }
+
+    // the cubemap is shared through the texture cache, keyed by the
+    // directory of its faces
     unsigned int loadCubemap(std::vector<std::string> faces_filepath)
     {
-        unsigned int cubemapTextureID;
-        glGenTextures(1, &cubemapTextureID);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTextureID);
+        bool created;
+        unsigned int cubemapTextureID = TextureCache::shared().acquire(
+          TextureCache::getKey(directory, "cubemap"), created);
+        if (!created)
+            return cubemapTextureID;
+
+        GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTextureID);
 
-        int width, height, nrChannels;
-        unsigned char* data;
+        // faces are decoded in parallel and uploaded as they complete
+        ImageDecoder decoder;
         for (unsigned int i = 0; i < faces_filepath.size(); i++)
         {
-            data = stbi_load(faces_filepath[i].c_str(),
-                             &width,
-                             &height,
-                             &nrChannels,
-                             0);
-            if (!data)
+            decoder.decode(faces_filepath[i], i);
+        }
+
+        DecodedImage face;
+        while (decoder.next(face))
+        {
+            if (!face.data)
             {
-                stbi_image_free(data);
                 std::cout << "Cubemap tex failed to load at path: "
-                          << faces_filepath[i] << std::endl;
+                          << face.path << std::endl;
                 throw;
             }
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face.tag,
                          0,
                          GL_RGB,
-                         width,
-                         height,
+                         face.width,
+                         face.height,
                          0,
                          GL_RGB,
                          GL_UNSIGNED_BYTE,
-                         data);
+                         face.data);
+            face.free();
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -92,6 +109,7 @@ class Skybox
                         GL_TEXTURE_WRAP_R,
                         GL_CLAMP_TO_EDGE);
 
+        TextureCache::shared().setReady(cubemapTextureID);
         return cubemapTextureID;
     }
 
@@ -100,13 +118,12 @@ class Skybox
         glDepthFunc(GL_LEQUAL);
 
         shader.use();
-        glActiveTexture(GL_TEXTURE10);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
-        shader.setInt("skybox", 10);
-        shader.setMat4("view", glm::mat4(glm::mat3(view)));
-        shader.setMat4("projection", projection);
+        GLState::bindTexture(10, GL_TEXTURE_CUBE_MAP, textureId);
+        shader.set(skyboxUniform, 10);
+        shader.set(viewUniform, glm::mat4(glm::mat3(view)));
+        shader.set(projectionUniform, projection);
 
-        glBindVertexArray(skyboxVAO);
+        GLState::bindVertexArray(skyboxVAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
 
         glDepthFunc(GL_LESS);
@@ -115,6 +132,10 @@ class Skybox
   private:
     Shader shader;
 
+    Uniform<int> skyboxUniform;
+    Uniform<glm::mat4> viewUniform;
+    Uniform<glm::mat4> projectionUniform;
+
     std::string directory;
 
     unsigned int skyboxVBO, skyboxVAO;
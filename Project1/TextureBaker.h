@@ -0,0 +1,371 @@
+#ifndef TEXTURE_BAKER_H
+#define TEXTURE_BAKER_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BlockCompression.h"
+#include "ImageDecoder.h"
+
+// what a texture is sampled for, which decides its block format
+enum class TextureUsage : uint32_t
+{
+    // sRGB diffuse maps, BC1 or BC3 when the alpha is used
+    Color = 0,
+    // tangent space normals, BC5 x and y, z is rebuilt by the shaders
+    Normal = 1,
+    // parallax depth, BC4
+    Height = 2,
+    // linear data such as specular maps, compressed like Color
+    Mask = 3
+};
+
+// Block compressed textures with their whole mip chain, baked from the
+// source image the first time it is loaded and stored next to it. Later
+// loads read the baked file directly: no image decoding, no mip generation
+// and 4 to 8 times less data to upload.
+//
+// layout (little endian, every level aligned to DATA_ALIGNMENT):
+//   header     magic, version, usage, block format, source mtime,
+//              source path, width, height, components, level count
+//   per level  byte size, blocks
+class TextureBaker
+{
+  public:
+    static constexpr uint32_t MAGIC = 0x54424C4F; // "OLBT"
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t DATA_ALIGNMENT = 16;
+
+    static std::string getBakedPath(const std::string& sourcePath)
+    {
+        return sourcePath + ".btex";
+    }
+
+    static TextureUsage getUsage(const std::string& type)
+    {
+        if (type == "texture_normal")
+            return TextureUsage::Normal;
+        if (type == "texture_parallax")
+            return TextureUsage::Height;
+        if (type == "texture_specular")
+            return TextureUsage::Mask;
+        return TextureUsage::Color;
+    }
+
+    // filtering of the mip chain, colors are averaged in linear space and
+    // normals keep their length
+    static MipmapOptions getMipmapOptions(TextureUsage usage)
+    {
+        MipmapOptions options;
+        options.filter = MipmapFilter::Kaiser;
+
+        switch (usage)
+        {
+            case TextureUsage::Color:
+                options.encoding = MipmapEncoding::SRGB;
+                break;
+            case TextureUsage::Normal:
+                options.encoding = MipmapEncoding::Normal;
+                break;
+            case TextureUsage::Height:
+            case TextureUsage::Mask:
+                options.encoding = MipmapEncoding::Linear;
+                break;
+        }
+        return options;
+    }
+
+    // None when the image is uploaded uncompressed
+    static BlockFormat getBlockFormat(const DecodedImage& image,
+                                      TextureUsage usage)
+    {
+        switch (usage)
+        {
+            case TextureUsage::Normal:
+                return image.components >= 3 ? BlockFormat::BC5
+                                             : BlockFormat::None;
+            case TextureUsage::Height:
+                return image.components != 2 ? BlockFormat::BC4
+                                             : BlockFormat::None;
+            case TextureUsage::Color:
+            case TextureUsage::Mask:
+                break;
+        }
+
+        switch (image.components)
+        {
+            case 1:
+                return BlockFormat::BC4;
+            case 3:
+                return BlockFormat::BC1;
+            case 4:
+                return isOpaque(image) ? BlockFormat::BC1 : BlockFormat::BC3;
+            default:
+                return BlockFormat::None;
+        }
+    }
+
+    // reads the baked texture of sourcePath, baking and writing it first if
+    // it is missing or stale. Falls back to the decoded image (with mips)
+    // when it has no block format. Mips are filtered from the decoded image
+    // before compressing each level.
+    static DecodedImage load(const std::string& sourcePath,
+                             unsigned int tag,
+                             TextureUsage usage)
+    {
+        DecodedImage image;
+        if (read(sourcePath, usage, image))
+        {
+            image.tag = tag;
+            return image;
+        }
+
+        image = decodeImage(sourcePath, tag, true, getMipmapOptions(usage));
+        if (!image.data)
+            return image;
+
+        BlockFormat format = getBlockFormat(image, usage);
+        if (format == BlockFormat::None)
+            return image;
+
+        DecodedImage baked = bake(image, format);
+        image.free();
+
+        write(sourcePath, usage, baked);
+        return baked;
+    }
+
+    // compresses every level of a decoded image
+    static DecodedImage bake(const DecodedImage& image, BlockFormat format)
+    {
+        DecodedImage baked;
+        baked.width = image.width;
+        baked.height = image.height;
+        baked.components = image.components;
+        baked.path = image.path;
+        baked.tag = image.tag;
+        baked.blockFormat = format;
+        baked.mipmaps.resize(image.getLevelCount() - 1);
+
+        for (int level = 0; level < image.getLevelCount(); level++)
+        {
+            std::vector<unsigned char>& blocks =
+              level == 0 ? baked.blocks : baked.mipmaps[level - 1];
+            blocks.resize(baked.getLevelSize(level));
+
+            compressImage(image.getLevelData(level),
+                          image.getLevelWidth(level),
+                          image.getLevelHeight(level),
+                          image.components,
+                          format,
+                          blocks.data());
+        }
+
+        baked.data = baked.blocks.data();
+        return baked;
+    }
+
+    // false if the baked file is missing, stale or was baked for another
+    // usage
+    static bool read(const std::string& sourcePath,
+                     TextureUsage usage,
+                     DecodedImage& image)
+    {
+        int64_t sourceTime;
+        if (!getSourceTime(sourcePath, sourceTime))
+            return false;
+
+        std::ifstream in(getBakedPath(sourcePath), std::ios::binary);
+        if (!in)
+            return false;
+
+        uint32_t magic, version, bakedUsage, format, levelCount;
+        int32_t width, height, components;
+        int64_t bakedTime;
+        std::string bakedPath;
+
+        if (!readValue(in, magic) || magic != MAGIC ||
+            !readValue(in, version) || version != VERSION ||
+            !readValue(in, bakedUsage) || bakedUsage != (uint32_t)usage ||
+            !readValue(in, format) || !isBlockFormat(format) ||
+            !readValue(in, bakedTime) || bakedTime != sourceTime ||
+            !readString(in, bakedPath) || bakedPath != sourcePath ||
+            !readValue(in, width) || !readValue(in, height) ||
+            !readValue(in, components) || !readValue(in, levelCount) ||
+            width <= 0 || height <= 0 ||
+            levelCount != (uint32_t)getMipLevelCount(width, height))
+        {
+            return false;
+        }
+
+        image = DecodedImage();
+        image.path = sourcePath;
+        image.width = width;
+        image.height = height;
+        image.components = components;
+        image.blockFormat = (BlockFormat)format;
+        image.mipmaps.resize(levelCount - 1);
+
+        for (uint32_t level = 0; level < levelCount; level++)
+        {
+            std::vector<unsigned char>& blocks =
+              level == 0 ? image.blocks : image.mipmaps[level - 1];
+
+            uint64_t size;
+            if (!readValue(in, size) || size != image.getLevelSize(level) ||
+                !readArray(in, blocks, size))
+            {
+                std::cout << "ERROR::TEXTURE_BAKER::CORRUPTED "
+                          << getBakedPath(sourcePath) << std::endl;
+                image = DecodedImage();
+                return false;
+            }
+        }
+
+        image.data = image.blocks.data();
+        return true;
+    }
+
+    static void write(const std::string& sourcePath,
+                      TextureUsage usage,
+                      const DecodedImage& image)
+    {
+        int64_t sourceTime;
+        if (!getSourceTime(sourcePath, sourceTime))
+            return;
+
+        const std::string bakedPath = getBakedPath(sourcePath);
+        std::ofstream out(bakedPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cout << "ERROR::TEXTURE_BAKER::COULD_NOT_WRITE " << bakedPath
+                      << std::endl;
+            return;
+        }
+
+        writeValue(out, MAGIC);
+        writeValue(out, VERSION);
+        writeValue(out, (uint32_t)usage);
+        writeValue(out, (uint32_t)image.blockFormat);
+        writeValue(out, sourceTime);
+        writeString(out, sourcePath);
+        writeValue(out, (int32_t)image.width);
+        writeValue(out, (int32_t)image.height);
+        writeValue(out, (int32_t)image.components);
+        writeValue(out, (uint32_t)image.getLevelCount());
+
+        for (int level = 0; level < image.getLevelCount(); level++)
+        {
+            writeValue(out, (uint64_t)image.getLevelSize(level));
+            writeArray(out,
+                       image.getLevelData(level),
+                       image.getLevelSize(level));
+        }
+
+        if (!out)
+        {
+            std::cout << "ERROR::TEXTURE_BAKER::COULD_NOT_WRITE " << bakedPath
+                      << std::endl;
+            out.close();
+            std::filesystem::remove(bakedPath);
+        }
+    }
+
+  private:
+    static bool isBlockFormat(uint32_t format)
+    {
+        switch ((BlockFormat)format)
+        {
+            case BlockFormat::BC1:
+            case BlockFormat::BC3:
+            case BlockFormat::BC4:
+            case BlockFormat::BC5:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool isOpaque(const DecodedImage& image)
+    {
+        size_t texels = (size_t)image.width * image.height;
+        for (size_t i = 0; i < texels; i++)
+        {
+            if (image.data[i * 4 + 3] != 255)
+                return false;
+        }
+        return true;
+    }
+
+    static bool getSourceTime(const std::string& sourcePath, int64_t& time)
+    {
+        std::error_code error;
+        auto lastWrite = std::filesystem::last_write_time(sourcePath, error);
+        if (error)
+            return false;
+
+        time = (int64_t)lastWrite.time_since_epoch().count();
+        return true;
+    }
+
+    static size_t align(size_t value)
+    {
+        return (value + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+    }
+
+    template<typename T>
+    static bool readValue(std::ifstream& in, T& value)
+    {
+        return (bool)in.read((char*)&value, sizeof(T));
+    }
+
+    static bool readString(std::ifstream& in, std::string& value)
+    {
+        uint32_t length;
+        if (!readValue(in, length) || length > 4096)
+            return false;
+
+        value.resize(length);
+        return (bool)in.read(value.data(), length);
+    }
+
+    static bool readArray(std::ifstream& in,
+                          std::vector<unsigned char>& data,
+                          size_t size)
+    {
+        size_t position = (size_t)in.tellg();
+        in.seekg(align(position) - position, std::ios::cur);
+
+        data.resize(size);
+        return (bool)in.read((char*)data.data(), size);
+    }
+
+    template<typename T>
+    static void writeValue(std::ofstream& out, const T& value)
+    {
+        out.write((const char*)&value, sizeof(T));
+    }
+
+    static void writeString(std::ofstream& out, const std::string& value)
+    {
+        writeValue(out, (uint32_t)value.size());
+        out.write(value.data(), value.size());
+    }
+
+    static void writeArray(std::ofstream& out,
+                           const unsigned char* data,
+                           size_t size)
+    {
+        static const char padding[DATA_ALIGNMENT] = {};
+
+        size_t position = (size_t)out.tellp();
+        out.write(padding, align(position) - position);
+        out.write((const char*)data, size);
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "GLState.h"
+
+struct TextureCacheStats
+{
+    unsigned int textures = 0;
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+};
+
+// Textures shared by every loader, keyed by the canonical path of their
+// source and how it is loaded, so that the same file referenced by several
+// models (or through different relative paths) is decoded and uploaded
+// once. A texture is ready once its last level is uploaded, until then
+// models sharing it have to wait for the loader that created it. Loaders
+// that upload over several frames register how to make progress, so that
+// a blocking loader can wait on their textures (waitUntilReady()).
+//
+// Each acquire() takes a reference that its owner gives back with release(),
+// the texture is deleted with its last reference. Only used from the GL
+// thread.
+class TextureCache
+{
+  public:
+    TextureCacheStats stats;
+
+    static TextureCache& shared()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // absolute, normalized path with forward slashes, followed by the usage
+    // (color space, baked or decoded...) that decides the texture's content
+    static std::string getKey(const std::string& path,
+                              const std::string& usage)
+    {
+        std::error_code error;
+        std::filesystem::path canonical =
+          std::filesystem::weakly_canonical(path, error);
+        if (error)
+            canonical = std::filesystem::path(path).lexically_normal();
+
+        return canonical.generic_string() + "|" + usage;
+    }
+
+    // texture of the key with one more reference. created is set when the
+    // texture did not exist yet, its name is new and the caller has to
+    // upload it
+    unsigned int acquire(const std::string& key, bool& created)
+    {
+        auto found = entries.find(key);
+        created = found == entries.end();
+
+        if (!created)
+        {
+            stats.hits++;
+            found->second.references++;
+            return found->second.textureID;
+        }
+
+        stats.misses++;
+        stats.textures++;
+
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        entries[key] = { textureID, 1, false };
+        keys[textureID] = key;
+        return textureID;
+    }
+
+    // called by whoever uploads the texture once it is complete, or failed
+    // and will not be uploaded. Unknown names are ignored.
+    void setReady(unsigned int textureID)
+    {
+        auto key = keys.find(textureID);
+        if (key != keys.end())
+            entries[key->second].ready = true;
+    }
+
+    bool isReady(unsigned int textureID) const
+    {
+        auto key = keys.find(textureID);
+        return key != keys.end() && entries.at(key->second).ready;
+    }
+
+    // progress is called while a texture is waited for, it should decode
+    // and upload what the loader has pending without waiting itself
+    void addLoader(const void* loader, std::function<void()> progress)
+    {
+        loaders[loader] = std::move(progress);
+    }
+
+    void removeLoader(const void* loader) { loaders.erase(loader); }
+
+    // makes the loaders progress until the texture is ready, returns early
+    // when no loader is left that could finish it
+    void waitUntilReady(unsigned int textureID)
+    {
+        while (!isReady(textureID) && !loaders.empty())
+        {
+            for (auto& loader : loaders)
+            {
+                loader.second();
+            }
+            if (!isReady(textureID))
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void release(unsigned int textureID)
+    {
+        auto key = keys.find(textureID);
+        if (key == keys.end())
+            return;
+
+        auto entry = entries.find(key->second);
+        if (--entry->second.references > 0)
+            return;
+
+        GLState::forgetTexture(textureID);
+        glDeleteTextures(1, &textureID);
+
+        entries.erase(entry);
+        keys.erase(key);
+        stats.textures--;
+    }
+
+  private:
+    struct Entry
+    {
+        unsigned int textureID;
+        unsigned int references;
+        bool ready;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<unsigned int, std::string> keys;
+    std::unordered_map<const void*, std::function<void()>> loaders;
+};
+
+#endif
@@ -0,0 +1,475 @@
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <iostream>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "GLState.h"
+#include "ImageDecoder.h"
+#include "TextureCache.h"
+
+// EXT_texture_compression_s3tc, not part of the core profile headers
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// work done by the uploader during a frame
+struct TextureUploadStats
+{
+    size_t uploadedBytes = 0;
+    unsigned int pendingTextures = 0;
+    // times the next buffer was still read by the GPU and the upload waited
+    // for a later frame
+    unsigned int stalls = 0;
+};
+
+// Queue of decoded images uploaded to 2D textures a slice at a time.
+//
+// Texels are copied into a ring of pixel buffer objects allocated once and
+// reused, then transferred with glTexSubImage2D per mip level (and per group
+// of rows for large levels), so no single frame pays for a whole texture.
+// Each buffer is fenced after its transfers are issued and only written to
+// again once the fence signaled, which lets it be mapped unsynchronized.
+//
+// Mip levels are expected to come with the image (decodeImage with mipmaps
+// or a baked texture) instead of being generated by the GPU once level 0 is
+// in place. Block compressed images are transferred a row of blocks at a
+// time with glCompressedTexSubImage2D.
+class TextureUploader
+{
+  public:
+    TextureUploadStats lastFrameStats;
+
+    explicit TextureUploader(size_t bytesPerFrame = 8 * 1024 * 1024,
+                             size_t bufferSize = 2 * 1024 * 1024,
+                             unsigned int bufferCount = 4)
+      : bytesPerFrame(bytesPerFrame)
+      , bufferSize(bufferSize)
+      , buffers(bufferCount)
+    {
+        for (Buffer& buffer : buffers)
+        {
+            glGenBuffers(1, &buffer.id);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER,
+                         bufferSize,
+                         NULL,
+                         GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    TextureUploader(const TextureUploader&) = delete;
+    TextureUploader& operator=(const TextureUploader&) = delete;
+
+    ~TextureUploader()
+    {
+        for (Buffer& buffer : buffers)
+        {
+            if (buffer.fence)
+                glDeleteSync(buffer.fence);
+            glDeleteBuffers(1, &buffer.id);
+        }
+
+        for (Job& job : jobs)
+        {
+            job.image.free();
+        }
+    }
+
+    // pixel format of a decoded image, GL_NONE if unsupported
+    static GLenum getFormat(int components)
+    {
+        switch (components)
+        {
+            case 1:
+                return GL_RED;
+            case 3:
+                return GL_RGB;
+            case 4:
+                return GL_RGBA;
+            default:
+                return GL_NONE;
+        }
+    }
+
+    // internal format of a block compressed image
+    static GLenum getCompressedFormat(BlockFormat format)
+    {
+        switch (format)
+        {
+            case BlockFormat::BC1:
+                return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+            case BlockFormat::BC3:
+                return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            case BlockFormat::BC4:
+                return GL_COMPRESSED_RED_RGTC1;
+            case BlockFormat::BC5:
+                return GL_COMPRESSED_RG_RGTC2;
+            default:
+                return GL_NONE;
+        }
+    }
+
+    // true if every BlockFormat can be uploaded. RGTC (BC4, BC5) is core,
+    // S3TC (BC1, BC3) is an extension every desktop driver exposes.
+    static bool supportsCompression()
+    {
+        static const bool supported = []
+        {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++)
+            {
+                const char* extension =
+                  (const char*)glGetStringi(GL_EXTENSIONS, i);
+                if (std::string(extension) == "GL_EXT_texture_compression_s3tc")
+                    return true;
+            }
+            return false;
+        }();
+        return supported;
+    }
+
+    // allocates every level of the texture and queues their texels, the
+    // uploader owns the image from now on
+    void enqueue(unsigned int textureID, DecodedImage&& image)
+    {
+        GLenum format = image.isCompressed()
+                          ? getCompressedFormat(image.blockFormat)
+                          : getFormat(image.components);
+        if (!image.data || format == GL_NONE)
+        {
+            std::cout << "ERROR::TEXTURE_UPLOADER::UNSUPPORTED_IMAGE "
+                      << image.path << std::endl;
+            image.free();
+            TextureCache::shared().setReady(textureID);
+            return;
+        }
+
+        GLState::bindTexture(0, GL_TEXTURE_2D, textureID);
+        for (int level = 0; level < image.getLevelCount(); level++)
+        {
+            if (image.isCompressed())
+            {
+                glCompressedTexImage2D(GL_TEXTURE_2D,
+                                       level,
+                                       format,
+                                       image.getLevelWidth(level),
+                                       image.getLevelHeight(level),
+                                       0,
+                                       (GLsizei)image.getLevelSize(level),
+                                       NULL);
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D,
+                             level,
+                             format,
+                             image.getLevelWidth(level),
+                             image.getLevelHeight(level),
+                             0,
+                             format,
+                             GL_UNSIGNED_BYTE,
+                             NULL);
+            }
+        }
+
+        // a row has to fit in a buffer, images that wide skip the ring
+        if (image.getRowSize(0) > bufferSize)
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (int level = 0; level < image.getLevelCount(); level++)
+            {
+                transfer({ textureID,
+                           format,
+                           image.isCompressed(),
+                           level,
+                           0,
+                           image.getLevelWidth(level),
+                           image.getLevelHeight(level),
+                           image.getLevelSize(level),
+                           0 },
+                         image.getLevelData(level));
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+            setParameters(image.getLevelCount());
+            image.free();
+            TextureCache::shared().setReady(textureID);
+            return;
+        }
+
+        Job job;
+        job.textureID = textureID;
+        job.format = format;
+        job.image = std::move(image);
+        jobs.push_back(std::move(job));
+        pendingTextures.insert(textureID);
+    }
+
+    // true until every level of the texture is uploaded
+    bool isPending(unsigned int textureID) const
+    {
+        return pendingTextures.count(textureID) != 0;
+    }
+
+    size_t getPendingCount() const { return pendingTextures.size(); }
+
+    // uploads within the frame budget, returns the bytes uploaded
+    size_t update() { return update(bytesPerFrame); }
+
+    // uploads at most budget bytes (at least one row), never waits on the
+    // GPU, returns the bytes uploaded
+    size_t update(size_t budget)
+    {
+        TextureUploadStats stats;
+
+        while (!jobs.empty() && stats.uploadedBytes < budget)
+        {
+            if (!acquireBuffer(false))
+            {
+                stats.stalls++;
+                break;
+            }
+            stats.uploadedBytes += fillBuffer(budget - stats.uploadedBytes);
+        }
+
+        stats.pendingTextures = (unsigned int)pendingTextures.size();
+        lastFrameStats = stats;
+        return stats.uploadedBytes;
+    }
+
+    // uploads everything queued, waiting on the GPU when the ring is full
+    void finish()
+    {
+        while (!jobs.empty())
+        {
+            acquireBuffer(true);
+            fillBuffer(SIZE_MAX);
+        }
+    }
+
+  private:
+    struct Buffer
+    {
+        unsigned int id = 0;
+        GLsync fence = NULL;
+    };
+
+    struct Job
+    {
+        unsigned int textureID;
+        GLenum format;
+        DecodedImage image;
+        int level = 0;
+        int row = 0;
+    };
+
+    // texel rows y to y + height of a level, copied into the current
+    // buffer at offset
+    struct Slice
+    {
+        unsigned int textureID;
+        GLenum format;
+        bool compressed;
+        int level;
+        int y;
+        int width;
+        int height;
+        size_t size;
+        size_t offset;
+    };
+
+    static const size_t SLICE_ALIGNMENT = 16;
+
+    size_t bytesPerFrame;
+    size_t bufferSize;
+    std::vector<Buffer> buffers;
+    unsigned int nextBuffer = 0;
+
+    std::deque<Job> jobs;
+    std::unordered_set<unsigned int> pendingTextures;
+    std::vector<Slice> slices;
+
+    // true once the GPU is done reading the next buffer of the ring
+    bool acquireBuffer(bool wait)
+    {
+        Buffer& buffer = buffers[nextBuffer];
+        if (!buffer.fence)
+            return true;
+
+        GLuint64 timeout = wait ? 1000000000 : 0;
+        GLenum status;
+        do
+        {
+            status = glClientWaitSync(buffer.fence,
+                                      GL_SYNC_FLUSH_COMMANDS_BIT,
+                                      timeout);
+        } while (wait && status == GL_TIMEOUT_EXPIRED);
+
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+
+        glDeleteSync(buffer.fence);
+        buffer.fence = NULL;
+        return true;
+    }
+
+    // copies the next slices into the acquired buffer and issues their
+    // transfers, returns the bytes copied
+    size_t fillBuffer(size_t budget)
+    {
+        Buffer& buffer = buffers[nextBuffer];
+        nextBuffer = (nextBuffer + 1) % buffers.size();
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+        unsigned char* mapped = (unsigned char*)glMapBufferRange(
+          GL_PIXEL_UNPACK_BUFFER,
+          0,
+          bufferSize,
+          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+
+        // textures whose last level was copied, with their level count
+        std::vector<std::pair<unsigned int, int>> completed;
+        size_t offset = 0, copied = 0;
+        slices.clear();
+
+        while (!jobs.empty() && offset < bufferSize && copied < budget)
+        {
+            Job& job = jobs.front();
+            const DecodedImage& image = job.image;
+
+            int rowCount = image.getRowCount(job.level);
+            size_t rowSize = image.getRowSize(job.level);
+
+            size_t space = std::min(bufferSize - offset, budget - copied);
+            int rows = (int)std::min((size_t)(rowCount - job.row),
+                                     space / rowSize);
+            if (rows == 0)
+            {
+                // the budget always allows one row, the buffer might not
+                if (rowSize > bufferSize - offset)
+                    break;
+                rows = 1;
+            }
+
+            size_t size = rows * rowSize;
+            std::memcpy(mapped + offset,
+                        image.getLevelData(job.level) + job.row * rowSize,
+                        size);
+
+            // rows of blocks cover 4 rows of texels, but not past the level
+            int texelRows = image.isCompressed() ? 4 : 1;
+            int y = job.row * texelRows;
+            slices.push_back(
+              { job.textureID,
+                job.format,
+                image.isCompressed(),
+                job.level,
+                y,
+                image.getLevelWidth(job.level),
+                std::min(rows * texelRows,
+                         image.getLevelHeight(job.level) - y),
+                size,
+                offset });
+
+            offset += (size + SLICE_ALIGNMENT - 1) & ~(SLICE_ALIGNMENT - 1);
+            copied += size;
+
+            job.row += rows;
+            if (job.row == rowCount)
+            {
+                job.row = 0;
+                job.level++;
+            }
+
+            if (job.level == image.getLevelCount())
+            {
+                completed.push_back({ job.textureID, image.getLevelCount() });
+                job.image.free();
+                jobs.pop_front();
+            }
+        }
+
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (const Slice& slice : slices)
+        {
+            transfer(slice, (const void*)slice.offset);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        for (const auto& [textureID, levelCount] : completed)
+        {
+            GLState::bindTexture(0, GL_TEXTURE_2D, textureID);
+            setParameters(levelCount);
+            pendingTextures.erase(textureID);
+            TextureCache::shared().setReady(textureID);
+        }
+
+        return copied;
+    }
+
+    // copies a slice from client memory or, with a bound unpack buffer,
+    // from the buffer offset given as texels
+    static void transfer(const Slice& slice, const void* texels)
+    {
+        GLState::bindTexture(0, GL_TEXTURE_2D, slice.textureID);
+
+        if (slice.compressed)
+        {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D,
+                                      slice.level,
+                                      0,
+                                      slice.y,
+                                      slice.width,
+                                      slice.height,
+                                      slice.format,
+                                      (GLsizei)slice.size,
+                                      texels);
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D,
+                            slice.level,
+                            0,
+                            slice.y,
+                            slice.width,
+                            slice.height,
+                            slice.format,
+                            GL_UNSIGNED_BYTE,
+                            texels);
+        }
+    }
+
+    // sampling of a model texture bound on GL_TEXTURE_2D
+    static void setParameters(int levelCount)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D,
+                        GL_TEXTURE_MIN_FILTER,
+                        levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running jobs in submission order.
+//
+// Jobs must not touch GL, the context is only current on the main thread:
+// workers do the CPU side (file reads, decoding) and hand their results back
+// for the main thread to upload.
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(unsigned int threadCount)
+    {
+        threadCount = std::max(threadCount, 1u);
+        for (unsigned int i = 0; i < threadCount; i++)
+        {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // jobs still queued are run before the workers exit
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobAvailable.notify_all();
+
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        jobAvailable.notify_one();
+    }
+
+    unsigned int size() const { return (unsigned int)workers.size(); }
+
+    // pool shared by the loaders, one worker per core: the main thread
+    // mostly waits on their results while loading
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+
+  private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    bool stopping = false;
+
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobAvailable.wait(lock,
+                                  [this] { return stopping || !jobs.empty(); });
+
+                if (jobs.empty())
+                    return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            job();
+        }
+    }
+};
+
+#endif
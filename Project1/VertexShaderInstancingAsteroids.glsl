@@ -1,9 +1,12 @@
 #version 330 core
 
+// VertexFormat::Float meshes drawn by an InstancedModel
 layout (location = 0) in vec3 Pos;
 layout (location = 1) in vec3 Nor;
-layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 instanceMatrix;
+layout (location = 4) in vec2 aTexCoords;
+layout (location = 6) in mat4 instanceMatrix;
+// inverse transpose of the instance matrix, computed once per instance
+layout (location = 10) in mat3 normalMatrix;
 
 out vec3 Normal;
 out vec3 FragPos;
@@ -15,7 +18,7 @@ uniform mat4 projection;
 
 void main()
 {
-	Normal = normalize(mat3(inverse(transpose(instanceMatrix))) * Pos);
+	Normal = normalize(normalMatrix * Nor);
 	TexCoords = aTexCoords;
 	FragPos = vec3(instanceMatrix * vec4(Pos, 1.0));
 	gl_Position = projection * view * vec4(FragPos, 1);
@@ -0,0 +1,39 @@
+#version 330 core
+
+// VertexFormat::Packed meshes drawn by an InstancedModel, see PackedVertex
+// in Mesh.h. vertexTransform maps the mesh's positions out of [0, 1], it is
+// not part of the instance matrix.
+layout (location = 0) in vec4 Position;
+layout (location = 1) in vec2 Nor;
+layout (location = 4) in vec2 aTexCoords;
+layout (location = 6) in mat4 instanceMatrix;
+// inverse transpose of the instance matrix, computed once per instance
+layout (location = 10) in mat3 normalMatrix;
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 vertexTransform;
+
+vec3 UnpackOctahedral(vec2 encoded)
+{
+	vec3 direction = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-direction.z, 0.0);
+	direction.x += direction.x >= 0.0 ? -fold : fold;
+	direction.y += direction.y >= 0.0 ? -fold : fold;
+	return normalize(direction);
+}
+
+void main()
+{
+	// the vertex transform only scales uniformly and translates, the normals
+	// are not affected
+	Normal = normalize(normalMatrix * UnpackOctahedral(Nor));
+	TexCoords = aTexCoords;
+	FragPos = vec3(instanceMatrix * vertexTransform * vec4(Position.xyz, 1.0));
+	gl_Position = projection * view * vec4(FragPos, 1);
+}
@@ -1,28 +1,11 @@
 #version 330 core
 
-#define MAX_NR_LIGHTS 10
-
 layout (location = 0) in vec3 Position;
 layout (location = 1) in vec3 Normal;
 layout (location = 2) in vec3 Tangent;
 layout (location = 3) in vec3 Bitangent;
 layout (location = 4) in vec2 texCoords;
 
-struct PointLight {
-	vec3 position;
-	bool casts_shadows;
-
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-
-	float constant;
-	float linear;
-	float quadratic;
-};
-uniform PointLight pointLights[MAX_NR_LIGHTS];
-uniform int NUMBER_OF_POINT_LIGHTS;
-
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
@@ -31,12 +14,11 @@ uniform vec3 viewPos;
 
 
 out VS_OUT {
-	vec3 Debug;
 	vec3 FragPos;
 	vec2 TexCoords;
 	vec3 TangentViewPos;
 	vec3 TangentFragPos;
-	vec3[MAX_NR_LIGHTS] tangentPointLightPositions;
+	mat3 TBN;
 } vs_out;
 
 
@@ -54,11 +36,9 @@ void main()
 	vs_out.TangentViewPos = TBN * viewPos;
 	vs_out.TangentFragPos = TBN * vs_out.FragPos;
 
-	for (int i = 0; i < NUMBER_OF_POINT_LIGHTS; i++){
-		vs_out.tangentPointLightPositions[i] = TBN * pointLights[i].position;
-	}
-
-	vs_out.Debug = pointLights[1].position;
+	// lights are moved to tangent space per fragment, only for the lights of
+	// the fragment's cluster
+	vs_out.TBN = TBN;
 
 	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0f);
 }
@@ -0,0 +1,58 @@
+#version 330 core
+
+// VertexFormat::Packed meshes, see PackedVertex in Mesh.h. The model matrix
+// includes the mesh's vertexTransform mapping positions out of [0, 1].
+layout (location = 0) in vec4 Position; // w: bitangent sign, 0 or 1
+layout (location = 1) in vec2 Normal;
+layout (location = 2) in vec2 Tangent;
+layout (location = 4) in vec2 texCoords;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+uniform vec3 viewPos;
+
+
+out VS_OUT {
+	vec3 FragPos;
+	vec2 TexCoords;
+	vec3 TangentViewPos;
+	vec3 TangentFragPos;
+	mat3 TBN;
+} vs_out;
+
+
+vec3 UnpackOctahedral(vec2 encoded)
+{
+	vec3 direction = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-direction.z, 0.0);
+	direction.x += direction.x >= 0.0 ? -fold : fold;
+	direction.y += direction.y >= 0.0 ? -fold : fold;
+	return normalize(direction);
+}
+
+void main()
+{
+	vec3 normal = UnpackOctahedral(Normal);
+	vec3 tangent = UnpackOctahedral(Tangent);
+	vec3 bitangent = (Position.w * 2.0 - 1.0) * cross(normal, tangent);
+
+	vec3 T = vec3(normalize(model * vec4(tangent, 0.0)));
+	vec3 B = vec3(normalize(model * vec4(bitangent, 0.0)));
+	vec3 N = vec3(normalize(model * vec4(normal, 0.0)));
+
+	mat3 TBN = transpose(mat3(T, B, N)); // World to tangent space
+
+	vs_out.FragPos = vec3(model * vec4(Position.xyz, 1.0));
+	vs_out.TexCoords = texCoords;
+
+	vs_out.TangentViewPos = TBN * viewPos;
+	vs_out.TangentFragPos = TBN * vs_out.FragPos;
+
+	// lights are moved to tangent space per fragment, only for the lights of
+	// the fragment's cluster
+	vs_out.TBN = TBN;
+
+	gl_Position = projection * view * vec4(vs_out.FragPos, 1.0f);
+}
@@ -0,0 +1,25 @@
+#version 430 core
+
+// omni shadow casters drawn by the GpuCuller: the model matrix and the faces
+// to render to are read at the draw index (its baseInstance, see
+// GeometryBuffer)
+layout (location = 0) in vec3 Pos;
+layout (location = 5) in uint drawIndex;
+
+layout (std430, binding = 0) readonly buffer DrawData
+{
+	mat4 models[];
+};
+
+layout (std430, binding = 4) readonly buffer DrawFaceMasks
+{
+	uint faceMasks[];
+};
+
+flat out int FaceMask;
+
+void main()
+{
+	gl_Position = models[drawIndex] * vec4(Pos, 1.0);
+	FaceMask = int(faceMasks[drawIndex]);
+}
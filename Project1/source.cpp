@@ -8,13 +8,28 @@
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
+#include <chrono>
 #include <format>
+#include <fstream>
+#include <memory>
+#include <random>
 
+#include "Benchmark.h"
 #include "Camera.h"
 #include "Model.h"
+#include "ModelStreamer.h"
 #include "filesystem.h"
 #include "stb_image.h"
 #include "Light.h"
+#include "Frustum.h"
+#include "GpuCuller.h"
+#include "HeadlessContext.h"
+#include "InstancedModel.h"
+#include "LightClusters.h"
+#include "LodSelector.h"
+#include "MeshletCuller.h"
+#include "OmniShadowMap.h"
+#include "RenderQueue.h"
 #include "Skybox.h"
 #include "Cube.h"
 
@@ -49,6 +64,7 @@ int nbFrames = 0;
 
 // transformation matrices
 glm::mat4 model, view, projection;
+const float cameraNearPlane = 0.1f, cameraFarPlane = 1000.0f;
 
 // uniform matrices setup
 unsigned int uboMatrixBlock;
@@ -71,69 +87,218 @@ bool parallax_self_shadow = true;
 float parallax_self_shadow_exponent = 1.0;
 
 vector<std::shared_ptr<Light>> lights;
-
-int
-main()
+LightClusterStats lightClusterStats;
+OmniShadowStats omniShadowStats;
+ModelStreamStats modelStreamStats;
+// meshes rejected with their whole model by its sphere, then the meshes of
+// the remaining models tested by their boxes
+FrustumCullStats sphereCullStats;
+FrustumCullStats frustumCullStats;
+LodStats lodStats;
+MeshletCullStats meshletCullStats;
+RenderQueueStats renderQueueStats;
+GpuCullStats gpuCullStats;
+InstancedModelStats rockFieldStats;
+
+// uniform handles of the shaders used every frame, resolved once after
+// compilation so the render loop never looks a uniform up by name
+struct OmniShadowUniforms
 {
-    // GLAD / GLFW3 SETUP
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    Uniform<glm::mat4> shadowMatrices[6];
+    Uniform<int> faceMask;
+    Uniform<glm::mat4> model;
+    Uniform<float> farPlane;
+    Uniform<glm::vec3> lightPos;
 
-    glfwWindowHint(GLFW_MAXIMIZED, GLFW_TRUE);
+    OmniShadowUniforms(const Shader& shader)
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            shadowMatrices[i] = shader.getUniform<glm::mat4>(
+              "shadowMatrices[" + std::to_string(i) + "]");
+        }
+        faceMask = shader.getUniform<int>("faceMask");
+        model = shader.getUniform<glm::mat4>("model");
+        farPlane = shader.getUniform<float>("far_plane");
+        lightPos = shader.getUniform<glm::vec3>("lightPos");
+    }
+};
 
-    string title = "gpu go brrr";
+struct LitUniforms
+{
+    Uniform<bool> wireframeMode;
+    Uniform<int> omniShadowMap;
+    Uniform<float> farPlane;
+    Uniform<float> parallaxStrength;
+    Uniform<float> parallaxMaxLayers;
+    Uniform<bool> parallaxSelfShadow;
+    Uniform<float> parallaxSelfShadowExponent;
+    Uniform<glm::mat4> model;
+    Uniform<glm::mat4> view;
+    Uniform<glm::mat4> projection;
+    Uniform<glm::vec3> viewPos;
+
+    LitUniforms(const Shader& shader)
+    {
+        wireframeMode = shader.getUniform<bool>("wireframeMode");
+        omniShadowMap = shader.getUniform<int>("omniShadowMap");
+        farPlane = shader.getUniform<float>("far_plane");
+        parallaxStrength = shader.getUniform<float>("parallax_strength");
+        parallaxMaxLayers = shader.getUniform<float>("parallax_max_layers");
+        parallaxSelfShadow = shader.getUniform<bool>("parallax_self_shadow");
+        parallaxSelfShadowExponent =
+          shader.getUniform<float>("parallax_self_shadow_exponent");
+        model = shader.getUniform<glm::mat4>("model");
+        view = shader.getUniform<glm::mat4>("view");
+        projection = shader.getUniform<glm::mat4>("projection");
+        viewPos = shader.getUniform<glm::vec3>("viewPos");
+    }
+};
 
-    float main_scale =
-      ImGui_ImplGlfw_GetContentScaleForMonitor(glfwGetPrimaryMonitor());
-    GLFWwindow* window = glfwCreateWindow((int)(windowWidth * main_scale),
-                                          (int)(windowHeight * main_scale),
-                                          title.c_str(),
-                                          NULL,
-                                          NULL);
+struct LightSourceUniforms
+{
+    Uniform<glm::mat4> model;
+    Uniform<glm::mat4> view;
+    Uniform<glm::mat4> projection;
+    Uniform<glm::vec3> lightColor;
 
-    if (window == NULL)
+    LightSourceUniforms(const Shader& shader)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        model = shader.getUniform<glm::mat4>("model");
+        view = shader.getUniform<glm::mat4>("view");
+        projection = shader.getUniform<glm::mat4>("projection");
+        lightColor = shader.getUniform<glm::vec3>("lightColor");
     }
-    glfwMakeContextCurrent(window);
+};
 
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+struct InstancingUniforms
+{
+    Uniform<glm::mat4> view;
+    Uniform<glm::mat4> projection;
+    Uniform<glm::vec3> viewPos;
+    Uniform<glm::mat4> vertexTransform;
+
+    InstancingUniforms(const Shader& shader)
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
+        view = shader.getUniform<glm::mat4>("view");
+        projection = shader.getUniform<glm::mat4>("projection");
+        viewPos = shader.getUniform<glm::vec3>("viewPos");
+        vertexTransform = shader.getUniform<glm::mat4>("vertexTransform");
+    }
+};
+
+int
+main(int argc, char** argv)
+{
+    BenchmarkOptions benchmarkOptions;
+    if (!parseBenchmarkOptions(argc, argv, benchmarkOptions))
         return -1;
+
+    const bool headless = benchmarkOptions.headless;
+    // newer contexts are optional, 3.3 is always the fallback
+    const bool requestsNewerGL =
+      benchmarkOptions.glMajor != 3 || benchmarkOptions.glMinor != 3;
+
+    string title = "gpu go brrr";
+
+    // GLAD / GLFW3 SETUP
+    // the headless benchmark renders into an offscreen framebuffer instead of
+    // a window, without input or ImGui
+    HeadlessContext headlessContext;
+    std::unique_ptr<OffscreenTarget> offscreenTarget;
+    GLFWwindow* window = NULL;
+    unsigned int mainFramebuffer = 0;
+
+    if (headless)
+    {
+        bool created = headlessContext.create(benchmarkOptions.glMajor,
+                                              benchmarkOptions.glMinor);
+        if (!created && requestsNewerGL)
+        {
+            headlessContext.destroy();
+            created = headlessContext.create(3, 3);
+        }
+        if (!created)
+            return -1;
+
+        windowWidth = benchmarkOptions.width;
+        windowHeight = benchmarkOptions.height;
+
+        offscreenTarget =
+          std::make_unique<OffscreenTarget>(windowWidth, windowHeight);
+        mainFramebuffer = offscreenTarget->FBO;
+        glViewport(0, 0, windowWidth, windowHeight);
     }
+    else
+    {
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, benchmarkOptions.glMajor);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, benchmarkOptions.glMinor);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+        glfwWindowHint(GLFW_MAXIMIZED, GLFW_TRUE);
+
+        float main_scale =
+          ImGui_ImplGlfw_GetContentScaleForMonitor(glfwGetPrimaryMonitor());
+        window = glfwCreateWindow((int)(windowWidth * main_scale),
+                                  (int)(windowHeight * main_scale),
+                                  title.c_str(),
+                                  NULL,
+                                  NULL);
+
+        if (window == NULL && requestsNewerGL)
+        {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+            window = glfwCreateWindow((int)(windowWidth * main_scale),
+                                      (int)(windowHeight * main_scale),
+                                      title.c_str(),
+                                      NULL,
+                                      NULL);
+        }
 
-    const char* version =
-      reinterpret_cast<const char*>(glGetString(GL_VERSION));
-    std::cout << std::format("OpenGL Version: {}\n", version);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
 
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
 
-    glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
-    glViewport(0, 0, windowWidth, windowHeight);
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
+        glViewport(0, 0, windowWidth, windowHeight);
 
 
-    // IMGUI SETUP
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO();
-    (void)io;
+        // IMGUI SETUP
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGuiIO& io = ImGui::GetIO();
+        (void)io;
 
-    ImGui::StyleColorsLight();
+        ImGui::StyleColorsLight();
 
-    ImGuiStyle& style = ImGui::GetStyle();
-    style.ScaleAllSizes(main_scale);
-    style.FontScaleDpi = main_scale;
+        ImGuiStyle& style = ImGui::GetStyle();
+        style.ScaleAllSizes(main_scale);
+        style.FontScaleDpi = main_scale;
 
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330");
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+        ImGui_ImplOpenGL3_Init("#version 330");
+    }
+
+    const char* version =
+      reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    std::cout << std::format("OpenGL Version: {}\n", version);
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_STENCIL_TEST);
@@ -169,10 +334,45 @@ main()
     Shader omniDepthPassThroughShader("VertexShaderOmniShadowMap.glsl",
                                       "GeometryShaderOmniShadowMap.glsl",
                                       "FragmentShaderOmniShadowMap.glsl");
+    // models are uploaded as VertexFormat::Packed, decoded by this vertex
+    // shader, the shadow and light source shaders only read the positions.
+    // With multi draw indirect (--gl 4.3) its model matrices come from the
+    // render queue's draw data buffer.
+    const bool indirectDraws =
+      benchmarkOptions.requestsGL(4, 3) && RenderQueue::supportsIndirect();
     Shader cubeLitWithOmniShadowsNormalParallaxShader(
-      "VertexShaderModelLitOmniShadowsNormalMapParallaxMap.glsl",
+      indirectDraws
+        ? "VertexShaderModelLitOmniShadowsNormalMapParallaxMapPackedIndirect."
+          "glsl"
+        : "VertexShaderModelLitOmniShadowsNormalMapParallaxMapPacked.glsl",
       "FragmentShaderModelLitOmniShadowsNormalMapParallaxMap.glsl");
 
+    // with --gpu-culling the camera and the shadow casters are frustum culled
+    // by a compute shader (GpuCuller), the shadow pass then reads its model
+    // matrices and faces from the culler's buffers instead of uniforms
+    const bool gpuCulling = benchmarkOptions.gpuCulling && indirectDraws &&
+                            GpuCuller::isSupported();
+    if (benchmarkOptions.gpuCulling && !gpuCulling)
+        cout << "ERROR::GPU_CULLER::REQUIRES_GL_4_3" << endl;
+
+    std::unique_ptr<Shader> omniDepthIndirectShader;
+    std::unique_ptr<GpuCuller> shadowCuller, cameraCuller;
+    if (gpuCulling)
+    {
+        omniDepthIndirectShader =
+          std::make_unique<Shader>("VertexShaderOmniShadowMapIndirect.glsl",
+                                   "GeometryShaderOmniShadowMapIndirect.glsl",
+                                   "FragmentShaderOmniShadowMap.glsl");
+        shadowCuller = std::make_unique<GpuCuller>();
+        cameraCuller = std::make_unique<GpuCuller>();
+    }
+    Shader& omniDepthShader =
+      gpuCulling ? *omniDepthIndirectShader : omniDepthPassThroughShader;
+
+    const LightSourceUniforms lightSourceUniforms(lightSourceShader);
+    const OmniShadowUniforms omniShadowUniforms(omniDepthShader);
+    const LitUniforms litUniforms(cubeLitWithOmniShadowsNormalParallaxShader);
+
     string cubePath = "resources/models/textured_cube/walls.obj";
     string brickCubePath = "resources/models/brick_cube/brick.obj";
     string brickParallaxCubePath =
@@ -184,8 +384,77 @@ main()
     string toyPath = "resources/models/toy/Untitled.obj";
     string invertedCubePath = "resources/models/inverted_cube/Untitled.obj";
 
-    Model walls = Model(FileSystem::getPath(invertedCubePath));
-    Model toy = Model(FileSystem::getPath(toyPath));
+    Model walls =
+      Model(FileSystem::getPath(invertedCubePath), VertexFormat::Packed);
+
+    // streamed in the background, a placeholder cube stands in for it until
+    // it is uploaded
+    ModelStreamer modelStreamer(VertexFormat::Packed);
+    std::shared_ptr<StreamedModel> toyStream =
+      modelStreamer.load(FileSystem::getPath(toyPath));
+
+    // ROCK FIELD
+    // a ring of rocks around a planet, far outside of the room. The rocks
+    // are uploaded once in cells of neighbours, the cells in view are drawn
+    // by a few instanced draws per mesh and level of detail.
+    const glm::vec3 rockFieldCenter(0.0f, 0.0f, -300.0f);
+    const float rockFieldRadius = 150.0f, rockFieldSpread = 25.0f;
+    const float rockMinScale = 0.05f, rockMaxScale = 0.25f;
+
+    std::unique_ptr<Shader> instancingShader;
+    std::unique_ptr<InstancingUniforms> instancingUniforms;
+    std::unique_ptr<Model> planet, rock;
+    std::unique_ptr<InstancedModel> planetInstance, rockField;
+
+    if (benchmarkOptions.rockFieldInstances > 0)
+    {
+        instancingShader =
+          std::make_unique<Shader>("VertexShaderInstancingAsteroidsPacked.glsl",
+                                   "FragmentShaderInstancingAsteroids.glsl");
+        instancingUniforms =
+          std::make_unique<InstancingUniforms>(*instancingShader);
+        Material::attach(*instancingShader);
+
+        planet = std::make_unique<Model>(FileSystem::getPath(marsPath),
+                                         VertexFormat::Packed);
+        rock = std::make_unique<Model>(FileSystem::getPath(rockPath),
+                                       VertexFormat::Packed);
+
+        planetInstance = std::make_unique<InstancedModel>(*planet);
+        planetInstance->add(
+          glm::scale(glm::translate(glm::mat4(1.0f), rockFieldCenter),
+                     glm::vec3(4.0f)));
+
+        // fixed seed, every benchmark run draws the same field
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        rockField = std::make_unique<InstancedModel>(*rock);
+        rockField->reserve(benchmarkOptions.rockFieldInstances);
+        for (int i = 0; i < benchmarkOptions.rockFieldInstances; i++)
+        {
+            float angle = unit(random) * glm::radians(360.0f);
+            float distance =
+              rockFieldRadius + (unit(random) * 2.0f - 1.0f) * rockFieldSpread;
+            // flatter than wide
+            float height =
+              (unit(random) * 2.0f - 1.0f) * rockFieldSpread * 0.4f;
+
+            glm::mat4 instance = glm::translate(
+              glm::mat4(1.0f),
+              rockFieldCenter + glm::vec3(std::sin(angle) * distance,
+                                          height,
+                                          std::cos(angle) * distance));
+            instance = glm::rotate(instance,
+                                   unit(random) * glm::radians(360.0f),
+                                   glm::vec3(0.4f, 0.6f, 0.8f));
+            instance = glm::scale(
+              instance,
+              glm::vec3(rockMinScale +
+                        unit(random) * (rockMaxScale - rockMinScale)));
+            rockField->add(instance);
+        }
+    }
 
     // light cube
     vector<glm::vec3> lightCube = { glm::vec3(0, 0, 0),
@@ -238,77 +507,47 @@ main()
     lights.push_back(p1);
     lights.push_back(p2);
 
-    // OMNIDIRECTIONAL SHADOW MAP SETUP
-    const unsigned int SHADOW_WIDTH = 4096, SHADOW_HEIGHT = 4096;
+    LightUniformBuffer lightUniformBuffer;
+    lightUniformBuffer.attach(cubeLitWithOmniShadowsNormalParallaxShader);
 
-    unsigned int depthMapFBO;
-    glGenFramebuffers(1, &depthMapFBO);
+    LightClusters lightClusters;
+    lightClusters.attach(cubeLitWithOmniShadowsNormalParallaxShader);
 
-    unsigned int depthCubemapTextureID;
-    glGenTextures(1, &depthCubemapTextureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemapTextureID);
+    Material::attach(cubeLitWithOmniShadowsNormalParallaxShader);
 
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                     0,
-                     GL_DEPTH_COMPONENT,
-                     SHADOW_WIDTH,
-                     SHADOW_HEIGHT,
-                     0,
-                     GL_DEPTH_COMPONENT,
-                     GL_FLOAT,
-                     NULL);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP,
-                        GL_TEXTURE_WRAP_S,
-                        GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP,
-                        GL_TEXTURE_WRAP_T,
-                        GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP,
-                        GL_TEXTURE_WRAP_R,
-                        GL_CLAMP_TO_EDGE);
-    }
+    // OMNIDIRECTIONAL SHADOW MAP SETUP
+    const unsigned int SHADOW_RESOLUTION = 4096;
+    const float shadowNearPlane = .01f, shadowFarPlane = 25.0f;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture(GL_FRAMEBUFFER,
-                         GL_DEPTH_ATTACHMENT,
-                         depthCubemapTextureID,
-                         0);
+    OmniShadowMap omniShadowMap(SHADOW_RESOLUTION, shadowNearPlane);
+    vector<ShadowCaster> shadowCasters(posScaleRot.size());
 
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
+    // CAMERA FRUSTUM CULLING SETUP
+    const size_t NOT_VISIBLE = SIZE_MAX;
+    FrustumCuller frustumCuller;
+    vector<glm::mat4> objectModels(posScaleRot.size());
+    vector<size_t> objectFirstBoxes(posScaleRot.size());
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    RenderQueue renderQueue(indirectDraws);
+    DrawRanges visibleMeshlets;
 
-    while (!glfwWindowShouldClose(window))
+    // everything but input and presentation, shared by the window and the
+    // headless benchmark
+    auto renderFrame = [&](float time)
     {
-        glfwPollEvents();
+        // STREAMING
+        // a model swapped in changes what the cached shadow map holds
+        if (modelStreamer.update() > 0)
+            omniShadowMap.invalidate();
+        modelStreamStats = modelStreamer.lastFrameStats;
 
-        if (currentRenderMode == IMGUI)
-        {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-
-            ImGui_ImplOpenGL3_NewFrame();
-            ImGui_ImplGlfw_NewFrame();
-            ImGui::NewFrame();
-            createIMGUIui();
-        }
-        else
-        {
-            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-        }
-
-        processInput(window);
+        Model& toy = toyStream->get();
 
         // PHYSICS
-        elapsedTime = (float)glfwGetTime();
+        elapsedTime = time;
 
-        float currentFrame = (float)glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        deltaTime = time - lastFrame;
+        lastFrame = time;
 
         float fast_speed = 2.0;
         float slow_speed = 0.5;
@@ -328,55 +567,6 @@ main()
         redLightCube[0] = redLight->position;
 
         // RENDER SHADOW MAP
-        float aspect = (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT;
-        float near_plane = .01f, far_plane = 25.0f;
-        glm::mat4 shadowProj =
-          glm::perspective(glm::radians(90.0f), aspect, near_plane, far_plane);
-
-        auto lightPos = mainLight->getPosition();
-        std::vector<glm::mat4> shadowTransforms;
-
-        shadowTransforms.push_back(
-          shadowProj * glm::lookAt(lightPos,
-                                   lightPos + glm::vec3(1.0, 0.0, 0.0),
-                                   glm::vec3(0.0, -1.0, 0.0)));
-        shadowTransforms.push_back(
-          shadowProj * glm::lookAt(lightPos,
-                                   lightPos + glm::vec3(-1.0, 0.0, 0.0),
-                                   glm::vec3(0.0, -1.0, 0.0)));
-
-        shadowTransforms.push_back(
-          shadowProj * glm::lookAt(lightPos,
-                                   lightPos + glm::vec3(0.0, 1.0, 0.0),
-                                   glm::vec3(0.0, 0.0, 1.0)));
-        shadowTransforms.push_back(
-          shadowProj * glm::lookAt(lightPos,
-                                   lightPos + glm::vec3(0.0, -1.0, 0.0),
-                                   glm::vec3(0.0, 0.0, -1.0)));
-
-        shadowTransforms.push_back(
-          shadowProj * glm::lookAt(lightPos,
-                                   lightPos + glm::vec3(0.0, 0.0, 1.0),
-                                   glm::vec3(0.0, -1.0, 0.0)));
-        shadowTransforms.push_back(
-          shadowProj * glm::lookAt(lightPos,
-                                   lightPos + glm::vec3(0.0, 0.0, -1.0),
-                                   glm::vec3(0.0, -1.0, 0.0)));
-
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-
-        omniDepthPassThroughShader.use();
-        for (int i = 0; i < shadowTransforms.size(); ++i)
-        {
-            omniDepthPassThroughShader.setMat4("shadowMatrices[" +
-                                                 std::to_string(i) + "]",
-                                               shadowTransforms[i]);
-        }
-        omniDepthPassThroughShader.setFloat("far_plane", far_plane);
-        omniDepthPassThroughShader.setVec3("lightPos", lightPos);
-
         for (int i = 0; i < posScaleRot.size(); i++)
         {
             auto vectors = posScaleRot[i];
@@ -385,88 +575,276 @@ main()
             model = glm::rotate(model, vectors[3].x, vectors[2]);
             model = glm::scale(model, vectors[1]);
 
-            omniDepthPassThroughShader.setMat4("model", model);
+            shadowCasters[i].model = model;
+            shadowCasters[i].bounds = i == 0 ? walls.bounds : toy.bounds;
+        }
+
+        // only the faces touched by a caster that moved are redrawn, all of
+        // them when the light moved
+        if (omniShadowMap.update(mainLight->getPosition(),
+                                 shadowFarPlane,
+                                 shadowCasters))
+        {
+            omniShadowMap.beginRender();
 
-            if (i == 0)
+            omniDepthShader.use();
+            for (int i = 0; i < 6; ++i)
             {
-                walls.Draw(omniDepthPassThroughShader);
+                omniDepthShader.set(omniShadowUniforms.shadowMatrices[i],
+                                    omniShadowMap.getShadowTransforms()[i]);
             }
-            else
+            omniDepthShader.set(omniShadowUniforms.farPlane, shadowFarPlane);
+            omniDepthShader.set(omniShadowUniforms.lightPos,
+                                omniShadowMap.getLightPos());
+
+            // a cube face covers 90 degrees over the map's resolution
+            const LodSelector shadowLods(omniShadowMap.getLightPos(),
+                                         90.0f,
+                                         (float)omniShadowMap.getResolution());
+
+            // the GPU culls every mesh of a caster against the faces it was
+            // found to touch, each mesh is drawn to the faces it is in only
+            if (gpuCulling)
             {
-                toy.Draw(omniDepthPassThroughShader);
+                shadowCuller->clear();
+                for (size_t i = 0; i < shadowCasters.size(); i++)
+                {
+                    unsigned int faceMask = omniShadowMap.getFaceMask(i);
+                    if (faceMask == 0)
+                        continue;
+
+                    Model& caster = i == 0 ? walls : toy;
+                    for (Mesh& mesh : caster.meshes)
+                    {
+                        shadowCuller->add(
+                          omniDepthShader,
+                          mesh,
+                          shadowCasters[i].model,
+                          shadowLods.select(mesh, shadowCasters[i].model),
+                          faceMask);
+                    }
+                }
+                shadowCuller->cull(omniShadowMap.getFaceFrusta(), 6);
+                shadowCuller->draw();
             }
-        }
 
-        glViewport(0, 0, windowWidth, windowHeight);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            for (size_t i = 0; i < shadowCasters.size() && !gpuCulling; i++)
+            {
+                unsigned int faceMask = omniShadowMap.getFaceMask(i);
+                if (faceMask == 0)
+                    continue;
+
+                omniDepthShader.set(omniShadowUniforms.faceMask,
+                                    (int)faceMask);
+
+                if (i == 0)
+                {
+                    walls.Draw(omniDepthShader,
+                               omniShadowUniforms.model,
+                               shadowCasters[i].model,
+                               shadowLods);
+                }
+                else
+                {
+                    toy.Draw(omniDepthShader,
+                             omniShadowUniforms.model,
+                             shadowCasters[i].model,
+                             shadowLods);
+                }
+            }
+
+            omniShadowMap.endRender();
+            glViewport(0, 0, windowWidth, windowHeight);
+        }
+        omniShadowMap.bindTexture(0);
+        omniShadowStats = omniShadowMap.lastFrameStats;
         // SHADOW MAP DONE
 
         // RENDER NORMAL SCENE
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, mainFramebuffer);
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         view = camera.GetViewMatrix();
         projection = glm::perspective(glm::radians(camera.Zoom),
                                       (float)windowWidth / (float)windowHeight,
-                                      0.1f,
-                                      1000.0f);
-
-        cubeLitWithOmniShadowsNormalParallaxShader.use();
-        cubeLitWithOmniShadowsNormalParallaxShader.setBool("wireframeMode", wireframeMode);
+                                      cameraNearPlane,
+                                      cameraFarPlane);
+
+        // LIGHT CULLING
+        lightClusters.update(lights,
+                             view,
+                             projection,
+                             cameraNearPlane,
+                             cameraFarPlane,
+                             windowWidth,
+                             windowHeight);
+        lightUniformBuffer.update(lights, lightClusters.getGrid());
+        lightClusters.bind();
+        lightClusterStats = lightClusters.lastFrameStats;
+
+        Shader& litShader = cubeLitWithOmniShadowsNormalParallaxShader;
+
+        litShader.use();
+        litShader.set(litUniforms.wireframeMode, wireframeMode);
 
         // glActiveTexture(GL_TEXTURE0);
-        cubeLitWithOmniShadowsNormalParallaxShader.setInt("omniShadowMap", 0);
-        cubeLitWithOmniShadowsNormalParallaxShader.setFloat("far_plane",
-                                                            far_plane);
+        litShader.set(litUniforms.omniShadowMap, 0);
+        litShader.set(litUniforms.farPlane, shadowFarPlane);
 
         // parallax mapping
-        cubeLitWithOmniShadowsNormalParallaxShader.setFloat("parallax_strength",
-                                                            parallax_strength);
-        cubeLitWithOmniShadowsNormalParallaxShader.setFloat(
-          "parallax_max_layers",
-          parallax_max_layers);
+        litShader.set(litUniforms.parallaxStrength, parallax_strength);
+        litShader.set(litUniforms.parallaxMaxLayers,
+                      (float)parallax_max_layers);
 
         // parallax self shadowing
-        cubeLitWithOmniShadowsNormalParallaxShader.setBool(
-          "parallax_self_shadow",
-          parallax_self_shadow);
-        cubeLitWithOmniShadowsNormalParallaxShader.setFloat(
-          "parallax_self_shadow_exponent",
-          parallax_self_shadow_exponent);
+        litShader.set(litUniforms.parallaxSelfShadow, parallax_self_shadow);
+        litShader.set(litUniforms.parallaxSelfShadowExponent,
+                      parallax_self_shadow_exponent);
+
+        // FRUSTUM CULLING
+        // whole models are rejected by their bounding sphere, the meshes of
+        // the remaining ones are tested by their boxes in one batch
+        const Frustum cameraFrustum(projection * view);
+        frustumCuller.clear();
+        unsigned int meshCount = 0, sphereCulledMeshes = 0;
 
         for (int i = 0; i < posScaleRot.size(); i++)
         {
             auto vectors = posScaleRot[i];
+            Model& object = i == 0 ? walls : toy;
 
             model = glm::mat4(1.0f);
             model = glm::translate(model, vectors[0]);
             model = glm::scale(model, vectors[1]);
             model = glm::rotate(model, vectors[3].x, vectors[2]);
 
-            for (auto light : lights)
+            objectModels[i] = model;
+            meshCount += (unsigned int)object.meshes.size();
+
+            // culled on the GPU below
+            if (gpuCulling)
+                continue;
+
+            if (!cameraFrustum.intersects(
+                  object.boundingSphere.transformed(model)))
+            {
+                objectFirstBoxes[i] = NOT_VISIBLE;
+                sphereCulledMeshes += (unsigned int)object.meshes.size();
+                continue;
+            }
+
+            objectFirstBoxes[i] = frustumCuller.size();
+            for (const Mesh& mesh : object.meshes)
             {
-                light.get()->setUniforms(
-                  cubeLitWithOmniShadowsNormalParallaxShader);
+                frustumCuller.add(mesh.bounds.transformed(model));
             }
+        }
+
+        frustumCuller.cull(cameraFrustum);
+        sphereCullStats.tested = meshCount;
+        sphereCullStats.culled = sphereCulledMeshes;
+        frustumCullStats = frustumCuller.lastStats;
+
+        litShader.set(litUniforms.view, view);
+        litShader.set(litUniforms.projection, projection);
+        litShader.set(litUniforms.viewPos, camera.Position);
+
+        renderQueue.clear();
+
+        const LodSelector cameraLods(
+          camera.Position, camera.Zoom, (float)windowHeight);
+        lodStats = LodStats();
 
-            cubeLitWithOmniShadowsNormalParallaxShader.setMat4("model", model);
-            cubeLitWithOmniShadowsNormalParallaxShader.setMat4("view", view);
-            cubeLitWithOmniShadowsNormalParallaxShader.setMat4("projection",
-                                                               projection);
-            cubeLitWithOmniShadowsNormalParallaxShader.setVec3("viewPos",
-                                                               camera.Position);
+        // full detail meshes are drawn by their visible meshlets only,
+        // dropping the back facing ones. The shadow pass draws whole meshes,
+        // faces away from the camera still cast shadows.
+        const MeshletCuller meshletCuller(cameraFrustum, camera.Position);
+        meshletCullStats = MeshletCullStats();
 
-            if (i == 0)
+        // every mesh is sent to the GPU culler, which draws the visible ones
+        // in one multi draw per batch. Meshlets are not culled, the triangle
+        // count is the one of the meshes before culling.
+        if (gpuCulling)
+        {
+            cameraCuller->clear();
+            for (int i = 0; i < posScaleRot.size(); i++)
             {
-                walls.Draw(cubeLitWithOmniShadowsNormalParallaxShader);
+                Model& object = i == 0 ? walls : toy;
+                for (Mesh& mesh : object.meshes)
+                {
+                    unsigned int lod =
+                      cameraLods.select(mesh, objectModels[i]);
+                    lodStats.fullTriangles += mesh.lods[0].indexCount / 3;
+                    lodStats.triangles += mesh.lods[lod].indexCount / 3;
+                    cameraCuller->add(litShader, mesh, objectModels[i], lod);
+                }
             }
-            else
+            cameraCuller->cull(&cameraFrustum, 1);
+            cameraCuller->draw();
+            gpuCullStats = cameraCuller->lastStats;
+        }
+
+        for (int i = 0; i < posScaleRot.size() && !gpuCulling; i++)
+        {
+            if (objectFirstBoxes[i] == NOT_VISIBLE)
+                continue;
+
+            Model& object = i == 0 ? walls : toy;
+
+            for (size_t j = 0; j < object.meshes.size(); j++)
             {
-                toy.Draw(cubeLitWithOmniShadowsNormalParallaxShader);
+                if (!frustumCuller.isVisible(objectFirstBoxes[i] + j))
+                    continue;
+
+                glm::vec3 center =
+                  object.meshes[j].bounds.transformed(objectModels[i])
+                    .getCenter();
+                float depth = -(view * glm::vec4(center, 1.0f)).z;
+
+                Mesh& mesh = object.meshes[j];
+                unsigned int lod = cameraLods.select(mesh, objectModels[i]);
+                lodStats.fullTriangles += mesh.lods[0].indexCount / 3;
+
+                if (lod == 0 && meshletCuller.cull(mesh,
+                                                   objectModels[i],
+                                                   visibleMeshlets,
+                                                   meshletCullStats))
+                {
+                    for (GLsizei count : visibleMeshlets.counts)
+                    {
+                        lodStats.triangles += count / 3;
+                    }
+
+                    if (visibleMeshlets.empty())
+                        continue;
+
+                    renderQueue.submit(RENDER_PASS_OPAQUE,
+                                       litShader,
+                                       litUniforms.model,
+                                       mesh,
+                                       objectModels[i],
+                                       depth / cameraFarPlane,
+                                       lod,
+                                       &visibleMeshlets);
+                    continue;
+                }
+
+                lodStats.triangles += mesh.lods[lod].indexCount / 3;
+                renderQueue.submit(RENDER_PASS_OPAQUE,
+                                   litShader,
+                                   litUniforms.model,
+                                   mesh,
+                                   objectModels[i],
+                                   depth / cameraFarPlane,
+                                   lod);
             }
         }
 
+        renderQueue.sort();
+        renderQueue.execute();
+        renderQueueStats = renderQueue.lastStats;
+
         lightSourceShader.use();
 
         model = glm::mat4(1.0f);
@@ -474,24 +852,132 @@ main()
         model = glm::scale(model, lightCube[1]);
         model = glm::rotate(model, lightCube[3].x, lightCube[2]);
 
-        lightSourceShader.setMat4("model", model);
-        lightSourceShader.setMat4("view", view);
-        lightSourceShader.setMat4("projection", projection);
-        lightSourceShader.setVec3("lightColor", glm::vec3(1.0f));
-        walls.Draw(lightSourceShader);
+        lightSourceShader.set(lightSourceUniforms.view, view);
+        lightSourceShader.set(lightSourceUniforms.projection, projection);
+        lightSourceShader.set(lightSourceUniforms.lightColor, glm::vec3(1.0f));
+        walls.Draw(lightSourceShader, lightSourceUniforms.model, model);
 
         model = glm::mat4(1.0f);
         model = glm::translate(model, redLightCube[0]);
         model = glm::scale(model, redLightCube[1]);
         model = glm::rotate(model, redLightCube[3].x, redLightCube[2]);
 
-        lightSourceShader.setMat4("model", model);
-        lightSourceShader.setMat4("view", view);
-        lightSourceShader.setMat4("projection", projection);
-        lightSourceShader.setVec3("lightColor", glm::vec3(1.0f, 0.0f, 0.0f));
-        walls.Draw(lightSourceShader);
+        lightSourceShader.set(lightSourceUniforms.view, view);
+        lightSourceShader.set(lightSourceUniforms.projection, projection);
+        lightSourceShader.set(lightSourceUniforms.lightColor,
+                              glm::vec3(1.0f, 0.0f, 0.0f));
+        walls.Draw(lightSourceShader, lightSourceUniforms.model, model);
+
+        if (rockField)
+        {
+            instancingShader->use();
+            instancingShader->set(instancingUniforms->view, view);
+            instancingShader->set(instancingUniforms->projection, projection);
+            instancingShader->set(instancingUniforms->viewPos,
+                                  camera.Position);
+
+            planetInstance->Draw(*instancingShader,
+                                 instancingUniforms->vertexTransform,
+                                 cameraFrustum,
+                                 cameraLods);
+            rockField->Draw(*instancingShader,
+                            instancingUniforms->vertexTransform,
+                            cameraFrustum,
+                            cameraLods);
+            rockFieldStats = rockField->lastStats;
+        }
 
         skybox.Draw(projection, view);
+    };
+
+    if (headless)
+    {
+        BenchmarkResults results;
+
+        // measure the scene itself, not the streaming
+        modelStreamer.finish();
+
+        // scripted orbit around the toy at a fixed time step, every run
+        // renders the same frames whatever the frame rate
+        const glm::vec3 orbitCenter(0.0f, 0.5f, 0.0f);
+        const float orbitRadius = 3.0f, orbitSpeed = 0.5f;
+
+        int totalFrames =
+          benchmarkOptions.warmupFrames + benchmarkOptions.frames;
+        for (int frame = 0; frame < totalFrames; frame++)
+        {
+            Shader::beginFrame();
+            GLState::beginFrame();
+
+            float time = frame / 60.0f;
+            float angle = time * orbitSpeed;
+            camera.Position =
+              orbitCenter + glm::vec3(std::cos(angle) * orbitRadius,
+                                      1.0f,
+                                      std::sin(angle) * orbitRadius);
+            camera.LookAt(orbitCenter);
+
+            // glFinish so the frame time covers the GPU work and not only
+            // the command submission
+            auto frameStart = std::chrono::steady_clock::now();
+            renderFrame(time);
+            glFinish();
+            auto frameEnd = std::chrono::steady_clock::now();
+
+            if (frame >= benchmarkOptions.warmupFrames)
+            {
+                results.addFrame(std::chrono::duration<double, std::milli>(
+                                   frameEnd - frameStart)
+                                   .count());
+            }
+        }
+
+        string renderer =
+          reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+
+        if (benchmarkOptions.outputPath.empty())
+        {
+            results.write(std::cout, renderer, windowWidth, windowHeight);
+        }
+        else
+        {
+            std::ofstream reportFile(benchmarkOptions.outputPath);
+            if (!reportFile)
+            {
+                std::cout << "ERROR::BENCHMARK::CANNOT_WRITE_REPORT "
+                          << benchmarkOptions.outputPath << std::endl;
+                return -1;
+            }
+            results.write(reportFile, renderer, windowWidth, windowHeight);
+        }
+
+        return 0;
+    }
+
+    while (!glfwWindowShouldClose(window))
+    {
+        glfwPollEvents();
+
+        Shader::beginFrame();
+        GLState::beginFrame();
+
+        if (currentRenderMode == IMGUI)
+        {
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            createIMGUIui();
+        }
+        else
+        {
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+        }
+
+        processInput(window);
+
+        renderFrame((float)glfwGetTime());
 
         updateWindowNameWithFPS(window, title);
 
@@ -672,6 +1158,88 @@ createIMGUIui()
                      1.0f,
                      2.5f);
 
+    ImGui::SeparatorText("Frame statistics");
+    ImGui::Text("uniform lookups: %u", Shader::lastFrameStats.lookups);
+    ImGui::Text("uniform sets: %u (%u skipped)",
+                Shader::lastFrameStats.sets,
+                Shader::lastFrameStats.skipped);
+    ImGui::Text("program binds: %u (%u skipped)",
+                GLState::lastFrameStats.programBinds,
+                GLState::lastFrameStats.programBindsSkipped);
+    ImGui::Text("texture binds: %u (%u skipped)",
+                GLState::lastFrameStats.textureBinds,
+                GLState::lastFrameStats.textureBindsSkipped);
+    ImGui::Text("vertex array binds: %u (%u skipped)",
+                GLState::lastFrameStats.vertexArrayBinds,
+                GLState::lastFrameStats.vertexArrayBindsSkipped);
+    ImGui::Text("clustered lights: %u", lightClusterStats.lights);
+    ImGui::Text("light indices: %u (max %u per cluster)",
+                lightClusterStats.indices,
+                lightClusterStats.maxLightsPerCluster);
+    ImGui::Text("omni shadow faces redrawn: %u (%u caster faces, %u redraws)",
+                omniShadowStats.redrawnFaces,
+                omniShadowStats.faceDraws,
+                omniShadowStats.redraws);
+    ImGui::Text("omni shadow casters in range: %u",
+                omniShadowStats.castersInRange);
+    // with --gpu-culling nothing is culled on the CPU, the GPU's culled
+    // count is not read back
+    if (gpuCullStats.instances > 0)
+    {
+        ImGui::Text("meshes culled on the gpu: %u tested, %u draw calls",
+                    gpuCullStats.instances,
+                    gpuCullStats.drawCalls);
+    }
+    else
+    {
+        ImGui::Text("meshes culled by model sphere: %u / %u",
+                    sphereCullStats.culled,
+                    sphereCullStats.tested);
+        ImGui::Text("meshes culled by box: %u / %u",
+                    frustumCullStats.culled,
+                    frustumCullStats.tested);
+    }
+    ImGui::Text("triangles drawn: %u / %u (levels of detail)",
+                lodStats.triangles,
+                lodStats.fullTriangles);
+    ImGui::Text("meshlets culled: %u back facing, %u outside / %u",
+                meshletCullStats.backfacing,
+                meshletCullStats.outsideFrustum,
+                meshletCullStats.tested);
+    ImGui::Text("draw calls: %u for %u draws%s",
+                renderQueueStats.drawCalls,
+                renderQueueStats.draws,
+                renderQueueStats.indirect ? " (multi draw indirect)" : "");
+    if (rockFieldStats.instances > 0)
+    {
+        ImGui::Text("rock field: %u / %u instances, %u / %u cells in %u "
+                    "draw calls (%zu bytes uploaded)",
+                    rockFieldStats.visible,
+                    rockFieldStats.instances,
+                    rockFieldStats.visibleCells,
+                    rockFieldStats.cells,
+                    rockFieldStats.drawCalls,
+                    rockFieldStats.uploadedBytes);
+    }
+    ImGui::Text("models streaming: %u (%zu bytes uploaded)",
+                modelStreamStats.pendingModels,
+                modelStreamStats.uploadedBytes);
+    for (VertexFormat format : { VertexFormat::Float, VertexFormat::Packed })
+    {
+        const GeometryBuffer& geometry = Mesh::getGeometryBuffer(format);
+        ImGui::Text("%s geometry: %u meshes, %zu / %zu KB (%u relocations)",
+                    format == VertexFormat::Packed ? "packed" : "float",
+                    geometry.stats.allocations,
+                    (geometry.getVertexBytes() + geometry.getIndexBytes()) /
+                      1024,
+                    geometry.getCapacityBytes() / 1024,
+                    geometry.stats.relocations);
+    }
+    ImGui::Text("textures cached: %u (%u hits, %u misses)",
+                TextureCache::shared().stats.textures,
+                TextureCache::shared().stats.hits,
+                TextureCache::shared().stats.misses);
+
     // if (ImGui::Button("Button"))
     //     counter++;
     // ImGui::SameLine();
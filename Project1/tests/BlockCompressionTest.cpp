@@ -0,0 +1,92 @@
+// Standalone checks of the BC1 color encoder, not part of the Visual Studio
+// project. Only needs the header:
+//   g++ -std=c++17 -I.. BlockCompressionTest.cpp && ./a.out
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "BlockCompression.h"
+
+// root mean square error of the decoded block against the texels
+static float
+getBlockError(const float texels[16][3], const unsigned char* block)
+{
+    uint16_t color0, color1;
+    uint32_t bits;
+    std::memcpy(&color0, block, 2);
+    std::memcpy(&color1, block + 2, 2);
+    std::memcpy(&bits, block + 4, 4);
+
+    float palette[4][3];
+    BlockCompression::getPalette(color0, color1, palette);
+
+    float error = 0.0f;
+    for (int i = 0; i < 16; i++)
+    {
+        int index = bits >> (2 * i) & 3;
+        for (int c = 0; c < 3; c++)
+        {
+            float difference = palette[index][c] - texels[i][c];
+            error += difference * difference;
+        }
+    }
+    return std::sqrt(error / 48.0f);
+}
+
+static bool
+check(const char* name, const float texels[16][3], float maxError)
+{
+    unsigned char block[8];
+    BlockCompression::encodeColorBlock(texels, block);
+
+    uint16_t color0, color1;
+    std::memcpy(&color0, block, 2);
+    std::memcpy(&color1, block + 2, 2);
+    float error = getBlockError(texels, block);
+
+    bool passed = color0 != color1 && error <= maxError;
+    std::cout << (passed ? "PASSED " : "FAILED ") << name << " rmse "
+              << error << std::endl;
+    return passed;
+}
+
+int
+main()
+{
+    bool passed = true;
+
+    // red and green change in opposite directions, the principal axis is
+    // orthogonal to (1, 1, 1)
+    float checker[16][3];
+    for (int i = 0; i < 16; i++)
+    {
+        bool red = (i % 4 + i / 4) % 2 == 0;
+        checker[i][0] = red ? 255.0f : 0.0f;
+        checker[i][1] = red ? 0.0f : 255.0f;
+        checker[i][2] = 0.0f;
+    }
+    passed &= check("red/green checker", checker, 1.0f);
+
+    float gradient[16][3];
+    for (int i = 0; i < 16; i++)
+    {
+        gradient[i][0] = 255.0f * i / 15.0f;
+        gradient[i][1] = 255.0f - gradient[i][0];
+        gradient[i][2] = 0.0f;
+    }
+    passed &= check("red to green gradient", gradient, 16.0f);
+
+    // blue against red and green
+    float anticorrelated[16][3];
+    for (int i = 0; i < 16; i++)
+    {
+        float t = i / 15.0f;
+        anticorrelated[i][0] = 200.0f * t;
+        anticorrelated[i][1] = 160.0f * t;
+        anticorrelated[i][2] = 220.0f * (1.0f - t);
+    }
+    passed &= check("blue against yellow", anticorrelated, 16.0f);
+
+    return passed ? 0 : 1;
+}